@@ -0,0 +1,63 @@
+#ifndef CODEGEN_INCLUDED
+#define CODEGEN_INCLUDED
+
+#include <stdio.h>
+
+#include "differ.h"
+
+/// @brief one instruction of the linear code, operands are indices of previous instructions
+typedef struct {
+    enum elem_type type;
+    enum oper op;
+
+    double number;
+    unsigned int var;
+
+    size_t left;
+    size_t right;
+} instr_t;
+
+/// @brief expressions compiled to linear code, equal subexpressions are computed once
+typedef struct {
+    instr_t * instrs;
+    size_t size;
+    size_t capacity;
+
+    size_t * outputs;
+    size_t outputs_num;
+    size_t outputs_capacity;
+
+    size_t * table;     ///< open addressing table of instruction indices for merging equal instructions
+    size_t table_capacity;
+} expr_code_t;
+
+/// @brief makes empty code
+expr_code_t codeCtor();
+
+/// @brief destructs code
+void codeDtor(expr_code_t * code);
+
+/// @brief adds tree as a new output of the code, returns index of the output
+size_t codeAddTree(expr_code_t * code, node_t * node);
+
+/// @brief rewrites code to avoid slow operations: integer powers become chains of multiplications,
+///        division by constant becomes multiplication by reciprocal, operations of constants (factorials)
+///        are precomputed and logarithm of the base of LOG is a separate shared instruction,
+///        results may differ from calcOper() in the last bits
+void codeStrengthReduce(expr_code_t * code);
+
+/// @brief evaluates all outputs of the code, regs must have code->size elements
+void codeEvaluate(const expr_code_t * code, const double * var_values, double * regs, double * outputs);
+
+/// @brief writes C function name(vars...) returning value of the expression and name_array() for arrays of points
+void emitC(diff_t * diff, node_t * node, const char * name, FILE * file);
+
+/// @brief writes C function name_grad(vars..., out) computing value and all partial derivatives (out[0] is value)
+///        and name_grad_array() for arrays of points, returns false and writes nothing if some derivative
+///        has no rule (factorial, log)
+bool emitCGradient(diff_t * diff, node_t * node, const char * name, FILE * file);
+
+/// @brief writes C functions computing all outputs of the code
+void emitCCode(diff_t * diff, expr_code_t * code, const char * name, FILE * file);
+
+#endif
@@ -4,58 +4,71 @@
 #include <stdint.h>
 
 #include "bintree.h"
-#include "hashtable.h"
+#include "expr_types.h"
+#include "sym_table.h"
+#include "stats.h"
+#include "thread_pool.h"
 
 #define  val_(node) (((expr_elem_t *)node->data)->val)
 #define type_(node) (((expr_elem_t *)node->data)->type)
 
-enum elem_type{
-    NUM = 0,
-    OPR = 1,
-    VAR = 2
-};
-
-enum oper{
-    ADD = 0,
-    SUB,
-    MUL,
-    DIV,
-    POW,
-    SIN,
-    COS,
-    TAN,
-    LN,
-    LOG,
-    FAC
-};
-
 typedef struct {
     enum elem_type type;
+    bool stale_hash;    ///< operand was changed in place (expandDeferred), exprHash() recomputes hash on demand
+
     union {
         double number;
         unsigned int var;
         enum oper op;
     } val;
+
+    uint64_t hash;      ///< structural hash of the subtree, see exprHash()
 } expr_elem_t;
 
+/// max length of names in the input
 const size_t NAME_MAX_LEN = 64;
 
 typedef struct {
-    char name[NAME_MAX_LEN];
-    double value;
-} var_t;
+    sym_table_t oper_table;     ///< name of operation -> its index in opers
+    sym_table_t  var_table;     ///< name of variable  -> its index in var_names and var_values
 
-const size_t MAX_VAR_NUM = 16;
+    char ** var_names;          ///< names by index for dumps, var_table keeps its own copy for lookups
+    double * var_values;        ///< dense values, evaluators read them without copying
+    unsigned int var_num;
+    size_t var_capacity;
+
+    diff_stats_t stats;
+} diff_t;
 
+/// rule of derivative, gets ready (or deferred) derivatives of operands (d_right is NULL for unary) and owns them,
+/// if consume is true the rule also owns operands of expr_node and moves them to the result at their last use
+typedef node_t * (*diff_func_t)(node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
+
+/// @brief limits of resources for kept derivatives, 0 means no limit,
+///        peak memory while one derivative is made can be higher (temporary derivatives of operands)
+typedef struct {
+    size_t max_nodes;
+    size_t max_bytes;
+} diff_budget_t;
+
+/// @brief status of the sequence of derivatives
+typedef enum {
+    DERIV_SUCCESS = 0,
+    DERIV_BUDGET_EXCEEDED,
+    DERIV_NOT_DIFFERENTIABLE
+} deriv_status_t;
+
+/// @brief sequence of simplified derivatives, derivatives[k] is k-th derivative, derivatives[0] is copy of expression
 typedef struct {
-    table_t oper_table;
-    table_t  var_table;
+    node_t ** derivatives;
+    size_t  * node_counts;
+    size_t orders_num;
 
-    var_t vars[MAX_VAR_NUM];
-    unsigned int var_num;
-} diff_t;
+    size_t total_nodes;
+    unsigned int var_index;
 
-typedef node_t * (*diff_func_t)(diff_t *, node_t *, unsigned int);
+    deriv_status_t status;
+} nth_derivative_t;
 
 typedef struct {
     const char * name;
@@ -72,6 +85,9 @@ typedef struct {
 /// @brief evaluates the value of tree with the node as a root
 double evaluate(diff_t * diff, node_t * node);
 
+/// @brief evaluates the value of tree taking variables from var_values instead of diff, does not change any shared state
+double evaluateWithValues(node_t * node, const double * var_values);
+
 double calcOper(enum oper op_num, double left_val, double right_val);
 
 /// @brief reads equation in prefix form from the input_file
@@ -83,6 +99,22 @@ void exprElemToStr(char * str, void * data);
 /// @brief asking user to insert variables values
 void setVariables(diff_t * diff);
 
+/// @brief makes derivatives up to the order-th simplifying between orders,
+///        stops with status when next derivative would exceed budget (NULL - no budget)
+nth_derivative_t makeNthDerivative(diff_t * diff, node_t * expr_node, unsigned int var_index, size_t order, const diff_budget_t * budget);
+
+/// @brief continues sequence of derivatives up to the order-th reusing already made ones
+deriv_status_t extendNthDerivative(diff_t * diff, nth_derivative_t * nth, size_t order, const diff_budget_t * budget);
+
+/// @brief destructs sequence of derivatives
+void nthDerivativeDtor(nth_derivative_t * nth);
+
+/// @brief evaluates derivatives of orders [0, members_num) at the point (derivatives[order]),
+///        returns number of evaluated ones: less if some derivative cannot be made,
+///        the variable is registered (diffReserveVars) if there is no such one yet
+size_t taylorDerivatives(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point,
+                         size_t members_num, double * derivatives);
+
 /// @brief make taylor series for the function
 node_t * taylorSeries(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point, size_t last_member_index);
 
@@ -97,6 +129,9 @@ node_t * deleteNeutral(node_t * node, node_t * parent, bool * changed_tree);
 /// @brief simplifies expression, uses foldConstants and deleteNeutral in cycle
 node_t * simplifyExpression(node_t * node);
 
+/// @brief same as simplifyExpression(), big independent subtrees are simplified by tasks on the pool (NULL - serially)
+node_t * simplifyExpressionParallel(node_t * node, thread_pool_t * pool);
+
 /*------------------------------------------------------------------------------------------*/
 
 /// @brief makes new operation node
@@ -108,14 +143,63 @@ node_t * newNumNode(double num);
 /// @brief makes new variable node
 node_t * newVarNode(unsigned int var_index);
 
+/// @brief makes new deferred derivative node, takes ownership of the expression
+node_t * newDrvNode(node_t * expr_node, unsigned int var_index);
+
+/// @brief copies tree, counted in statistics
+node_t * exprCopy(node_t * node);
+
+/// @brief structural hash of the tree kept in its root, equal trees have equal hashes,
+///        operands of commutative operations are hashed in any order (a+b and b+a have the same hash).
+///        Simplification and expansion of deferred derivatives keep hashes up to date,
+///        after other changes in place use exprRehash()
+uint64_t exprHash(const node_t * node);
+
+/// @brief recomputes hash of the node from hashes of its operands
+void exprRehash(node_t * node);
+
+/// @brief recomputes hashes of all nodes of the tree
+void exprRehashTree(node_t * node);
+
+/// @brief checks if trees are the same, trees with different hashes are rejected at once
+bool exprEqual(const node_t * first, const node_t * second);
+
+/// @brief checks if trees are the same up to order of operands of commutative operations
+bool exprEqualCommutative(const node_t * first, const node_t * second);
+
+/// @brief hashes of nodes made from hashes of operands, used by other representations of expressions
+uint64_t exprHashNum(double number);
+
+uint64_t exprHashVar(unsigned int var_index);
+
+uint64_t exprHashOpr(enum oper op_num, uint64_t left_hash, uint64_t right_hash);
+
+/// @brief destroys tree, counted in statistics
+void exprDestroy(node_t * node);
+
+/// @brief deletes one node, counted in statistics
+void exprDelNode(node_t * node);
+
 /// @brief finds variable in table and if there is not - makes new, returns pointer to node with variable
 node_t * getVarNode(diff_t * diff, char * var_name);
 
+/// @brief registers variables with generated names x_k until there are var_num of them
+void diffReserveVars(diff_t * diff, unsigned int var_num);
+
 /// @brief counts variables in the tree
 size_t countVars(node_t * node, unsigned int var_index);
 
-/// @brief calculates factorial of the number
-long unsigned int factorial(long unsigned int number);
+/// @brief marks variables that are in the tree: vars_in_tree[var_index] = true
+void collectVars(node_t * node, bool * vars_in_tree);
+
+/// @brief counts nodes in the tree, deferred derivatives are not expanded
+size_t treeSize(node_t * node);
+
+/// factorial of bigger numbers is infinite in double
+const double MAX_FACTORIAL_ARG = 170.;
+
+/// @brief calculates factorial of the number, exact up to 22!
+double factorial(long unsigned int number);
 
 /*------------------------------------------------------------------------------------------*/
 
@@ -131,28 +215,53 @@ void diffDump(diff_t * diff);
 const uint32_t NUM_COLOR = 0xAAFFAAFF;
 const uint32_t VAR_COLOR = 0xFFAAAAFF;
 const uint32_t OPR_COLOR = 0xFFFFAAFF;
+const uint32_t DRV_COLOR = 0xAAAAFFFF;
 
 /*------------------------------------------------------------------------------------------*/
 
-/// @brief makes derivative of the expression
+/// @brief makes derivative of the expression, NULL if some operation has no derivative rule
 node_t * makeDerivative(diff_t * diff, node_t * expr_node, unsigned int var_index);
 
+/// @brief makes derivative taking ownership of the expression, its subtrees are moved to the result
+///        where they are used once and copied only when needed several times,
+///        NULL if some operation has no derivative rule, then the expression is not consumed
+node_t * makeDerivativeConsume(diff_t * diff, node_t * expr_node, unsigned int var_index);
+
+/// @brief makes the same derivative as makeDerivative(), derivatives of big independent subtrees are made
+///        by tasks on the pool (NULL - serially), only the part of the tree above them is made serially
+node_t * makeDerivativeParallel(diff_t * diff, node_t * expr_node, unsigned int var_index, thread_pool_t * pool);
+
+/// @brief makes deferred derivative of the copy of expression, rules are applied only to the parts
+///        that evaluation, simplification, printing or other traversals touch,
+///        NULL if some operation has no derivative rule (it is checked at once, not on expansion)
+node_t * makeDerivativeLazy(diff_t * diff, node_t * expr_node, unsigned int var_index);
+
+/// @brief expands deferred derivative in place (node keeps its address) until node is not DRV,
+///        derivatives of operands stay deferred
+void expandDeferred(node_t * node);
+
+/// @brief expands all deferred derivatives in the tree, must be called before the tree is shared between threads
+void expandAllDeferred(node_t * node);
+
+/// @brief predicts number of nodes in makeDerivative result without making it, SIZE_MAX if there is no rule
+size_t derivativeSize(node_t * expr_node, unsigned int var_index);
+
 
-node_t * diffAddSub(diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffAddSub(node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
-node_t * diffMul   (diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffMul   (node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
-node_t * diffDiv   (diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffDiv   (node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
-node_t * diffPow   (diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffPow   (node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
-node_t * diffSin   (diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffSin   (node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
-node_t * diffCos   (diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffCos   (node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
-node_t * diffTan   (diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffTan   (node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
-node_t * diffLn    (diff_t * diff, node_t * expr_node, unsigned int var_index);
+node_t * diffLn    (node_t * expr_node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume);
 
 const oper_t opers[] = {
     {.name = "+"  , .num = ADD, .binary = true,  .commutative = true , .diffFunc = diffAddSub, .priority = 7},
@@ -0,0 +1,441 @@
+#ifndef EXPR_TEMPLATES_INCLUDED
+#define EXPR_TEMPLATES_INCLUDED
+
+#include <stdio.h>
+#include <cmath>
+#include <type_traits>
+
+#include "expr_types.h"
+
+/// @brief compile-time expressions for formulas known at build time, operations mirror enum oper:
+///
+///        using namespace et;
+///        Var<0> x; Var<1> y;
+///        auto f  = x * sin(y) + pow(ln(x), 2_c);
+///        auto df = derivative<0>(f);          // type of the derivative is made at compile time
+///        double vars[] = {1., 2.};
+///        double val = df(vars);               // inlined straight-line code
+///
+///        Builders fold constants and delete neutral elements while types are instantiated,
+///        so derivative<0>(x * x) is x + x, not 1 * x + x * 1.
+///        operator^ is pow but has lower priority than + in C++, so it should be in brackets: (ln(x) ^ 2_c)
+namespace et {
+
+struct expr_base {};
+
+template <class E>
+constexpr bool is_expr_v = std::is_base_of<expr_base, E>::value;
+
+/// @brief integer constant known at compile time
+template <long N>
+struct Int : expr_base {
+    static constexpr long value = N;
+
+    constexpr double operator()(const double *) const { return (double)N; }
+};
+
+/// @brief number known only at run time (double literals)
+struct Num : expr_base {
+    double value;
+
+    constexpr explicit Num(double val) : value(val) {}
+
+    constexpr double operator()(const double *) const { return value; }
+};
+
+/// @brief variable with index I in array of values
+template <unsigned int I>
+struct Var : expr_base {
+    constexpr double operator()(const double * vars) const { return vars[I]; }
+};
+
+/// @brief binary operation
+template <enum oper Op, class L, class R>
+struct Opr : expr_base {
+    L left;
+    R right;
+
+    constexpr Opr(L left_expr, R right_expr) : left(left_expr), right(right_expr) {}
+
+    inline double operator()(const double * vars) const;
+};
+
+/// @brief unary operation
+template <enum oper Op, class A>
+struct Func : expr_base {
+    A arg;
+
+    constexpr explicit Func(A arg_expr) : arg(arg_expr) {}
+
+    inline double operator()(const double * vars) const;
+};
+
+/*------------------------------------------------------------------------------------------*/
+
+template <class E> struct is_int : std::false_type {};
+template <long N>  struct is_int<Int<N>> : std::true_type {};
+
+template <class E>
+constexpr bool is_int_v = is_int<E>::value;
+
+template <class E>
+constexpr bool is_const_v = is_int_v<E> || std::is_same<E, Num>::value;
+
+template <class E, long N>
+constexpr bool is_int_equal_v = std::is_same<E, Int<N>>::value;
+
+/// @brief analog of countVars: true if expression depends on variable I
+template <unsigned int I, class E>
+struct depends_on : std::false_type {};
+
+template <unsigned int I>
+struct depends_on<I, Var<I>> : std::true_type {};
+
+template <unsigned int I, enum oper Op, class L, class R>
+struct depends_on<I, Opr<Op, L, R>> : std::integral_constant<bool, depends_on<I, L>::value || depends_on<I, R>::value> {};
+
+template <unsigned int I, enum oper Op, class A>
+struct depends_on<I, Func<Op, A>> : depends_on<I, A> {};
+
+template <unsigned int I, class E>
+constexpr bool depends_on_v = depends_on<I, E>::value;
+
+template <class E>
+using enable_expr_t = std::enable_if_t<is_expr_v<E>>;
+
+template <class L, class R>
+using enable_exprs_t = std::enable_if_t<is_expr_v<L> && is_expr_v<R>>;
+
+/*------------------------------------------------------------------------------------------*/
+
+constexpr long intPow(long base, long exponent)
+{
+    long result = 1;
+
+    for (long index = 0; index < exponent; index++)
+        result *= base;
+
+    return result;
+}
+
+constexpr double facValue(double number)
+{
+    double result = 1.;
+
+    for (long index = (long)number; index > 1; index--)
+        result *= (double)index;
+
+    return result;
+}
+
+/// @brief same as calcOper but known at compile time
+template <enum oper Op>
+inline double calcOp(double left_val, double right_val)
+{
+    if constexpr (Op == ADD) return left_val + right_val;
+    if constexpr (Op == SUB) return left_val - right_val;
+    if constexpr (Op == MUL) return left_val * right_val;
+    if constexpr (Op == DIV) return left_val / right_val;
+    if constexpr (Op == POW) return std::pow(left_val, right_val);
+    if constexpr (Op == SIN) return std::sin(left_val);
+    if constexpr (Op == COS) return std::cos(left_val);
+    if constexpr (Op == TAN) return std::tan(left_val);
+    if constexpr (Op == LN ) return std::log(left_val);
+    if constexpr (Op == LOG) return std::log(right_val) / std::log(left_val);
+    if constexpr (Op == FAC) return facValue(left_val);
+}
+
+template <enum oper Op, class L, class R>
+inline double Opr<Op, L, R>::operator()(const double * vars) const
+{
+    return calcOp<Op>(left(vars), right(vars));
+}
+
+template <enum oper Op, class A>
+inline double Func<Op, A>::operator()(const double * vars) const
+{
+    return calcOp<Op>(arg(vars), 0.);
+}
+
+/*------------------------------------------------------------------------------------------*/
+/* builders: fold constants and delete neutral elements like foldConstants and deleteNeutral */
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto add(L left, R right)
+{
+    if constexpr (is_int_v<L> && is_int_v<R>)
+        return Int<L::value + R::value>{};
+    else if constexpr (is_int_equal_v<L, 0>)
+        return right;
+    else if constexpr (is_int_equal_v<R, 0>)
+        return left;
+    else if constexpr (is_const_v<L> && is_const_v<R>)
+        return Num(left(nullptr) + right(nullptr));
+    else
+        return Opr<ADD, L, R>(left, right);
+}
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto sub(L left, R right)
+{
+    if constexpr (is_int_v<L> && is_int_v<R>)
+        return Int<L::value - R::value>{};
+    else if constexpr (is_int_equal_v<R, 0>)
+        return left;
+    else if constexpr (is_const_v<L> && is_const_v<R>)
+        return Num(left(nullptr) - right(nullptr));
+    else
+        return Opr<SUB, L, R>(left, right);
+}
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto mul(L left, R right)
+{
+    if constexpr (is_int_v<L> && is_int_v<R>)
+        return Int<L::value * R::value>{};
+    else if constexpr (is_int_equal_v<L, 0> || is_int_equal_v<R, 0>)
+        return Int<0>{};
+    else if constexpr (is_int_equal_v<L, 1>)
+        return right;
+    else if constexpr (is_int_equal_v<R, 1>)
+        return left;
+    else if constexpr (is_const_v<L> && is_const_v<R>)
+        return Num(left(nullptr) * right(nullptr));
+    else
+        return Opr<MUL, L, R>(left, right);
+}
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto div(L left, R right)
+{
+    if constexpr (is_int_equal_v<R, 1>)
+        return left;
+    else if constexpr (is_int_v<L> && is_int_v<R>){
+        if constexpr (R::value != 0 && L::value % R::value == 0)
+            return Int<L::value / R::value>{};
+        else
+            return Num((double)L::value / (double)R::value);
+    }
+    else if constexpr (is_const_v<L> && is_const_v<R>)
+        return Num(left(nullptr) / right(nullptr));
+    else
+        return Opr<DIV, L, R>(left, right);
+}
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto pow(L left, R right)
+{
+    if constexpr (is_int_equal_v<R, 1>)
+        return left;
+    else if constexpr (is_int_equal_v<R, 0>)
+        return Int<1>{};
+    else if constexpr (is_int_equal_v<L, 0> || is_int_equal_v<L, 1>)
+        return left;
+    else if constexpr (is_const_v<L> && is_const_v<R>){
+        if constexpr (is_int_v<L> && is_int_v<R>){
+            if constexpr (R::value > 0)
+                return Int<intPow(L::value, R::value)>{};
+            else
+                return Num(std::pow((double)L::value, (double)R::value));
+        }
+        else
+            return Num(std::pow(left(nullptr), right(nullptr)));
+    }
+    else
+        return Opr<POW, L, R>(left, right);
+}
+
+/// @brief log with base left of right, as LOG in calcOper
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto log(L left, R right)
+{
+    if constexpr (is_const_v<L> && is_const_v<R>)
+        return Num(calcOp<LOG>(left(nullptr), right(nullptr)));
+    else
+        return Opr<LOG, L, R>(left, right);
+}
+
+template <class A, class = enable_expr_t<A>>
+constexpr auto sin(A arg)
+{
+    if constexpr (is_int_equal_v<A, 0>)
+        return Int<0>{};
+    else if constexpr (is_const_v<A>)
+        return Num(std::sin(arg(nullptr)));
+    else
+        return Func<SIN, A>(arg);
+}
+
+template <class A, class = enable_expr_t<A>>
+constexpr auto cos(A arg)
+{
+    if constexpr (is_int_equal_v<A, 0>)
+        return Int<1>{};
+    else if constexpr (is_const_v<A>)
+        return Num(std::cos(arg(nullptr)));
+    else
+        return Func<COS, A>(arg);
+}
+
+template <class A, class = enable_expr_t<A>>
+constexpr auto tan(A arg)
+{
+    if constexpr (is_int_equal_v<A, 0>)
+        return Int<0>{};
+    else if constexpr (is_const_v<A>)
+        return Num(std::tan(arg(nullptr)));
+    else
+        return Func<TAN, A>(arg);
+}
+
+template <class A, class = enable_expr_t<A>>
+constexpr auto ln(A arg)
+{
+    if constexpr (is_int_equal_v<A, 1>)
+        return Int<0>{};
+    else if constexpr (is_const_v<A>)
+        return Num(std::log(arg(nullptr)));
+    else
+        return Func<LN, A>(arg);
+}
+
+template <class A, class = enable_expr_t<A>>
+constexpr auto fac(A arg)
+{
+    if constexpr (is_const_v<A>)
+        return Num(facValue(arg(nullptr)));
+    else
+        return Func<FAC, A>(arg);
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto operator+(L left, R right) { return add(left, right); }
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto operator-(L left, R right) { return sub(left, right); }
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto operator*(L left, R right) { return mul(left, right); }
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto operator/(L left, R right) { return div(left, right); }
+
+template <class L, class R, class = enable_exprs_t<L, R>>
+constexpr auto operator^(L left, R right) { return pow(left, right); }
+
+template <class E, class = enable_expr_t<E>> constexpr auto operator+(E expr, double num) { return add(expr, Num(num)); }
+template <class E, class = enable_expr_t<E>> constexpr auto operator+(double num, E expr) { return add(Num(num), expr); }
+template <class E, class = enable_expr_t<E>> constexpr auto operator-(E expr, double num) { return sub(expr, Num(num)); }
+template <class E, class = enable_expr_t<E>> constexpr auto operator-(double num, E expr) { return sub(Num(num), expr); }
+template <class E, class = enable_expr_t<E>> constexpr auto operator*(E expr, double num) { return mul(expr, Num(num)); }
+template <class E, class = enable_expr_t<E>> constexpr auto operator*(double num, E expr) { return mul(Num(num), expr); }
+template <class E, class = enable_expr_t<E>> constexpr auto operator/(E expr, double num) { return div(expr, Num(num)); }
+template <class E, class = enable_expr_t<E>> constexpr auto operator/(double num, E expr) { return div(Num(num), expr); }
+
+/// @brief integer constant literal: 2_c is Int<2>
+template <char... Digits>
+constexpr auto operator""_c()
+{
+    constexpr char digits[] = {Digits...};
+
+    constexpr long value = [&]{
+        long result = 0;
+        for (char digit : digits)
+            result = result * 10 + (digit - '0');
+        return result;
+    }();
+
+    return Int<value>{};
+}
+
+/*------------------------------------------------------------------------------------------*/
+/* derivatives by the rules from derivatives.cpp */
+
+template <unsigned int I, long N>
+constexpr auto derivative(Int<N>) { return Int<0>{}; }
+
+template <unsigned int I>
+constexpr auto derivative(Num) { return Int<0>{}; }
+
+template <unsigned int I, unsigned int J>
+constexpr auto derivative(Var<J>)
+{
+    if constexpr (I == J)
+        return Int<1>{};
+    else
+        return Int<0>{};
+}
+
+template <unsigned int I, enum oper Op, class A>
+constexpr auto derivative(Func<Op, A> node);
+
+template <unsigned int I, enum oper Op, class L, class R>
+constexpr auto derivative(Opr<Op, L, R> node)
+{
+    static_assert(Op != LOG, "there is no rule for derivative of log");
+
+    auto CL = node.left;
+    auto CR = node.right;
+
+    if constexpr (Op == ADD)
+        return add(derivative<I>(CL), derivative<I>(CR));
+
+    else if constexpr (Op == SUB)
+        return sub(derivative<I>(CL), derivative<I>(CR));
+
+    else if constexpr (Op == MUL)
+        return add(mul(derivative<I>(CL), CR), mul(CL, derivative<I>(CR)));
+
+    else if constexpr (Op == DIV)
+        return div(sub(mul(derivative<I>(CL), CR), mul(CL, derivative<I>(CR))), pow(CR, Int<2>{}));
+
+    else if constexpr (Op == POW){
+        constexpr bool vars_in_left  = depends_on_v<I, L>;
+        constexpr bool vars_in_right = depends_on_v<I, R>;
+
+        if constexpr (!vars_in_left && !vars_in_right)
+            return Int<0>{};
+        else if constexpr (!vars_in_left)
+            return mul(mul(node, ln(CL)), derivative<I>(CR));
+        else if constexpr (!vars_in_right)
+            return mul(mul(CR, pow(CL, sub(CR, Int<1>{}))), derivative<I>(CL));
+        else
+            return mul(node, add(div(mul(derivative<I>(CL), CR), CL), mul(ln(CL), derivative<I>(CR))));
+    }
+}
+
+template <unsigned int I, enum oper Op, class A>
+constexpr auto derivative(Func<Op, A> node)
+{
+    static_assert(Op != FAC, "there is no rule for derivative of factorial");
+
+    auto CL = node.arg;
+
+    if constexpr (Op == SIN)
+        return mul(cos(CL), derivative<I>(CL));
+
+    else if constexpr (Op == COS)
+        return mul(sin(CL), mul(derivative<I>(CL), Int<-1>{}));
+
+    else if constexpr (Op == TAN)
+        return div(derivative<I>(CL), pow(cos(CL), Int<2>{}));
+
+    else if constexpr (Op == LN)
+        return div(derivative<I>(CL), CL);
+}
+
+/// @brief n-th derivative by variable I
+template <unsigned int I, unsigned int N, class E, class = enable_expr_t<E>>
+constexpr auto nthDerivative(E expr)
+{
+    if constexpr (N == 0)
+        return expr;
+    else
+        return nthDerivative<I, N - 1>(derivative<I>(expr));
+}
+
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef EXPR_TYPES_INCLUDED
+#define EXPR_TYPES_INCLUDED
+
+/// kinds of expression elements and operations, the header has no dependencies, so header-only code can use it
+
+enum elem_type{
+    NUM = 0,
+    OPR = 1,
+    VAR = 2,
+    DRV = 3     ///< deferred derivative of the left subtree by variable val.var, expanded on the first touch
+};
+
+enum oper{
+    ADD = 0,
+    SUB,
+    MUL,
+    DIV,
+    POW,
+    SIN,
+    COS,
+    TAN,
+    LN,
+    LOG,
+    FAC
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef FLAT_EXPR_INCLUDED
+#define FLAT_EXPR_INCLUDED
+
+#include <stdint.h>
+
+#include "differ.h"
+
+const uint32_t FLAT_NONE = UINT32_MAX;
+
+/// @brief value of the flat node: number for NUM, index of variable for VAR
+typedef union {
+    double number;
+    unsigned int var;
+} flat_value_t;
+
+/// @brief expression stored in contiguous arrays (18 bytes per node),
+///        children always precede parents (postorder), the last node is the root.
+///        Results of flatDerivative() share equal operands, so a node may have several parents
+typedef struct {
+    uint8_t  * types;           ///< enum elem_type
+    uint8_t  * ops;             ///< enum oper for OPR nodes
+    uint32_t * left;            ///< FLAT_NONE if there is no child
+    uint32_t * right;
+    flat_value_t * values;
+
+    size_t size;
+    size_t capacity;
+} flat_expr_t;
+
+/// @brief makes empty flat expression
+flat_expr_t flatCtor();
+
+/// @brief destructs flat expression
+void flatDtor(flat_expr_t * flat);
+
+/// @brief adds node, children must be already added, returns its index
+uint32_t flatAddNode(flat_expr_t * flat, enum elem_type type, enum oper op, flat_value_t value, uint32_t left, uint32_t right);
+
+/// @brief index of the root, FLAT_NONE if expression is empty
+uint32_t flatRoot(const flat_expr_t * flat);
+
+/// @brief converts tree to flat expression
+flat_expr_t flatFromTree(node_t * node);
+
+/// @brief converts flat expression to tree, shared nodes are copied
+node_t * flatToTree(const flat_expr_t * flat);
+
+/// @brief evaluates expression in one linear pass, regs must have flat->size elements (NULL - allocated inside)
+double flatEvaluate(const flat_expr_t * flat, const double * var_values, double * regs);
+
+/// @brief makes derivative by the same rules as makeDerivative(), operands are shared instead of copied,
+///        result is empty if there is no rule for some operation
+flat_expr_t flatDerivative(const flat_expr_t * flat, unsigned int var_index);
+
+/// @brief folds constants, returns new expression
+flat_expr_t flatFoldConstants(const flat_expr_t * flat);
+
+/// @brief deletes neutral constructions, returns new expression
+flat_expr_t flatDeleteNeutral(const flat_expr_t * flat);
+
+/// @brief folds constants and deletes neutral constructions in one pass, result is the same as of simplifyExpression()
+flat_expr_t flatSimplify(const flat_expr_t * flat);
+
+/// @brief counts occurrences of the variable as in the tree (shared nodes are counted for every parent)
+size_t flatCountVars(const flat_expr_t * flat, unsigned int var_index);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef GRAPH_DUMP_INCLUDED
+#define GRAPH_DUMP_INCLUDED
+
+#include <stddef.h>
+
+#include "bintree.h"
+
+/// nodes drawn in one graph, subtrees below them are replaced by "..." nodes
+const size_t GRAPH_DUMP_NODE_BUDGET = 256;
+
+/// graphs waiting for graphviz, graphDump() waits if there are more
+const size_t GRAPH_DUMP_MAX_PENDING = 16;
+
+/// true if graphDump() makes images, by default only in debug builds
+extern bool graph_dump_enabled;
+
+/// @brief starts background thread running graphviz, images are written to dir and shown in the log
+void graphDumpStart(const char * dir, size_t node_budget);
+
+/// @brief waits for queued graphs and stops the thread
+void graphDumpStop();
+
+/// @brief copies top of the tree (node_budget nodes in breadth-first order) and queues its drawing,
+///        does nothing if dumps are disabled or not started, the tree can be changed right after the call
+void graphDump(node_t * root_node, elemtostr_func_t elemToStr);
+
+#endif
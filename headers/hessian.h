@@ -0,0 +1,32 @@
+#ifndef HESSIAN_INCLUDED
+#define HESSIAN_INCLUDED
+
+#include "differ.h"
+
+/// @brief gradient and hessian of the expression, all trees share common subexpressions (they form one DAG),
+///        so they must not be changed or destroyed separately
+typedef struct {
+    size_t var_num;
+
+    node_t ** gradient;     ///< gradient[i] = df/dx_i, NULL if it is structurally zero
+    node_t ** hessian;      ///< hessian[i * var_num + j], NULL if it is structurally zero, [i][j] and [j][i] are the same tree
+
+    size_t gradient_nonzero;
+    size_t hessian_nonzero; ///< number of nonzero entries in upper triangle
+
+    node_t ** nodes;        ///< all unique nodes of the DAG
+    size_t nodes_num;
+} hessian_t;
+
+/// @brief makes gradient only (hessian is NULL) by variables marked in vars (all if vars is NULL), other entries are NULL,
+///        result is empty (gradient is NULL) if some derivative has no rule (factorial, logarithm)
+hessian_t makeGradient(diff_t * diff, node_t * expr_node, const bool * vars);
+
+/// @brief makes gradient and hessian by variables marked in vars (all if vars is NULL) differentiating only
+///        structurally nonzero entries of upper triangle, result is empty (gradient is NULL) if some derivative has no rule
+hessian_t makeHessian(diff_t * diff, node_t * expr_node, const bool * vars);
+
+/// @brief destructs gradient and hessian
+void hessianDtor(hessian_t * hessian);
+
+#endif
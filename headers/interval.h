@@ -0,0 +1,41 @@
+#ifndef INTERVAL_INCLUDED
+#define INTERVAL_INCLUDED
+
+#include "differ.h"
+
+/// @brief closed interval [lo, hi], empty interval has NAN bounds
+typedef struct {
+    double lo;
+    double hi;
+} interval_t;
+
+/// @brief enclosures of global minimum and maximum found by branch and bound
+typedef struct {
+    interval_t min;
+    interval_t max;
+
+    size_t evaluations;
+} range_bounds_t;
+
+/// @brief makes interval [lo, hi]
+interval_t intervalMake(double lo, double hi);
+
+/// @brief checks if interval is empty (function is undefined on whole interval)
+bool intervalIsEmpty(interval_t interval);
+
+/// @brief calculates guaranteed enclosure of the operation over intervals
+interval_t calcOperInterval(enum oper op_num, interval_t left, interval_t right);
+
+/// @brief evaluates guaranteed enclosure of the tree, var_ranges contains interval for every variable
+interval_t evaluateInterval(diff_t * diff, node_t * node, const interval_t * var_ranges);
+
+/// @brief finds enclosures of global min and max over domain by branch and bound (max_evals for each of them),
+///        other variables are taken from diff->var_values
+range_bounds_t findRangeBounds(diff_t * diff, node_t * node, unsigned int var_index,
+                               interval_t domain, double tolerance, size_t max_evals);
+
+/// @brief finds subintervals of domain where function has no roots, returns number of written regions
+size_t findRootFreeRegions(diff_t * diff, node_t * node, unsigned int var_index, interval_t domain,
+                           double min_width, interval_t * regions, size_t max_regions);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef JET_INCLUDED
+#define JET_INCLUDED
+
+#include "differ.h"
+#include "thread_pool.h"
+
+/// max order of derivatives evaluated together with the value
+const size_t MAX_JET_ORDER = 2;
+
+/// @brief value of expression and its derivatives by all variables at one point
+typedef struct {
+    double value;
+    double * gradient;          ///< var_num first derivatives, NULL if order is 0
+    double * hessian;           ///< var_num x var_num second derivatives, NULL if order is less than 2
+
+    size_t var_num;
+    size_t order;
+} eval_derivs_t;
+
+/// @brief evaluates value, gradient and (for order 2) hessian in one traversal of the tree
+///        propagating truncated taylor expansions (jets) instead of making trees of derivatives,
+///        point has diff->var_num values (NULL - values from diff)
+eval_derivs_t evaluateWithDerivatives(diff_t * diff, node_t * expr_node, const double * point, size_t order);
+
+/// @brief destructs derivatives
+void evalDerivsDtor(eval_derivs_t * derivs);
+
+/// @brief evaluates value and derivatives at points_num points (var_num values each) on threads of the pool
+///        (NULL - in caller thread): values[i], gradients[i * var_num + k], hessians[(i * var_num + k) * var_num + l],
+///        gradients and hessians can be NULL if they are not needed
+void evaluateWithDerivativesBatch(diff_t * diff, node_t * expr_node, const double * points, size_t points_num, size_t order,
+                                  double * values, double * gradients, double * hessians, thread_pool_t * pool);
+
+#endif
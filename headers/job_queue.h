@@ -0,0 +1,23 @@
+#ifndef JOB_QUEUE_INCLUDED
+#define JOB_QUEUE_INCLUDED
+
+#include <stddef.h>
+
+/// @brief job run on a background thread, it owns its argument and must free it
+typedef void (*job_func_t)(void * arg);
+
+typedef struct job_queue job_queue_t;
+
+/// @brief creates queue served by workers_num background threads, at most max_pending jobs wait in it
+job_queue_t * jobQueueCtor(size_t workers_num, size_t max_pending);
+
+/// @brief runs remaining jobs, then stops and joins threads of the queue
+void jobQueueDtor(job_queue_t * queue);
+
+/// @brief adds job, waits only while the queue is full, jobs are started in order of pushing
+void jobQueuePush(job_queue_t * queue, job_func_t func, void * arg);
+
+/// @brief waits until all pushed jobs are done
+void jobQueueWait(job_queue_t * queue);
+
+#endif
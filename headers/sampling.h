@@ -0,0 +1,67 @@
+#ifndef SAMPLING_INCLUDED
+#define SAMPLING_INCLUDED
+
+#include "differ.h"
+#include "thread_pool.h"
+
+/// @brief one point of the plot, y = NAN marks a break (pole, jump or undefined region)
+typedef struct {
+    double x;
+    double y;
+} plot_point_t;
+
+/// @brief sampled function, points are sorted by x
+typedef struct {
+    plot_point_t * points;
+    size_t size;
+    size_t capacity;
+
+    size_t evaluations;
+} plot_t;
+
+/// @brief parameters of adaptive sampling
+typedef struct {
+    size_t initial_pts;     ///< number of uniform segments before refinement
+    size_t max_depth;       ///< max number of halvings of one initial segment
+    double tolerance;       ///< allowed deviation from the chord, relative to the height of plot
+    double jump_fraction;   ///< change on the smallest segment (relative to height) that is a break
+} sampling_params_t;
+
+const sampling_params_t DEFAULT_SAMPLING = {
+    .initial_pts   = 32,
+    .max_depth     = 12,
+    .tolerance     = 2e-3,
+    .jump_fraction = 0.25
+};
+
+/// @brief one axis of the grid, points are uniform and include both borders
+typedef struct {
+    unsigned int var_index;
+
+    double left_border;
+    double right_border;
+
+    size_t num_of_pts;
+} grid_axis_t;
+
+/// @brief samples function on [left_border, right_border] subdividing segments where it is curved
+plot_t sampleAdaptive(diff_t * diff, node_t * tree, unsigned int var_index,
+                      double left_border, double right_border, const sampling_params_t * params);
+
+/// @brief leaves at most max_pts points keeping the shape of every continuous part (largest triangle three buckets),
+///        consecutive breaks are merged; ends of every part and breaks are always kept, so only a plot with more
+///        than about max_pts / 3 parts gets more points
+void downsamplePlot(plot_t * plot, size_t max_pts);
+
+/// @brief returns coordinate of the point_index-th point of the axis
+double gridAxisPoint(const grid_axis_t * axis, size_t point_index);
+
+/// @brief evaluates tree in every point of the grid splitting it between threads of the pool (NULL - in caller thread),
+///        results are in row-major order (last axis changes fastest), other variables are taken from diff->var_values
+void sampleGrid(diff_t * diff, node_t * tree, const grid_axis_t * axes, size_t axes_num,
+                double * results, thread_pool_t * pool);
+
+/// @brief destructs plot
+void plotDtor(plot_t * plot);
+
+#endif
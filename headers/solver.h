@@ -0,0 +1,55 @@
+#ifndef SOLVER_INCLUDED
+#define SOLVER_INCLUDED
+
+#include "differ.h"
+#include "thread_pool.h"
+
+/// @brief method of the solver
+typedef enum {
+    SOLVER_NEWTON,          ///< pure Newton steps
+    SOLVER_DAMPED_NEWTON,   ///< Newton steps with backtracking, hessian is shifted until it is positive definite
+    SOLVER_BFGS             ///< quasi-Newton, only gradient is used (secant method for roots)
+} solver_method_t;
+
+/// @brief parameters of the solver
+typedef struct {
+    solver_method_t method;
+
+    size_t max_iters;
+    double tolerance;       ///< on |f| for roots, on max |gradient component| for minimums
+} solver_params_t;
+
+const solver_params_t DEFAULT_SOLVER_PARAMS = {
+    .method    = SOLVER_DAMPED_NEWTON,
+    .max_iters = 100,
+    .tolerance = 1e-10
+};
+
+/// @brief status of one run of the solver
+typedef enum {
+    SOLVER_CONVERGED = 0,
+    SOLVER_MAX_ITERS,
+    SOLVER_STALLED,         ///< no step decreases the function, usually precision limit near the solution
+    SOLVER_DIVERGED,
+    SOLVER_NO_DERIVATIVE    ///< expression has no derivative rule (factorial, logarithm), points are not changed
+} solver_status_t;
+
+/// @brief result of one run of the solver
+typedef struct {
+    solver_status_t status;
+
+    double value;
+    size_t iters;
+} solver_result_t;
+
+/// @brief finds roots of expression in var_index from every starting point in parallel (pool may be NULL),
+///        points are replaced by found roots, other variables are taken from diff->var_values
+void solverFindRoots(diff_t * diff, node_t * expr_node, unsigned int var_index, double * points, size_t points_num,
+                     const solver_params_t * params, solver_result_t * results, thread_pool_t * pool);
+
+/// @brief finds local minimums of expression from every starting point in parallel (pool may be NULL),
+///        points has points_num rows of diff->var_num values and they are replaced by found minimums
+void solverMinimize(diff_t * diff, node_t * expr_node, double * points, size_t points_num,
+                    const solver_params_t * params, solver_result_t * results, thread_pool_t * pool);
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef STATS_INCLUDED
+#define STATS_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+/// @brief counters of the differentiator
+typedef enum {
+    STAT_NODES_ALLOCATED = 0,
+    STAT_NODES_FREED,
+    STAT_TREE_COPY_NODES,       ///< nodes made by exprCopy()
+
+    STAT_SIMPLIFY_PASSES,
+    STAT_RULE_FOLD_CONSTANTS,   ///< operation on numbers replaced by the number
+    STAT_RULE_MUL_ONE,          ///< x*1 = x
+    STAT_RULE_MUL_ZERO,         ///< x*0 = 0
+    STAT_RULE_ADD_ZERO,         ///< x+0 = x
+    STAT_RULE_DIV_ONE,          ///< x/1 = x
+    STAT_RULE_SUB_ZERO,         ///< x-0 = x
+    STAT_RULE_SUB_SELF,         ///< x-x = 0
+    STAT_RULE_POW_ONE,          ///< x^1 = x
+    STAT_RULE_POW_ZERO,         ///< x^0 = 1
+    STAT_RULE_POW_BASE,         ///< 1^x = 1, 0^x = 0
+
+    STAT_MEMO_HITS,             ///< equal subexpressions merged in gradient and hessian
+    STAT_CSE_HITS,              ///< equal instructions merged in compiled code
+    STAT_EVALUATIONS,
+
+    STAT_COUNTERS_NUM
+} stat_counter_t;
+
+/// @brief phases with measured wall time, nested calls of the same phase are measured once
+typedef enum {
+    PHASE_PARSE = 0,
+    PHASE_DERIVATIVE,
+    PHASE_SIMPLIFY,
+    PHASE_CODEGEN,
+    PHASE_SAMPLING,
+    PHASE_SOLVER,
+    PHASE_TEX,
+
+    PHASES_NUM
+} stats_phase_t;
+
+/// @brief statistics, all fields are updated atomically so they can be collected from many threads
+typedef struct {
+    uint64_t counters[STAT_COUNTERS_NUM];
+
+    int64_t nodes_live;         ///< allocated minus freed since the reset
+    int64_t nodes_peak;
+
+    uint64_t phase_calls[PHASES_NUM];
+    uint64_t phase_ns   [PHASES_NUM];
+} diff_stats_t;
+
+/// @brief measurement of one phase, stats is NULL if statistics were disabled at the beginning
+typedef struct {
+    diff_stats_t * stats;
+    stats_phase_t phase;
+    uint64_t start_ns;
+    bool nested;
+} stats_timer_t;
+
+/// statistics that are collected now, NULL if disabled
+extern diff_stats_t * active_stats;
+
+/// @brief starts collecting statistics to stats (usually &diff->stats), only one stats is collected at a time
+void statsEnable(diff_stats_t * stats);
+
+/// @brief stops collecting statistics
+void statsDisable();
+
+/// @brief resets all counters and timers
+void statsReset(diff_stats_t * stats);
+
+/// @brief writes statistics as JSON object
+void statsDumpJSON(const diff_stats_t * stats, FILE * file);
+
+void statsNodesChanged(diff_stats_t * stats, int64_t allocated, int64_t freed);
+
+stats_timer_t statsTimerStart(diff_stats_t * stats, stats_phase_t phase);
+
+void statsTimerStop(stats_timer_t timer);
+
+/// @brief adds value to the counter if statistics are enabled
+static inline void statsCount(stat_counter_t counter, uint64_t value)
+{
+    diff_stats_t * stats = __atomic_load_n(&active_stats, __ATOMIC_RELAXED);
+
+    if (stats != NULL)
+        __atomic_fetch_add(&stats->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+/// @brief counts allocated and freed nodes if statistics are enabled
+static inline void statsNodes(int64_t allocated, int64_t freed)
+{
+    diff_stats_t * stats = __atomic_load_n(&active_stats, __ATOMIC_RELAXED);
+
+    if (stats != NULL)
+        statsNodesChanged(stats, allocated, freed);
+}
+
+/// @brief true if statistics are enabled, used to skip work needed only for them
+static inline bool statsEnabled()
+{
+    return __atomic_load_n(&active_stats, __ATOMIC_RELAXED) != NULL;
+}
+
+/// @brief begins measuring of the phase
+static inline stats_timer_t statsPhaseBegin(stats_phase_t phase)
+{
+    diff_stats_t * stats = __atomic_load_n(&active_stats, __ATOMIC_RELAXED);
+
+    if (stats == NULL)
+        return {};
+
+    return statsTimerStart(stats, phase);
+}
+
+/// @brief ends measuring of the phase
+static inline void statsPhaseEnd(stats_timer_t timer)
+{
+    if (timer.stats != NULL)
+        statsTimerStop(timer);
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SYM_TABLE_INCLUDED
+#define SYM_TABLE_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// names shorter than this are stored inside the slot, longer ones are allocated
+const size_t SYM_INLINE_LEN = 24;
+
+/// value of the name that is not in the table
+const size_t SYM_NONE = SIZE_MAX;
+
+/// @brief one slot of the table
+typedef struct {
+    union {
+        char inline_name[SYM_INLINE_LEN];
+        char * long_name;
+    } name;
+    size_t len;
+
+    size_t value;
+} sym_slot_t;
+
+/// @brief open-addressing table from names to numbers, control byte of every slot is
+///        empty or 7 bits of hash of the name, probing compares 16 control bytes at once
+typedef struct {
+    int8_t * ctrl;              ///< capacity + 16 bytes, the last 16 repeat the first ones so groups never wrap
+    sym_slot_t * slots;
+
+    size_t capacity;            ///< power of two
+    size_t size;
+} sym_table_t;
+
+/// @brief makes empty table for about capacity names
+sym_table_t symTableCtor(size_t capacity);
+
+/// @brief destructs table
+void symTableDtor(sym_table_t * table);
+
+/// @brief finds value of the name, SYM_NONE if there is no such name
+size_t symLookup(const sym_table_t * table, const char * name);
+
+/// @brief inserts name with value if the name is not in the table yet,
+///        returns value of the name in the table (old one if the name already was there)
+size_t symInsert(sym_table_t * table, const char * name, size_t value);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef TAYLOR_INCLUDED
+#define TAYLOR_INCLUDED
+
+#include "differ.h"
+#include "thread_pool.h"
+
+/// @brief taylor polynomial with numeric coefficients: sum of coeffs[k] * (x - center)^k
+typedef struct {
+    double * coeffs;            ///< coeffs[k] is k-th derivative at the center divided by k!
+    size_t coeffs_num;
+
+    double center;
+    unsigned int var_index;
+} taylor_poly_t;
+
+/// @brief taylor coefficients around many centers, row of every center has coeffs_num coefficients
+typedef struct {
+    double * coeffs;            ///< centers_num x coeffs_num matrix, row-major
+    double * centers;
+    size_t centers_num;
+    size_t coeffs_num;
+
+    unsigned int var_index;
+} taylor_table_t;
+
+/// @brief makes taylor polynomial with last_member_index members (fewer if some derivative cannot be made)
+taylor_poly_t taylorPolynomial(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point, size_t last_member_index);
+
+/// @brief destructs polynomial
+void taylorPolyDtor(taylor_poly_t * poly);
+
+/// @brief evaluates polynomial at x by Horner scheme, one multiply-add per member
+double polyEvaluate(const taylor_poly_t * poly, double x);
+
+/// @brief evaluates polynomial at points_num points: ys[i] = poly(xs[i]), vectorized with SSE2 if it is available
+void polyEvaluateBatch(const taylor_poly_t * poly, const double * xs, double * ys, size_t points_num);
+
+/// @brief makes tree of polynomial in Horner form: c0 + (x - a) * (c1 + (x - a) * (...))
+node_t * polyToTree(const taylor_poly_t * poly);
+
+/// @brief make taylor series for the function in Horner form with numeric coefficients
+node_t * taylorSeriesHorner(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point, size_t last_member_index);
+
+/// @brief makes coefficients of taylor polynomials around all centers with last_member_index members,
+///        derivatives are made once and evaluated at centers on threads of the pool (NULL - in caller thread),
+///        other variables are taken from diff, which is not changed
+taylor_table_t taylorTable(diff_t * diff, node_t * expr_node, unsigned int var_index, const double * centers, size_t centers_num,
+                           size_t last_member_index, thread_pool_t * pool);
+
+/// @brief destructs table
+void taylorTableDtor(taylor_table_t * table);
+
+/// @brief polynomial of one row of the table, it points into the table and must not be destructed
+taylor_poly_t taylorTableRow(const taylor_table_t * table, size_t center_index);
+
+#endif
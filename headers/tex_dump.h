@@ -2,26 +2,75 @@
 #define TEX_DUMP_INCLUDED
 
 #include "differ.h"
+#include "flat_expr.h"
+#include "job_queue.h"
+
+/// @brief background writer of tex files and bounded pool of pdflatex runs, shared by documents of a batch
+typedef struct {
+    job_queue_t * writer;       ///< one thread, so sections of every document are written in order
+    job_queue_t * latex;        ///< at most latex_num pdflatex runs at once
+} tex_pipeline_t;
 
 /// @brief context structure for tex dump
 typedef struct {
     const char * file_name;
-    FILE * file;
+    FILE * file;                ///< tex file, or memory buffer of the current section if pipeline is used
+
+    tex_pipeline_t * pipeline;  ///< NULL - everything is written and rendered in caller thread
+    FILE * out;                 ///< tex file, used only by the writer thread
+    char * section;
+    size_t section_size;
 } tex_dump_t;
 
+/// @brief limits of step by step output of TexSimplifySteps()
+typedef struct {
+    size_t max_steps;           ///< rendered steps, later ones are only counted and the result is shown (0 - no limit)
+    size_t node_budget;         ///< nodes rendered in one formula, the rest are elided (0 - no limit)
+    size_t min_named_size;      ///< unchanged subterms of at least this size are named instead of rendered (0 - never)
+} tex_steps_t;
+
+const tex_steps_t DEFAULT_TEX_STEPS = {
+    .max_steps      = 16,
+    .node_budget    = 2000,
+    .min_named_size = 8
+};
+
+/// @brief starts writer thread and latex_num threads for pdflatex, at most max_pending sections or
+///        documents wait in each queue, so memory is bounded and producers wait only if rendering is far behind
+tex_pipeline_t texPipelineCtor(size_t latex_num, size_t max_pending);
+
+/// @brief waits until all queued documents are written and rendered, stops threads
+void texPipelineDtor(tex_pipeline_t * pipeline);
+
 /// @brief initialising struncture tex_dump_t to dump in file with name "file_name"
 tex_dump_t startTexDump(const char * file_name);
 
+/// @brief same as startTexDump(), but the document is written by the writer thread of the pipeline
+///        section by section and rendered by its pdflatex pool
+tex_dump_t startTexDumpAsync(const char * file_name, tex_pipeline_t * pipeline);
+
+/// @brief hands written part of the document to the writer thread, does nothing without pipeline
+void texEndSection(tex_dump_t * tex);
+
 /// @brief dupms expression to tex file
 void dumpToTEX(tex_dump_t * tex, diff_t * diff, node_t * node);
 
+/// @brief dumps flat expression to tex file
+void flatDumpToTEX(tex_dump_t * tex, diff_t * diff, const flat_expr_t * flat);
+
 /// @brief simplifies expression writing step by step to tex file
 node_t * TexSimplifyExpression(tex_dump_t * tex, diff_t * diff, node_t * node);
 
-/// @brief ends tex dump, closes tex file
+/// @brief same as TexSimplifyExpression(), but every step shows only changed parts: unchanged subterms
+///        of the previous step are replaced by names T_k defined once, long formulas are elided and
+///        number of steps is limited, so output does not grow with passes x size of the tree
+node_t * TexSimplifySteps(tex_dump_t * tex, diff_t * diff, node_t * node, const tex_steps_t * steps);
+
+/// @brief ends tex dump, closes tex file and runs pdflatex, with pipeline it returns without waiting for them
 void endTexDump(tex_dump_t * tex);
 
-/// @brief makes plot of tree
+/// @brief makes plot of tree sampled adaptively, num_of_pts is max number of points in the plot,
+///        values out of [-max_y, max_y] are clipped
 void TexMakePlot(tex_dump_t * tex, diff_t * diff, node_t * tree,
                   double left_border, double right_border, size_t num_of_pts, unsigned int var_index, double max_y);
 
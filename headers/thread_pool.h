@@ -0,0 +1,24 @@
+#ifndef THREAD_POOL_INCLUDED
+#define THREAD_POOL_INCLUDED
+
+#include <stddef.h>
+
+/// @brief task of parallel loop, thread_index is in [0, threadPoolSize(pool)) and can be used for per-thread state
+typedef void (*pool_task_t)(void * context, size_t task_index, size_t thread_index);
+
+typedef struct thread_pool thread_pool_t;
+
+/// @brief creates pool with threads_num threads (including caller thread), 0 means number of cores
+thread_pool_t * threadPoolCtor(size_t threads_num);
+
+/// @brief stops and joins threads of the pool
+void threadPoolDtor(thread_pool_t * pool);
+
+/// @brief returns number of threads including caller thread
+size_t threadPoolSize(thread_pool_t * pool);
+
+/// @brief runs task for every index in [0, tasks_num) on threads of the pool, returns when all tasks are done,
+///        call from inside a task of the same pool runs the tasks serially in the calling thread with its thread_index
+void threadPoolFor(thread_pool_t * pool, size_t tasks_num, pool_task_t task, void * context);
+
+#endif
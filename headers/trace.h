@@ -0,0 +1,66 @@
+#ifndef TRACE_INCLUDED
+#define TRACE_INCLUDED
+
+#include <stdint.h>
+
+/// @brief one scoped span, inactive if tracing was disabled at the beginning
+typedef struct {
+    bool active;
+
+    const char * name;          ///< names and arguments must live until traceStop() (usually literals)
+    const char * arg_name;
+    const char * arg_str;       ///< NULL if argument is a number
+    long arg_num;
+
+    uint64_t start_ns;
+} trace_span_t;
+
+/// true while trace is being recorded
+extern bool tracing_enabled;
+
+/// @brief starts recording spans of all threads, they are written to file_name by traceStop()
+void traceStart(const char * file_name);
+
+/// @brief stops recording and writes Chrome trace-event JSON (viewable in perfetto),
+///        must not be called while other threads record spans
+void traceStop();
+
+trace_span_t traceSpanStart(const char * name, const char * arg_name, const char * arg_str, long arg_num);
+
+void traceSpanStop(trace_span_t * span);
+
+/// @brief begins span without arguments
+static inline trace_span_t traceBegin(const char * name)
+{
+    if (!__atomic_load_n(&tracing_enabled, __ATOMIC_RELAXED))
+        return {};
+
+    return traceSpanStart(name, NULL, NULL, 0);
+}
+
+/// @brief begins span with string argument
+static inline trace_span_t traceBeginStr(const char * name, const char * arg_name, const char * arg)
+{
+    if (!__atomic_load_n(&tracing_enabled, __ATOMIC_RELAXED))
+        return {};
+
+    return traceSpanStart(name, arg_name, arg, 0);
+}
+
+/// @brief begins span with number argument
+static inline trace_span_t traceBeginNum(const char * name, const char * arg_name, long arg)
+{
+    if (!__atomic_load_n(&tracing_enabled, __ATOMIC_RELAXED))
+        return {};
+
+    return traceSpanStart(name, arg_name, NULL, arg);
+}
+
+/// @brief ends span, it is saved to the buffer of the current thread
+static inline void traceEnd(trace_span_t * span)
+{
+    if (span->active)
+        traceSpanStop(span);
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TRAV_STACK_INCLUDED
+#define TRAV_STACK_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "bintree.h"
+
+/// elements kept inside the stack itself, so shallow traversals do not allocate
+const size_t STACK_INLINE_SIZE = 32;
+
+/// tree walks recurse up to this depth, deeper subtrees are walked with explicit stacks,
+/// so shallow trees do not pay for stacks and deep ones do not overflow the call stack
+const size_t RECURSIVE_WALK_DEPTH = 64;
+
+/// @brief explicit stack for traversals of arbitrarily deep trees, must be initialized with stackInit()
+template <typename elem_t>
+struct trav_stack_t {
+    elem_t * elems;
+    size_t size;
+    size_t capacity;
+
+    elem_t inline_elems[STACK_INLINE_SIZE];
+};
+
+/// @brief initializes empty stack
+template <typename elem_t>
+static inline void stackInit(trav_stack_t<elem_t> * stack)
+{
+    stack->elems    = stack->inline_elems;
+    stack->size     = 0;
+    stack->capacity = STACK_INLINE_SIZE;
+}
+
+/// @brief frees memory of the stack
+template <typename elem_t>
+static inline void stackDtor(trav_stack_t<elem_t> * stack)
+{
+    if (stack->elems != stack->inline_elems)
+        free(stack->elems);
+
+    stack->elems    = NULL;
+    stack->size     = 0;
+    stack->capacity = 0;
+}
+
+template <typename elem_t>
+static inline void stackPush(trav_stack_t<elem_t> * stack, elem_t elem)
+{
+    if (stack->size == stack->capacity){
+        size_t new_capacity = stack->capacity * 2;
+
+        if (stack->elems == stack->inline_elems){
+            elem_t * elems = (elem_t *)malloc(new_capacity * sizeof(elem_t));
+
+            for (size_t index = 0; index < stack->size; index++)
+                elems[index] = stack->elems[index];
+
+            stack->elems = elems;
+        }
+        else
+            stack->elems = (elem_t *)realloc(stack->elems, new_capacity * sizeof(elem_t));
+
+        stack->capacity = new_capacity;
+    }
+
+    stack->elems[stack->size++] = elem;
+}
+
+template <typename elem_t>
+static inline elem_t stackPop(trav_stack_t<elem_t> * stack)
+{
+    assert(stack->size > 0);
+
+    return stack->elems[--stack->size];
+}
+
+template <typename elem_t>
+static inline elem_t * stackTop(trav_stack_t<elem_t> * stack)
+{
+    assert(stack->size > 0);
+
+    return stack->elems + stack->size - 1;
+}
+
+/// @brief frame of postorder traversal, node is expanded when its children are pushed
+typedef struct {
+    node_t * node;
+    bool expanded;
+} trav_frame_t;
+
+#endif
@@ -0,0 +1,828 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "codegen.h"
+#include "differ.h"
+#include "bintree.h"
+#include "trav_stack.h"
+#include "logger.h"
+
+static const size_t EMPTY_SLOT = SIZE_MAX;
+
+static const size_t MIN_TABLE_CAPACITY = 64;
+
+static uint64_t instrHash(const instr_t * instr);
+
+static bool instrEqual(const instr_t * first, const instr_t * second);
+
+static void codeRehash(expr_code_t * code, size_t new_capacity);
+
+static size_t codeAddInstr(expr_code_t * code, instr_t instr);
+
+static size_t codeAddNode(expr_code_t * code, node_t * node);
+
+static bool isNumInstr(const expr_code_t * code, size_t instr_index);
+
+static bool isPowerChain(const expr_code_t * code, const instr_t * instr);
+
+static bool isReciprocal(const expr_code_t * code, const instr_t * instr);
+
+static size_t addNumInstr(expr_code_t * code, double number);
+
+static size_t addOprInstr(expr_code_t * code, enum oper op_num, size_t left, size_t right);
+
+static size_t addPowerChain(expr_code_t * code, size_t base, long exponent);
+
+static size_t reduceInstr(expr_code_t * new_code, const expr_code_t * code, const instr_t * instr, const size_t * new_indices);
+
+expr_code_t codeCtor()
+{
+    expr_code_t code = {};
+
+    code.table_capacity = MIN_TABLE_CAPACITY;
+    code.table = (size_t *)calloc(code.table_capacity, sizeof(size_t));
+
+    for (size_t slot = 0; slot < code.table_capacity; slot++)
+        code.table[slot] = EMPTY_SLOT;
+
+    return code;
+}
+
+void codeDtor(expr_code_t * code)
+{
+    assert(code);
+
+    free(code->instrs);
+    free(code->outputs);
+    free(code->table);
+
+    *code = {};
+}
+
+static uint64_t instrHash(const instr_t * instr)
+{
+    uint64_t number_bits = 0;
+    memcpy(&number_bits, &(instr->number), sizeof(number_bits));
+
+    uint64_t hash = (uint64_t)instr->type * 0x9E3779B97F4A7C15ull;
+
+    hash = (hash ^ (uint64_t)instr->op    ) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ number_bits            ) * 0x94D049BB133111EBull;
+    hash = (hash ^ (uint64_t)instr->var   ) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (uint64_t)instr->left  ) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (uint64_t)instr->right ) * 0x94D049BB133111EBull;
+
+    return hash ^ (hash >> 31);
+}
+
+static bool instrEqual(const instr_t * first, const instr_t * second)
+{
+    return first->type  == second->type
+        && first->op    == second->op
+        && memcmp(&(first->number), &(second->number), sizeof(double)) == 0
+        && first->var   == second->var
+        && first->left  == second->left
+        && first->right == second->right;
+}
+
+static void codeRehash(expr_code_t * code, size_t new_capacity)
+{
+    free(code->table);
+
+    code->table_capacity = new_capacity;
+    code->table = (size_t *)calloc(new_capacity, sizeof(size_t));
+
+    for (size_t slot = 0; slot < new_capacity; slot++)
+        code->table[slot] = EMPTY_SLOT;
+
+    for (size_t instr_index = 0; instr_index < code->size; instr_index++){
+        size_t slot = instrHash(code->instrs + instr_index) & (new_capacity - 1);
+
+        while (code->table[slot] != EMPTY_SLOT)
+            slot = (slot + 1) & (new_capacity - 1);
+
+        code->table[slot] = instr_index;
+    }
+}
+
+/// returns index of the equal instruction if there is one, otherwise adds new
+static size_t codeAddInstr(expr_code_t * code, instr_t instr)
+{
+    size_t slot = instrHash(&instr) & (code->table_capacity - 1);
+
+    while (code->table[slot] != EMPTY_SLOT){
+        if (instrEqual(code->instrs + code->table[slot], &instr)){
+            statsCount(STAT_CSE_HITS, 1);
+            return code->table[slot];
+        }
+
+        slot = (slot + 1) & (code->table_capacity - 1);
+    }
+
+    if (code->size == code->capacity){
+        code->capacity = (code->capacity == 0) ? 64 : code->capacity * 2;
+        code->instrs = (instr_t *)realloc(code->instrs, code->capacity * sizeof(instr_t));
+    }
+
+    size_t instr_index = code->size++;
+    code->instrs[instr_index] = instr;
+    code->table[slot] = instr_index;
+
+    /* load factor is not more than 1/2 */
+    if (2 * code->size > code->table_capacity)
+        codeRehash(code, code->table_capacity * 2);
+
+    return instr_index;
+}
+
+static size_t codeAddNode(expr_code_t * code, node_t * node)
+{
+    assert(node);
+
+    trav_stack_t<trav_frame_t> frames;
+    trav_stack_t<size_t> instr_indices;
+
+    stackInit(&frames);
+    stackInit(&instr_indices);
+
+    stackPush(&frames, {node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node = frame.node;
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        instr_t instr = {};
+
+        instr.type  = type_(node);
+        instr.left  = EMPTY_SLOT;
+        instr.right = EMPTY_SLOT;
+
+        switch (type_(node)){
+            case NUM:
+                instr.number = val_(node).number;
+                break;
+
+            case VAR:
+                instr.var = val_(node).var;
+                break;
+
+            case OPR: {
+                enum oper op_num = val_(node).op;
+
+                if (!frame.expanded){
+                    stackPush(&frames, {node, true});
+
+                    if (opers[op_num].binary)
+                        stackPush(&frames, {node->right, false});
+
+                    stackPush(&frames, {node->left, false});
+                    break;
+                }
+
+                instr.op = op_num;
+
+                if (opers[op_num].binary)
+                    instr.right = stackPop(&instr_indices);
+
+                instr.left = stackPop(&instr_indices);
+
+                /* a+b and b+a are the same instruction */
+                if (opers[op_num].commutative && instr.left > instr.right){
+                    size_t temp = instr.left;
+                    instr.left  = instr.right;
+                    instr.right = temp;
+                }
+                break;
+            }
+
+            default:
+                assert(0 && "unknown element type");
+                break;
+        }
+
+        /* operation is added when its operands are ready */
+        if (type_(node) != OPR || frame.expanded)
+            stackPush(&instr_indices, codeAddInstr(code, instr));
+    }
+
+    size_t root = stackPop(&instr_indices);
+
+    stackDtor(&frames);
+    stackDtor(&instr_indices);
+
+    return root;
+}
+
+size_t codeAddTree(expr_code_t * code, node_t * node)
+{
+    assert(code);
+    assert(node);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_CODEGEN);
+
+    size_t root = codeAddNode(code, node);
+
+    statsPhaseEnd(timer);
+
+    if (code->outputs_num == code->outputs_capacity){
+        code->outputs_capacity = (code->outputs_capacity == 0) ? 8 : code->outputs_capacity * 2;
+        code->outputs = (size_t *)realloc(code->outputs, code->outputs_capacity * sizeof(size_t));
+    }
+
+    code->outputs[code->outputs_num] = root;
+
+    return code->outputs_num++;
+}
+
+void codeEvaluate(const expr_code_t * code, const double * var_values, double * regs, double * outputs)
+{
+    assert(code);
+    assert(var_values);
+    assert(regs);
+    assert(outputs);
+
+    statsCount(STAT_EVALUATIONS, 1);
+
+    for (size_t instr_index = 0; instr_index < code->size; instr_index++){
+        const instr_t * instr = code->instrs + instr_index;
+
+        switch (instr->type){
+            case NUM:
+                regs[instr_index] = instr->number;
+                break;
+
+            case VAR:
+                regs[instr_index] = var_values[instr->var];
+                break;
+
+            case OPR:
+                regs[instr_index] = calcOper(instr->op, regs[instr->left],
+                                             opers[instr->op].binary ? regs[instr->right] : 0.);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    for (size_t output = 0; output < code->outputs_num; output++)
+        outputs[output] = regs[code->outputs[output]];
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+/// integer powers with bigger exponents stay pow() calls
+static const long MAX_POWER_CHAIN = 64;
+
+static bool isNumInstr(const expr_code_t * code, size_t instr_index)
+{
+    return instr_index != EMPTY_SLOT && code->instrs[instr_index].type == NUM;
+}
+
+static bool isPowerChain(const expr_code_t * code, const instr_t * instr)
+{
+    if (instr->op != POW || !isNumInstr(code, instr->right))
+        return false;
+
+    double exponent = code->instrs[instr->right].number;
+
+    return exponent == floor(exponent) && fabs(exponent) <= (double)MAX_POWER_CHAIN;
+}
+
+static bool isReciprocal(const expr_code_t * code, const instr_t * instr)
+{
+    if (instr->op != DIV || !isNumInstr(code, instr->right))
+        return false;
+
+    double divisor = code->instrs[instr->right].number;
+
+    return divisor != 0. && isfinite(divisor);
+}
+
+static size_t addNumInstr(expr_code_t * code, double number)
+{
+    instr_t instr = {};
+
+    instr.type   = NUM;
+    instr.number = number;
+    instr.left   = EMPTY_SLOT;
+    instr.right  = EMPTY_SLOT;
+
+    return codeAddInstr(code, instr);
+}
+
+static size_t addOprInstr(expr_code_t * code, enum oper op_num, size_t left, size_t right)
+{
+    instr_t instr = {};
+
+    instr.type  = OPR;
+    instr.op    = op_num;
+    instr.left  = left;
+    instr.right = right;
+
+    if (opers[op_num].commutative && instr.left > instr.right){
+        instr.left  = right;
+        instr.right = left;
+    }
+
+    return codeAddInstr(code, instr);
+}
+
+/// base^exponent by squaring, squares are shared by CSE
+static size_t addPowerChain(expr_code_t * code, size_t base, long exponent)
+{
+    if (exponent == 0)
+        return addNumInstr(code, 1.);
+
+    unsigned long rest = (unsigned long)labs(exponent);
+    size_t result = EMPTY_SLOT;
+
+    while (rest != 0){
+        if (rest & 1)
+            result = (result == EMPTY_SLOT) ? base : addOprInstr(code, MUL, result, base);
+
+        rest >>= 1;
+
+        if (rest != 0)
+            base = addOprInstr(code, MUL, base, base);
+    }
+
+    if (exponent < 0)
+        result = addOprInstr(code, DIV, addNumInstr(code, 1.), result);
+
+    return result;
+}
+
+/// adds reduced instruction to new_code, operands are taken from new_indices
+static size_t reduceInstr(expr_code_t * new_code, const expr_code_t * code, const instr_t * instr, const size_t * new_indices)
+{
+    if (instr->type == NUM)
+        return addNumInstr(new_code, instr->number);
+
+    if (instr->type == VAR)
+        return codeAddInstr(new_code, *instr);
+
+    bool binary = opers[instr->op].binary;
+
+    double left_num  = isNumInstr(code, instr->left)  ? code->instrs[instr->left].number  : 0.;
+    double right_num = isNumInstr(code, instr->right) ? code->instrs[instr->right].number : 0.;
+
+    /* operations of constants, including factorials */
+    if (isNumInstr(code, instr->left) && (!binary || isNumInstr(code, instr->right)))
+        return addNumInstr(new_code, calcOper(instr->op, left_num, right_num));
+
+    size_t left = new_indices[instr->left];
+
+    switch (instr->op){
+        case POW:
+            if (isPowerChain(code, instr))
+                return addPowerChain(new_code, left, (long)right_num);
+            break;
+
+        case DIV:
+            if (isReciprocal(code, instr))
+                return addOprInstr(new_code, MUL, left, addNumInstr(new_code, 1. / right_num));
+            break;
+
+        case LOG: {
+            /* log_a(b) = ln(b) / ln(a), ln(a) of the same base is computed once or is a constant */
+            size_t ln_right = addOprInstr(new_code, LN, new_indices[instr->right], EMPTY_SLOT);
+
+            if (isNumInstr(code, instr->left))
+                return addOprInstr(new_code, MUL, ln_right, addNumInstr(new_code, 1. / log(left_num)));
+
+            return addOprInstr(new_code, DIV, ln_right, addOprInstr(new_code, LN, left, EMPTY_SLOT));
+        }
+
+        default:
+            break;
+    }
+
+    return addOprInstr(new_code, instr->op, left, binary ? new_indices[instr->right] : EMPTY_SLOT);
+}
+
+void codeStrengthReduce(expr_code_t * code)
+{
+    assert(code);
+
+    if (code->size == 0)
+        return;
+
+    /* instructions that are still needed after reduction: exponents, divisors and operands of constant
+       operations are dropped, so they are not copied to the new code if nothing else uses them */
+    bool * needed = (bool *)calloc(code->size, sizeof(bool));
+
+    for (size_t output = 0; output < code->outputs_num; output++)
+        needed[code->outputs[output]] = true;
+
+    for (size_t instr_index = code->size; instr_index-- > 0;){
+        const instr_t * instr = code->instrs + instr_index;
+
+        if (!needed[instr_index] || instr->type != OPR)
+            continue;
+
+        bool binary = opers[instr->op].binary;
+
+        if (isNumInstr(code, instr->left) && (!binary || isNumInstr(code, instr->right)))
+            continue;
+
+        bool drop_left  = (instr->op == LOG) && isNumInstr(code, instr->left);
+        bool drop_right = isPowerChain(code, instr) || isReciprocal(code, instr);
+
+        if (!drop_left)
+            needed[instr->left] = true;
+
+        if (binary && !drop_right)
+            needed[instr->right] = true;
+    }
+
+    expr_code_t new_code = codeCtor();
+    size_t * new_indices = (size_t *)calloc(code->size, sizeof(size_t));
+
+    for (size_t instr_index = 0; instr_index < code->size; instr_index++){
+        new_indices[instr_index] = EMPTY_SLOT;
+
+        if (needed[instr_index])
+            new_indices[instr_index] = reduceInstr(&new_code, code, code->instrs + instr_index, new_indices);
+    }
+
+    for (size_t output = 0; output < code->outputs_num; output++){
+        if (new_code.outputs_num == new_code.outputs_capacity){
+            new_code.outputs_capacity = (new_code.outputs_capacity == 0) ? 8 : new_code.outputs_capacity * 2;
+            new_code.outputs = (size_t *)realloc(new_code.outputs, new_code.outputs_capacity * sizeof(size_t));
+        }
+
+        new_code.outputs[new_code.outputs_num++] = new_indices[code->outputs[output]];
+    }
+
+    logPrint(LOG_DEBUG, "strength reduction: %zu instructions -> %zu\n", code->size, new_code.size);
+
+    free(needed);
+    free(new_indices);
+    codeDtor(code);
+
+    *code = new_code;
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+/// names that cannot be used as names of parameters in generated code: keywords of C (up to C23),
+/// macros and functions of math.h and identifiers that the generated code uses itself (temporaries T0, T1, ... too)
+static const char * const RESERVED_NAMES[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum",
+    "extern", "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return",
+    "short", "signed", "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void",
+    "volatile", "while", "bool", "true", "false", "alignas", "alignof", "constexpr", "nullptr",
+    "static_assert", "thread_local", "typeof", "typeof_unqual", "size_t", "NULL", "NAN", "INFINITY",
+    "sin", "cos", "tan", "log", "pow", "diff_factorial", "N", "I", "OUT"
+};
+
+static bool isReservedName(const char * name);
+
+static void printVarName(FILE * file, diff_t * diff, unsigned int var_index);
+
+static void printNumber(FILE * file, double number);
+
+static void printOperand(FILE * file, diff_t * diff, expr_code_t * code, size_t instr_index, bool array);
+
+static void printInstr(FILE * file, diff_t * diff, expr_code_t * code, size_t instr_index, bool array);
+
+static void printParams(FILE * file, diff_t * diff, bool array);
+
+static void printUnusedParams(FILE * file, diff_t * diff, expr_code_t * code, const char * indent);
+
+/// reserved words, temporaries T<number> and identifiers reserved by C (_Bool, __x and other _Upper ones)
+static bool isReservedName(const char * name)
+{
+    for (size_t index = 0; index < sizeof(RESERVED_NAMES) / sizeof(*RESERVED_NAMES); index++)
+        if (strcmp(name, RESERVED_NAMES[index]) == 0)
+            return true;
+
+    if (name[0] == 'T' && name[1] != '\0' && strspn(name + 1, "0123456789") == strlen(name + 1))
+        return true;
+
+    return name[0] == '_' && (name[1] == '_' || (name[1] >= 'A' && name[1] <= 'Z'));
+}
+
+/// reserved name is printed as name_var with underscores appended until it differs from names of other variables
+static void printVarName(FILE * file, diff_t * diff, unsigned int var_index)
+{
+    const char * name = diff->var_names[var_index];
+
+    if (!isReservedName(name)){
+        fprintf(file, "%s", name);
+        return;
+    }
+
+    /* every other variable can take at most one candidate */
+    size_t name_len = strlen(name);
+    char * new_name = (char *)calloc(name_len + sizeof("_var") + diff->var_num + 1, sizeof(char));
+
+    memcpy(new_name, name, name_len);
+    strcat(new_name, "_var");
+
+    bool taken = true;
+
+    while (taken){
+        taken = false;
+
+        for (unsigned int other_index = 0; other_index < diff->var_num && !taken; other_index++)
+            taken = (strcmp(new_name, diff->var_names[other_index]) == 0);
+
+        if (taken)
+            strcat(new_name, "_");
+    }
+
+    fprintf(file, "%s", new_name);
+
+    free(new_name);
+}
+
+static void printNumber(FILE * file, double number)
+{
+    if (isnan(number)){
+        fprintf(file, "NAN");
+        return;
+    }
+
+    if (isinf(number)){
+        fprintf(file, (number > 0) ? "INFINITY" : "(-INFINITY)");
+        return;
+    }
+
+    const size_t NUMBER_LEN = 64;
+    char buffer[NUMBER_LEN] = "";
+
+    snprintf(buffer, NUMBER_LEN, "%.17g", number);
+
+    /* literal must be double */
+    bool is_integer = (strpbrk(buffer, ".e") == NULL);
+
+    fprintf(file, (number < 0) ? "(%s%s)" : "%s%s", buffer, is_integer ? ".0" : "");
+}
+
+static void printOperand(FILE * file, diff_t * diff, expr_code_t * code, size_t instr_index, bool array)
+{
+    instr_t * instr = code->instrs + instr_index;
+
+    switch (instr->type){
+        case NUM:
+            printNumber(file, instr->number);
+            break;
+
+        case VAR:
+            printVarName(file, diff, instr->var);
+            if (array)
+                fprintf(file, "[I]");
+            break;
+
+        case OPR:
+            fprintf(file, "T%zu", instr_index);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* variables are lowercase so uppercase names of temporaries and indices never clash with them */
+static void printInstr(FILE * file, diff_t * diff, expr_code_t * code, size_t instr_index, bool array)
+{
+    instr_t * instr = code->instrs + instr_index;
+
+    fprintf(file, "const double T%zu = ", instr_index);
+
+    switch (instr->op){
+        case ADD: case SUB: case MUL: case DIV:
+            printOperand(file, diff, code, instr->left, array);
+            fprintf(file, " %s ", opers[instr->op].name);
+            printOperand(file, diff, code, instr->right, array);
+            break;
+
+        case POW:
+            fprintf(file, "pow(");
+            printOperand(file, diff, code, instr->left, array);
+            fprintf(file, ", ");
+            printOperand(file, diff, code, instr->right, array);
+            fprintf(file, ")");
+            break;
+
+        case SIN: case COS: case TAN:
+            fprintf(file, "%s(", opers[instr->op].name);
+            printOperand(file, diff, code, instr->left, array);
+            fprintf(file, ")");
+            break;
+
+        case LN:
+            fprintf(file, "log(");
+            printOperand(file, diff, code, instr->left, array);
+            fprintf(file, ")");
+            break;
+
+        case LOG:
+            fprintf(file, "log(");
+            printOperand(file, diff, code, instr->right, array);
+            fprintf(file, ") / log(");
+            printOperand(file, diff, code, instr->left, array);
+            fprintf(file, ")");
+            break;
+
+        case FAC:
+            fprintf(file, "diff_factorial(");
+            printOperand(file, diff, code, instr->left, array);
+            fprintf(file, ")");
+            break;
+
+        default:
+            fprintf(file, "NAN");
+            break;
+    }
+
+    fprintf(file, ";\n");
+}
+
+static void printParams(FILE * file, diff_t * diff, bool array)
+{
+    for (unsigned int var_index = 0; var_index < diff->var_num; var_index++){
+        if (var_index > 0)
+            fprintf(file, ", ");
+
+        fprintf(file, array ? "const double * restrict " : "double ");
+        printVarName(file, diff, var_index);
+    }
+}
+
+static void printUnusedParams(FILE * file, diff_t * diff, expr_code_t * code, const char * indent)
+{
+    for (unsigned int var_index = 0; var_index < diff->var_num; var_index++){
+        bool used = false;
+
+        for (size_t instr_index = 0; instr_index < code->size && !used; instr_index++)
+            used = (code->instrs[instr_index].type == VAR && code->instrs[instr_index].var == var_index);
+
+        if (!used){
+            fprintf(file, "%s(void)", indent);
+            printVarName(file, diff, var_index);
+            fprintf(file, ";\n");
+        }
+    }
+}
+
+void emitCCode(diff_t * diff, expr_code_t * code, const char * name, FILE * file)
+{
+    assert(diff);
+    assert(code);
+    assert(name);
+    assert(file);
+    assert(code->outputs_num > 0);
+
+    fprintf(file,
+        "#ifndef DIFF_GENERATED_HELPERS\n"
+        "#define DIFF_GENERATED_HELPERS\n"
+        "#include <math.h>\n"
+        "#include <stddef.h>\n"
+        "\n"
+        "static inline double diff_factorial(double number)\n"
+        "{\n"
+        "    double result = 1.;\n"
+        "    for (unsigned long index = (unsigned long)number; index > 1; index--)\n"
+        "        result *= (double)index;\n"
+        "    return result;\n"
+        "}\n"
+        "#endif\n"
+        "\n");
+
+    bool single = (code->outputs_num == 1);
+
+    /* one point */
+    fprintf(file, single ? "double %s(" : "void %s(", name);
+    printParams(file, diff, false);
+    if (!single)
+        fprintf(file, (diff->var_num > 0) ? ", double * restrict OUT" : "double * restrict OUT");
+    fprintf(file, ")\n{\n");
+
+    printUnusedParams(file, diff, code, "    ");
+
+    for (size_t instr_index = 0; instr_index < code->size; instr_index++){
+        if (code->instrs[instr_index].type != OPR)
+            continue;
+
+        fprintf(file, "    ");
+        printInstr(file, diff, code, instr_index, false);
+    }
+
+    if (single){
+        fprintf(file, "    return ");
+        printOperand(file, diff, code, code->outputs[0], false);
+        fprintf(file, ";\n");
+    }
+    else {
+        for (size_t output = 0; output < code->outputs_num; output++){
+            fprintf(file, "    OUT[%zu] = ", output);
+            printOperand(file, diff, code, code->outputs[output], false);
+            fprintf(file, ";\n");
+        }
+    }
+
+    fprintf(file, "}\n\n");
+
+    /* arrays of points, body is inside the loop so it can be vectorized */
+    fprintf(file, "void %s_array(size_t N", name);
+    if (diff->var_num > 0)
+        fprintf(file, ", ");
+    printParams(file, diff, true);
+    fprintf(file, ", double * restrict OUT)\n{\n");
+
+    printUnusedParams(file, diff, code, "    ");
+
+    fprintf(file, "    for (size_t I = 0; I < N; I++){\n");
+
+    for (size_t instr_index = 0; instr_index < code->size; instr_index++){
+        if (code->instrs[instr_index].type != OPR)
+            continue;
+
+        fprintf(file, "        ");
+        printInstr(file, diff, code, instr_index, true);
+    }
+
+    for (size_t output = 0; output < code->outputs_num; output++){
+        if (single)
+            fprintf(file, "        OUT[I] = ");
+        else
+            fprintf(file, "        OUT[%zu * N + I] = ", output);
+
+        printOperand(file, diff, code, code->outputs[output], true);
+        fprintf(file, ";\n");
+    }
+
+    fprintf(file, "    }\n}\n\n");
+
+    logPrint(LOG_DEBUG, "emitted C function '%s': %zu instructions, %zu outputs\n", name, code->size, code->outputs_num);
+}
+
+void emitC(diff_t * diff, node_t * node, const char * name, FILE * file)
+{
+    assert(diff);
+    assert(node);
+
+    expr_code_t code = codeCtor();
+
+    codeAddTree(&code, node);
+    codeStrengthReduce(&code);
+
+    emitCCode(diff, &code, name, file);
+
+    codeDtor(&code);
+}
+
+bool emitCGradient(diff_t * diff, node_t * node, const char * name, FILE * file)
+{
+    assert(diff);
+    assert(node);
+    assert(name);
+
+    /* checked before making any derivative, rules of factorial and log do not exist */
+    for (unsigned int var_index = 0; var_index < diff->var_num; var_index++){
+        if (derivativeSize(node, var_index) == SIZE_MAX){
+            logPrint(LOG_RELEASE, "cannot emit gradient '%s': no derivative by variable '%s'\n",
+                                  name, diff->var_names[var_index]);
+            return false;
+        }
+    }
+
+    expr_code_t code = codeCtor();
+
+    codeAddTree(&code, node);
+
+    /* derivatives share subexpressions with the expression and each other in one code */
+    for (unsigned int var_index = 0; var_index < diff->var_num; var_index++){
+        node_t * derivative = makeDerivative(diff, node, var_index);
+        derivative = simplifyExpression(derivative);
+
+        codeAddTree(&code, derivative);
+
+        exprDestroy(derivative);
+    }
+
+    codeStrengthReduce(&code);
+
+    const size_t SUFFIX_LEN = 8;
+    size_t grad_name_len = strlen(name) + SUFFIX_LEN;
+    char * grad_name = (char *)calloc(grad_name_len, sizeof(char));
+
+    snprintf(grad_name, grad_name_len, "%s_grad", name);
+
+    emitCCode(diff, &code, grad_name, file);
+
+    free(grad_name);
+    codeDtor(&code);
+
+    return true;
+}
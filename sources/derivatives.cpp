@@ -1,58 +1,73 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
 
 #include "bintree.h"
 #include "differ.h"
+#include "trav_stack.h"
 
 #define OPR_ newOprNode
 #define NUM(number) newNumNode(number)
-#define DL_ makeDerivative(diff, node->left , var_index)
-#define DR_ makeDerivative(diff, node->right, var_index)
-#define CL_ treeCopy(node->left )
-#define CR_ treeCopy(node->right)
+#define DL_ d_left
+#define DR_ d_right
+#define CL_ exprCopy(node->left )
+#define CR_ exprCopy(node->right)
+#define ML_ moveOperand(node->left , consume)
+#define MR_ moveOperand(node->right, consume)
 
-#define D_(node) makeDerivative(diff, node, var_index)
-#define C_(node) treeCopy(node)
+/// operand at its last use in the rule: moved if the source is consumed, copied otherwise
+static node_t * moveOperand(node_t * operand, bool consume);
 
-node_t * diffAddSub(diff_t * diff, node_t * node, unsigned int var_index)
+static node_t * moveOperand(node_t * operand, bool consume)
+{
+    return consume ? operand : exprCopy(operand);
+}
+
+node_t * diffAddSub(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
 
+    /* operands are not used, when consuming they are already consumed by their own derivatives */
+    (void) var_index;
+    (void) consume;
+
     enum oper op_num = val_(node).op;
 
-    return  OPR_(op_num,
-                D_(node->left),
-                D_(node->right));
+    return  OPR_(op_num, DL_, DR_);
 }
 
-node_t * diffMul(diff_t * diff, node_t * node, unsigned int var_index)
+node_t * diffMul(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
 
+    (void) var_index;
+
     return  OPR_(ADD,
-                OPR_(MUL, DL_, CR_),
-                OPR_(MUL, CL_, DR_)
+                OPR_(MUL, DL_, MR_),
+                OPR_(MUL, ML_, DR_)
             );
 }
 
-node_t * diffDiv(diff_t * diff, node_t * node, unsigned int var_index)
+node_t * diffDiv(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
 
+    (void) var_index;
+
     return  OPR_(DIV,
                 OPR_(SUB,
                     OPR_(MUL, DL_, CR_),
-                    OPR_(MUL, CL_, DR_)
+                    OPR_(MUL, ML_, DR_)
                 ),
-                OPR_(POW, CR_, NUM(2.))
+                OPR_(POW, MR_, NUM(2.))
             );
 }
 
-node_t * diffPow(diff_t * diff, node_t * node, unsigned int var_index)
+node_t * diffPow(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
@@ -61,28 +76,40 @@ node_t * diffPow(diff_t * diff, node_t * node, unsigned int var_index)
     size_t num_vars_in_right = countVars(node->right, var_index);
 
     if (num_vars_in_left == 0){
-        if (num_vars_in_right == 0)
+        exprDestroy(d_left);
+
+        if (num_vars_in_right == 0){
+            exprDestroy(d_right);
+
+            if (consume){
+                exprDestroy(node->left);
+                exprDestroy(node->right);
+            }
+
             return NUM(0.);
+        }
 
         return
             OPR_(MUL,
                 OPR_(MUL,
-                    C_(node),
-                    OPR_(LN, CL_, NULL)
+                    OPR_(POW, CL_, MR_),
+                    OPR_(LN, ML_, NULL)
                 ),
                 DR_
             );
     }
 
     if (num_vars_in_right == 0){
+        exprDestroy(d_right);
+
         return
             OPR_(MUL,
                 OPR_(MUL,
                     CR_,
                     OPR_(POW,
-                        CL_,
+                        ML_,
                         OPR_(SUB,
-                            CR_,
+                            MR_,
                             NUM(1.)
                         )
                     )
@@ -93,17 +120,17 @@ node_t * diffPow(diff_t * diff, node_t * node, unsigned int var_index)
 
     return
         OPR_(MUL,
-            C_(node),
+            OPR_(POW, CL_, CR_),
             OPR_(ADD,
                 OPR_(DIV,
                     OPR_(MUL,
                         DL_,
-                        CR_
+                        MR_
                     ),
                     CL_
                 ),
                 OPR_(MUL,
-                    OPR_(LN, CL_, NULL),
+                    OPR_(LN, ML_, NULL),
                     DR_
                 )
             )
@@ -111,24 +138,30 @@ node_t * diffPow(diff_t * diff, node_t * node, unsigned int var_index)
 
 }
 
-node_t * diffSin(diff_t * diff, node_t * node, unsigned int var_index)
+node_t * diffSin(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
+    assert(d_right == NULL);
+
+    (void) var_index;
 
     return  OPR_(MUL,
-                OPR_(COS, CL_, NULL),
+                OPR_(COS, ML_, NULL),
                 DL_
             );
 }
 
-node_t * diffCos(diff_t * diff, node_t * node, unsigned int var_index)
+node_t * diffCos(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
+    assert(d_right == NULL);
+
+    (void) var_index;
 
     return  OPR_(MUL,
-                OPR_(SIN, CL_, NULL),
+                OPR_(SIN, ML_, NULL),
                 OPR_(MUL,
                     DL_,
                     NUM(-1.)
@@ -136,28 +169,206 @@ node_t * diffCos(diff_t * diff, node_t * node, unsigned int var_index)
             );
 }
 
-node_t * diffTan(diff_t * diff, node_t * node, unsigned int var_index)
+node_t * diffTan(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
+    assert(d_right == NULL);
+
+    (void) var_index;
 
     return  OPR_(DIV,
-                NUM(1.),
+                DL_,
                 OPR_(POW,
-                    OPR_(COS, CL_, NULL),
+                    OPR_(COS, ML_, NULL),
                     NUM(2.)
                 )
             );
 }
 
-node_t * diffLn(diff_t * diff, node_t * node, unsigned int var_index)
+node_t * diffLn(node_t * node, unsigned int var_index, node_t * d_left, node_t * d_right, bool consume)
 {
     assert(node);
     assert(type_(node) == OPR);
+    assert(d_right == NULL);
+
+    (void) var_index;
 
     return
         OPR_(DIV,
             DL_,
-            CL_
+            ML_
         );
 }
+
+typedef struct {
+    size_t size;
+    size_t deriv_size;
+    size_t vars_num;
+} deriv_size_t;
+
+static deriv_size_t combineSizes(node_t * node, deriv_size_t left, deriv_size_t right, unsigned int var_index);
+
+static size_t addSizes(size_t first, size_t second);
+
+static deriv_size_t sizesRecursive(node_t * node, unsigned int var_index, size_t depth);
+
+static deriv_size_t sizesIterative(node_t * node, unsigned int var_index);
+
+/// saturating addition, SIZE_MAX means there is no rule for derivative
+static size_t addSizes(size_t first, size_t second)
+{
+    if (first > SIZE_MAX - second)
+        return SIZE_MAX;
+
+    return first + second;
+}
+
+size_t derivativeSize(node_t * expr_node, unsigned int var_index)
+{
+    assert(expr_node);
+
+    return sizesRecursive(expr_node, var_index, 0).deriv_size;
+}
+
+static deriv_size_t sizesRecursive(node_t * node, unsigned int var_index, size_t depth)
+{
+    if (depth == RECURSIVE_WALK_DEPTH)
+        return sizesIterative(node, var_index);
+
+    if (type_(node) == DRV)
+        expandDeferred(node);
+
+    deriv_size_t left  = {.size = 0, .deriv_size = 0, .vars_num = 0};
+    deriv_size_t right = {.size = 0, .deriv_size = 0, .vars_num = 0};
+
+    if (type_(node) == OPR){
+        left = sizesRecursive(node->left, var_index, depth + 1);
+
+        if (opers[val_(node).op].binary)
+            right = sizesRecursive(node->right, var_index, depth + 1);
+    }
+
+    return combineSizes(node, left, right, var_index);
+}
+
+static deriv_size_t sizesIterative(node_t * expr_node, unsigned int var_index)
+{
+    trav_stack_t<trav_frame_t> frames;
+    trav_stack_t<deriv_size_t> sizes;
+
+    stackInit(&frames);
+    stackInit(&sizes);
+
+    stackPush(&frames, {expr_node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node_t * node = frame.node;
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        deriv_size_t left  = {.size = 0, .deriv_size = 0, .vars_num = 0};
+        deriv_size_t right = {.size = 0, .deriv_size = 0, .vars_num = 0};
+
+        if (type_(node) == OPR){
+            if (!frame.expanded){
+                stackPush(&frames, {node, true});
+
+                if (opers[val_(node).op].binary)
+                    stackPush(&frames, {node->right, false});
+
+                stackPush(&frames, {node->left, false});
+                continue;
+            }
+
+            if (opers[val_(node).op].binary)
+                right = stackPop(&sizes);
+
+            left = stackPop(&sizes);
+        }
+
+        stackPush(&sizes, combineSizes(node, left, right, var_index));
+    }
+
+    deriv_size_t result = stackPop(&sizes);
+
+    stackDtor(&frames);
+    stackDtor(&sizes);
+
+    return result;
+}
+
+/* sizes mirror the rules above, S - size of the operand copy, D - size of the operand derivative */
+static deriv_size_t combineSizes(node_t * node, deriv_size_t left, deriv_size_t right, unsigned int var_index)
+{
+    deriv_size_t sizes = {.size = 1, .deriv_size = 1, .vars_num = 0};
+
+    if (type_(node) == NUM)
+        return sizes;
+
+    if (type_(node) == VAR){
+        sizes.vars_num = (val_(node).var == var_index) ? 1 : 0;
+        return sizes;
+    }
+
+    enum oper op_num = val_(node).op;
+
+    sizes.size     = 1 + left.size + right.size;
+    sizes.vars_num = left.vars_num + right.vars_num;
+
+    size_t SL = left.size,       SR = right.size;
+    size_t DL = left.deriv_size, DR = right.deriv_size;
+
+    switch (op_num){
+        case ADD: case SUB:
+            sizes.deriv_size = addSizes(1, addSizes(DL, DR));
+            break;
+
+        case MUL:
+            sizes.deriv_size = addSizes(3 + SL + SR, addSizes(DL, DR));
+            break;
+
+        case DIV:
+            sizes.deriv_size = addSizes(6 + SL + 2 * SR, addSizes(DL, DR));
+            break;
+
+        case POW:
+            /* derivatives of both operands are made even if the rule drops them */
+            if (DL == SIZE_MAX || DR == SIZE_MAX)
+                sizes.deriv_size = SIZE_MAX;
+            else if (left.vars_num == 0 && right.vars_num == 0)
+                sizes.deriv_size = 1;
+            else if (left.vars_num == 0)
+                sizes.deriv_size = addSizes(3 + sizes.size + SL, DR);
+            else if (right.vars_num == 0)
+                sizes.deriv_size = addSizes(5 + 2 * SR + SL, DL);
+            else
+                sizes.deriv_size = addSizes(6 + sizes.size + SR + 2 * SL, addSizes(DL, DR));
+            break;
+
+        case SIN:
+            sizes.deriv_size = addSizes(2 + SL, DL);
+            break;
+
+        case COS:
+            sizes.deriv_size = addSizes(4 + SL, DL);
+            break;
+
+        case TAN:
+            sizes.deriv_size = addSizes(4 + SL, DL);
+            break;
+
+        case LN:
+            sizes.deriv_size = addSizes(1 + SL, DL);
+            break;
+
+        case LOG: case FAC:
+        default:
+            sizes.deriv_size = SIZE_MAX;
+            break;
+    }
+
+    return sizes;
+}
@@ -3,11 +3,15 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 
 #include "differ.h"
 #include "bintree.h"
 #include "logger.h"
-#include "hashtable.h"
+#include "sym_table.h"
+#include "trace.h"
+#include "trav_stack.h"
+#include "thread_pool.h"
 
 static void fillOperTable(diff_t * diff);
 
@@ -15,12 +19,23 @@ const size_t OPR_TABLE_SIZE = 32;
 
 const size_t VAR_TABLE_SIZE = 32;
 
+const size_t MIN_VAR_CAPACITY = 16;
+
+const size_t GENERATED_VAR_NAME_LEN = 32;
+
 void diffInit(diff_t * diff)
 {
     assert(diff);
 
-    diff->oper_table = tableCtor(OPR_TABLE_SIZE);
-    diff-> var_table = tableCtor(VAR_TABLE_SIZE);
+    diff->oper_table = symTableCtor(OPR_TABLE_SIZE);
+    diff-> var_table = symTableCtor(VAR_TABLE_SIZE);
+
+    diff->var_names    = NULL;
+    diff->var_values   = NULL;
+    diff->var_num      = 0;
+    diff->var_capacity = 0;
+
+    statsReset(&(diff->stats));
 
     fillOperTable(diff);
 }
@@ -29,8 +44,22 @@ void diffDtor(diff_t * diff)
 {
     assert(diff);
 
-    tableDtor(&(diff->oper_table));
-    tableDtor(&(diff-> var_table));
+    symTableDtor(&(diff->oper_table));
+    symTableDtor(&(diff-> var_table));
+
+    for (unsigned int var_index = 0; var_index < diff->var_num; var_index++)
+        free(diff->var_names[var_index]);
+
+    free(diff->var_names);
+    free(diff->var_values);
+
+    diff->var_names    = NULL;
+    diff->var_values   = NULL;
+    diff->var_num      = 0;
+    diff->var_capacity = 0;
+
+    if (active_stats == &(diff->stats))
+        statsDisable();
 }
 
 static void fillOperTable(diff_t * diff)
@@ -38,477 +67,1980 @@ static void fillOperTable(diff_t * diff)
     assert(diff);
 
     for (size_t oper_index = 0; oper_index < opers_size; oper_index++){
-        tableInsert(&(diff->oper_table), opers[oper_index].name, opers + oper_index, sizeof(oper_t));
+        symInsert(&(diff->oper_table), opers[oper_index].name, oper_index);
     }
 }
 
-node_t * makeDerivative(diff_t * diff, node_t * expr_node, unsigned int var_index)
-{
-    assert(diff);
-    assert(expr_node);
+/// frame of derivative traversal, consumed nodes are deleted after their rule
+typedef struct {
+    node_t * node;
+    bool expanded;
+    bool consume;
 
-    switch (type_(expr_node)){
-        case NUM: {
-            return newNumNode(0.);
-        }
+    node_t * ready;     ///< derivative of the node made by a task of parallel version
+} deriv_frame_t;
 
-        case VAR: {
-            if (val_(expr_node).var == var_index){
-                return newNumNode(1.);
-            }
-            return treeCopy(expr_node);
-        }
+/// subtree processed by one task of parallel versions, link is the child pointer in its parent
+typedef struct {
+    node_t * node;
+    node_t * parent;
+    node_t ** link;
+    size_t size;
 
-        case OPR: {
-            enum oper op_num = val_(expr_node).op;
-            diff_func_t diffFunc = opers[op_num].diffFunc;
+    node_t * result;
+    bool changed;
+} par_subtree_t;
 
-            return diffFunc(diff, expr_node, var_index);
-        }
-    }
-}
+/// tree split into subtrees for tasks, the top part above them is processed serially
+typedef struct {
+    par_subtree_t * subtrees;   ///< sorted by link
+    size_t subtrees_num;
 
-double calcOper(enum oper op_num, double left_val, double right_val)
-{
-    double new_val = 0.;
+    size_t * task_starts;       ///< subtrees of task are [task_starts[task], task_starts[task + 1])
+    size_t tasks_num;
 
-    switch (op_num){
-        case ADD:
-            new_val = left_val + right_val;
-            break;
+    node_t ** top_nodes;        ///< nodes above subtrees, sorted
+    size_t top_nodes_num;
+} par_split_t;
 
-        case SUB:
-            new_val = left_val - right_val;
-            break;
+/// split of the tree whose top part is differentiated by this thread, operands of the top part are copied in parallel
+static thread_local struct {
+    const par_split_t * split;
+    thread_pool_t * pool;
+} par_copy = {};
 
-        case MUL:
-            new_val = left_val * right_val;
-            break;
+static node_t * derivative(diff_t * diff, node_t * expr_node, unsigned int var_index, bool consume, const par_split_t * split);
 
-        case DIV:
-            new_val = left_val / right_val;
-            break;
+static node_t * derivativeRecursive(diff_t * diff, node_t * expr_node, unsigned int var_index, bool consume, size_t depth);
 
-        case POW:
-            new_val = pow(left_val, right_val);
-            break;
+static node_t * derivativeIterative(diff_t * diff, node_t * expr_node, unsigned int var_index, bool consume, const par_split_t * split);
 
-        case FAC:
-            new_val = (double)factorial((long unsigned int)left_val);
-            break;
+static bool usesOperands(enum oper op_num);
 
-        case SIN:
-            new_val = sin(left_val);
-            break;
+static par_split_t splitTree(node_t * root, size_t threads_num);
 
-        case COS:
-            new_val = cos(left_val);
-            break;
+static void splitDtor(par_split_t * split);
 
-        case TAN:
-            new_val = tan(left_val);
-            break;
+static par_subtree_t * findSubtree(const par_split_t * split, node_t ** link);
 
-        case LN:
-            new_val = log(left_val);
-            break;
+static bool isTopNode(const par_split_t * split, node_t * node);
 
-        case LOG:
-            new_val = log(right_val) / log(left_val);
-            break;
+static bool hasDerivativeRules(node_t * expr_node, unsigned int var_index);
 
-        default:
-            fprintf(stderr, "CANNOT CALCULATE THIS OPERATION: %d\n", op_num);
-            exit(1);
-    }
-    return new_val;
+/// derivative is refused before anything is made, so rules without function are never called
+static bool hasDerivativeRules(node_t * expr_node, unsigned int var_index)
+{
+    if (derivativeSize(expr_node, var_index) != SIZE_MAX)
+        return true;
+
+    logPrint(LOG_RELEASE, "there is no derivative rule for some operation of expression %p\n", expr_node);
+    return false;
 }
 
-double evaluate(diff_t * diff, node_t * node)
+node_t * makeDerivative(diff_t * diff, node_t * expr_node, unsigned int var_index)
 {
-    assert(node);
     assert(diff);
+    assert(expr_node);
 
-    logPrint(LOG_DEBUG_PLUS, "entered evaluate for root %p\n", node);
-    logPrint(LOG_DEBUG_PLUS, "\tvalue: %lg, type: %d\n", val_(node).number, type_(node));
+    if (!hasDerivativeRules(expr_node, var_index))
+        return NULL;
 
-    if (type_(node) == NUM)
-        return val_(node).number;
+    stats_timer_t timer = statsPhaseBegin(PHASE_DERIVATIVE);
 
-    if (type_(node) == VAR)
-        return diff->vars[val_(node).var].value;
+    node_t * result = derivative(diff, expr_node, var_index, false, NULL);
 
-    if (type_(node) == OPR){
-        enum oper op_num = val_(node).op;
+    statsPhaseEnd(timer);
 
-        if (opers[op_num].binary)
-            return calcOper(op_num, evaluate(diff, node->left), evaluate(diff, node->right));
+    return result;
+}
 
-        return calcOper(op_num, evaluate(diff, node->left), 0.);
-    }
+node_t * makeDerivativeConsume(diff_t * diff, node_t * expr_node, unsigned int var_index)
+{
+    assert(diff);
+    assert(expr_node);
+
+    if (!hasDerivativeRules(expr_node, var_index))
+        return NULL;
 
-    return 0.;
+    stats_timer_t timer = statsPhaseBegin(PHASE_DERIVATIVE);
+
+    node_t * result = derivative(diff, expr_node, var_index, true, NULL);
+
+    statsPhaseEnd(timer);
+
+    return result;
 }
 
-node_t * simplifyExpression(node_t * node)
-{
-    assert(node);
+typedef struct {
+    diff_t * diff;
+    unsigned int var_index;
+    par_split_t * split;
+} par_derivative_t;
 
-    bool changing = true;
-    while (changing){
-        changing = false;
+static void derivativeTask(void * context, size_t task_index, size_t thread_index);
 
-        node = foldConstants(node, NULL, &changing);
-        node = deleteNeutral(node, NULL, &changing);
-    }
+static void derivativeTask(void * context, size_t task_index, size_t thread_index)
+{
+    par_derivative_t * task = (par_derivative_t *)context;
+    par_split_t * split = task->split;
 
-    return node;
+    (void) thread_index;
+
+    for (size_t index = split->task_starts[task_index]; index < split->task_starts[task_index + 1]; index++)
+        split->subtrees[index].result = derivative(task->diff, split->subtrees[index].node, task->var_index, false, NULL);
 }
 
-node_t * foldConstants(node_t * node, node_t * parent, bool * changed_tree)
+node_t * makeDerivativeParallel(diff_t * diff, node_t * expr_node, unsigned int var_index, thread_pool_t * pool)
 {
-    if (node == NULL)
-        return NULL;
+    assert(diff);
+    assert(expr_node);
 
-    if (type_(node) == VAR)
-        return node;
+    if (pool == NULL || threadPoolSize(pool) == 1)
+        return makeDerivative(diff, expr_node, var_index);
 
-    if (type_(node) == NUM)
-        return node;
+    if (!hasDerivativeRules(expr_node, var_index))
+        return NULL;
 
-    node->left  = foldConstants(node->left , node, changed_tree);
-    node->right = foldConstants(node->right, node, changed_tree);
+    stats_timer_t timer = statsPhaseBegin(PHASE_DERIVATIVE);
 
-    enum oper op_num = val_(node).op;
+    /* tasks must not expand nodes of the shared tree */
+    expandAllDeferred(expr_node);
 
-    double new_val = 0.;
+    par_split_t split = splitTree(expr_node, threadPoolSize(pool));
 
-    if (opers[op_num].binary){
-        if (type_(node->left) == NUM && type_(node->right) == NUM){
-            double  left_val = val_(node->left ).number;
-            double right_val = val_(node->right).number;
+    par_derivative_t task = {.diff = diff, .var_index = var_index, .split = &split};
 
-            new_val = calcOper(op_num, left_val, right_val);
-        }
-        else
-            return node;
-    }
-    else {
-        if (type_(node->left) == NUM){
-            double val = val_(node->left).number;
-            new_val = calcOper(op_num, val, 0);
-        }
-        else
-            return node;
-    }
+    if (split.tasks_num > 0)
+        threadPoolFor(pool, split.tasks_num, derivativeTask, &task);
 
-    treeDestroy(node);
+    par_copy.split = &split;
+    par_copy.pool  = pool;
 
-    node_t * new_node = newNumNode(new_val);
-    new_node->parent = parent;
+    node_t * result = derivative(diff, expr_node, var_index, false, &split);
 
-    *changed_tree = true;
+    par_copy.split = NULL;
+    par_copy.pool  = NULL;
 
-    return new_node;
-}
+    splitDtor(&split);
 
-static node_t * delNeutralInCommutatives(node_t * node, node_t * parent, bool * changed_tree);
+    statsPhaseEnd(timer);
 
-static node_t * delNeutralInNonCommutatives(node_t * node, node_t * parent, bool * changed_tree);
+    return result;
+}
 
-node_t * deleteNeutral(node_t * node, node_t * parent, bool * changed_tree)
+/// rules of addition and subtraction need only derivatives of operands, so operands may be consumed by them
+static bool usesOperands(enum oper op_num)
 {
-    if (node == NULL)
-        return NULL;
-
-    if (type_(node) != OPR)
-        return node;
+    return op_num != ADD && op_num != SUB;
+}
 
-    node->left  = deleteNeutral(node->left,  node, changed_tree);
-    node->right = deleteNeutral(node->right, node, changed_tree);
+/// derivatives of subtrees of split (NULL - serial) are taken ready instead of being made
+static node_t * derivative(diff_t * diff, node_t * expr_node, unsigned int var_index, bool consume, const par_split_t * split)
+{
+    assert(diff);
+    assert(expr_node);
 
-    if (opers[val_(node).op].commutative)
-        return delNeutralInCommutatives(node, parent, changed_tree);
+    if (split != NULL)
+        return derivativeIterative(diff, expr_node, var_index, consume, split);
 
-    return delNeutralInNonCommutatives(node, parent, changed_tree);
+    return derivativeRecursive(diff, expr_node, var_index, consume, 0);
 }
 
-static node_t * delNeutralInCommutatives(node_t * node, node_t * parent, bool * changed_tree)
+/// the same rules as derivativeIterative(), operands are differentiated by recursive calls
+static node_t * derivativeRecursive(diff_t * diff, node_t * expr_node, unsigned int var_index, bool consume, size_t depth)
 {
-    assert(node);
-    assert(type_(node) == OPR);
-
-    bool last_changed = *changed_tree;
-    *changed_tree = true;
+    if (depth == RECURSIVE_WALK_DEPTH)
+        return derivativeIterative(diff, expr_node, var_index, consume, NULL);
 
-    node_t * cur_node = node->left;
-    node_t * another_node = node->right;
-    while (cur_node != NULL) {
-        if (type_(cur_node) == NUM){
-            switch (val_(node).op){
-                case MUL:
-                    logPrint(LOG_DEBUG_PLUS, "in mul case...\n");
-                    /* x*1 = x */
-                    if (val_(cur_node).number == 1.){
-                        delNode(cur_node);
-                        delNode(node);
+    if (type_(expr_node) == DRV)
+        expandDeferred(expr_node);
 
-                        another_node->parent = parent;
-                        return another_node;
-                    }
-                    /* x*0 = 0 */
-                    else if (val_(cur_node).number == 0.){
-                        treeDestroy(another_node);
-                        delNode(node);
+    node_t * result = NULL;
 
-                        cur_node->parent = parent;
-                        return cur_node;
-                    }
-                    break;
-                case ADD:
-                    logPrint(LOG_DEBUG_PLUS, "in add case...\n");
-                    if (val_(cur_node).number == 0.){
-                        delNode(cur_node);
-                        delNode(node);
+    switch (type_(expr_node)){
+        case NUM: {
+            result = newNumNode(0.);
+            break;
+        }
 
-                        another_node->parent = parent;
-                        return another_node;
-                    }
-                    break;
-                default:
-                    break;
-            }
+        case VAR: {
+            result = newNumNode((val_(expr_node).var == var_index) ? 1. : 0.);
+            break;
         }
 
-        if (cur_node == node->left){
-            cur_node     = node->right;
-            another_node = node->left;
+        case OPR: {
+            enum oper op_num = val_(expr_node).op;
+            bool consume_operands = consume && !usesOperands(op_num);
+
+            node_t * d_left  = derivativeRecursive(diff, expr_node->left, var_index, consume_operands, depth + 1);
+            node_t * d_right = opers[op_num].binary ?
+                               derivativeRecursive(diff, expr_node->right, var_index, consume_operands, depth + 1) : NULL;
+
+            diff_func_t diffFunc = opers[op_num].diffFunc;
+            assert(diffFunc && "entry points check rules before the walk");
+
+            trace_span_t span = traceBeginStr("derivative", "op", opers[op_num].name);
+            result = diffFunc(expr_node, var_index, d_left, d_right, consume && usesOperands(op_num));
+            traceEnd(&span);
+            break;
         }
-        else
-            cur_node = NULL;
+
+        default:
+            assert(0 && "incorrect elem type");
+            break;
     }
 
-    *changed_tree = last_changed;
+    if (consume)
+        exprDelNode(expr_node);
 
-    return node;
+    return result;
 }
 
-static node_t * delNeutralInNonCommutatives(node_t * node, node_t * parent, bool * changed_tree)
+static node_t * derivativeIterative(diff_t * diff, node_t * expr_node, unsigned int var_index, bool consume, const par_split_t * split)
 {
-    assert(node);
-    assert(type_(node) == OPR);
+    assert(diff);
+    assert(expr_node);
 
-    node_t * left  = node->left;
-    node_t * right = node->right;
+    trav_stack_t<deriv_frame_t> frames;
+    trav_stack_t<node_t *> derivatives;
 
-    bool last_changed = *changed_tree;
-    *changed_tree = true;
+    stackInit(&frames);
+    stackInit(&derivatives);
 
-    switch (val_(node).op){
-        case DIV:
-            if (type_(right) == NUM){
-                if (val_(right).number == 1.){
-                    delNode(right);
-                    delNode(node);
+    stackPush(&frames, {expr_node, false, consume, NULL});
 
-                    left->parent = parent;
+    /* derivatives of operands are made before the rule of operation gets them,
+       operand is consumed by its derivative only if the rule of operation does not use it */
+    while (frames.size > 0){
+        deriv_frame_t frame = stackPop(&frames);
+        node_t * node = frame.node;
 
-                    return left;
-                }
-            }
-            break;
+        if (frame.ready != NULL){
+            stackPush(&derivatives, frame.ready);
+            continue;
+        }
 
-        case SUB:
-            if (type_(right) == NUM){
-                if (val_(right).number == 0.){
-                    delNode(right);
-                    delNode(node);
+        if (type_(node) == DRV)
+            expandDeferred(node);
 
-                    left->parent = parent;
+        switch (type_(node)){
+            case NUM: {
+                stackPush(&derivatives, newNumNode(0.));
+                break;
+            }
 
-                    return left;
-                }
+            case VAR: {
+                stackPush(&derivatives, newNumNode((val_(node).var == var_index) ? 1. : 0.));
+                break;
             }
-            break;
-        case POW:
-            if (type_(right) == NUM){
-                if (val_(right).number == 1.){
-                    delNode(right);
-                    delNode(node);
 
-                    left->parent = parent;
+            case OPR: {
+                enum oper op_num = val_(node).op;
 
-                    return left;
-                }
-                else if (val_(right).number == 0.){
-                    treeDestroy(node);
+                if (!frame.expanded){
+                    bool consume_operands = frame.consume && !usesOperands(op_num);
 
-                    node_t * new_node = newNumNode(1.);
-                    new_node->parent = parent;
+                    stackPush(&frames, {node, true, frame.consume, NULL});
 
-                    return new_node;
-                }
-            }
-            if (type_(left) == NUM){
-                if (val_(left).number == 1. || val_(left).number == 0.){
-                    treeDestroy(right);
-                    delNode(node);
+                    par_subtree_t * right = (split != NULL) ? findSubtree(split, &(node->right)) : NULL;
+                    par_subtree_t * left  = (split != NULL) ? findSubtree(split, &(node->left )) : NULL;
 
-                    left->parent = parent;
+                    if (opers[op_num].binary)
+                        stackPush(&frames, {node->right, false, consume_operands, (right != NULL) ? right->result : NULL});
 
-                    return left;
+                    stackPush(&frames, {node->left, false, consume_operands, (left != NULL) ? left->result : NULL});
+                    continue;
                 }
+
+                node_t * d_right = opers[op_num].binary ? stackPop(&derivatives) : NULL;
+                node_t * d_left  = stackPop(&derivatives);
+
+                diff_func_t diffFunc = opers[op_num].diffFunc;
+                assert(diffFunc && "entry points check rules before the walk");
+
+                trace_span_t span = traceBeginStr("derivative", "op", opers[op_num].name);
+                stackPush(&derivatives, diffFunc(node, var_index, d_left, d_right, frame.consume && usesOperands(op_num)));
+                traceEnd(&span);
+                break;
             }
-            break;
+
+            default:
+                assert(0 && "incorrect elem type");
+                break;
+        }
+
+        if (frame.consume)
+            exprDelNode(node);
     }
 
-    *changed_tree = last_changed;
+    node_t * result = stackPop(&derivatives);
 
-    return node;
+    stackDtor(&frames);
+    stackDtor(&derivatives);
+
+    return result;
 }
 
-const size_t BUFFER_LEN = 32;
+/*------------------------------------------------------------------------------------------*/
 
-node_t * readEquationPrefix(diff_t * diff, FILE * input_file)
-{
+/// smallest subtree worth a task
+const size_t PAR_GRAIN = 4096;
+
+/// tasks per thread, so threads that finished early take remaining tasks
+const size_t PAR_TASKS_PER_THREAD = 8;
+
+static int cmpSubtrees(const void * first, const void * second);
+
+static int cmpNodes(const void * first, const void * second);
+
+static int cmpNodes(const void * first, const void * second)
+{
+    uintptr_t first_node  = (uintptr_t)*(node_t * const *)first;
+    uintptr_t second_node = (uintptr_t)*(node_t * const *)second;
+
+    return (first_node > second_node) - (first_node < second_node);
+}
+
+static int cmpSubtrees(const void * first, const void * second)
+{
+    uintptr_t first_link  = (uintptr_t)((const par_subtree_t *)first )->link;
+    uintptr_t second_link = (uintptr_t)((const par_subtree_t *)second)->link;
+
+    return (first_link > second_link) - (first_link < second_link);
+}
+
+/// node of the top part and its index in postorder
+typedef struct {
+    node_t * node;
+    size_t index;
+} split_frame_t;
+
+/// takes maximal subtrees not bigger than cut, empty split if the whole tree is small
+static par_split_t splitTree(node_t * root, size_t threads_num)
+{
+    par_split_t split = {};
+
+    /* sizes in postorder: right child of i-th node is (i - 1)-th, left one is just before right subtree */
+    trav_stack_t<trav_frame_t> frames;
+    trav_stack_t<size_t> sizes;
+
+    stackInit(&frames);
+    stackInit(&sizes);
+
+    stackPush(&frames, {root, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node_t * node = frame.node;
+
+        bool has_children = (node->left != NULL || node->right != NULL);
+
+        if (has_children && !frame.expanded){
+            stackPush(&frames, {node, true});
+
+            if (node->right != NULL)
+                stackPush(&frames, {node->right, false});
+
+            if (node->left != NULL)
+                stackPush(&frames, {node->left, false});
+
+            continue;
+        }
+
+        size_t size = 1;
+        size_t child = sizes.size;
+
+        if (node->right != NULL){
+            size  += sizes.elems[child - 1];
+            child -= sizes.elems[child - 1];
+        }
+
+        if (node->left != NULL)
+            size += sizes.elems[child - 1];
+
+        stackPush(&sizes, size);
+    }
+
+    size_t total = sizes.elems[sizes.size - 1];
+    size_t cut = total / (threads_num * PAR_TASKS_PER_THREAD);
+
+    if (cut < PAR_GRAIN)
+        cut = PAR_GRAIN;
+
+    size_t capacity = 0;
+
+    /* top part is walked down until subtrees are small enough */
+    if (total > cut){
+        trav_stack_t<split_frame_t> top_frames;
+        stackInit(&top_frames);
+
+        stackPush(&top_frames, {root, sizes.size - 1});
+
+        size_t top_capacity = 0;
+
+        while (top_frames.size > 0){
+            split_frame_t frame = stackPop(&top_frames);
+
+            node_t * node = frame.node;
+            size_t index = frame.index;
+
+            if (split.top_nodes_num == top_capacity){
+                top_capacity = (top_capacity == 0) ? 64 : top_capacity * 2;
+                split.top_nodes = (node_t **)realloc(split.top_nodes, top_capacity * sizeof(node_t *));
+            }
+
+            split.top_nodes[split.top_nodes_num++] = node;
+
+            size_t child = index;
+
+            node_t  *   children[2] = {node->right, node->left};
+            node_t ** child_links[2] = {&(node->right), &(node->left)};
+
+            for (size_t child_index = 0; child_index < 2; child_index++){
+                if (children[child_index] == NULL)
+                    continue;
+
+                size_t child_size = sizes.elems[child - 1];
+
+                if (child_size > cut)
+                    stackPush(&top_frames, {children[child_index], child - 1});
+                else {
+                    if (split.subtrees_num == capacity){
+                        capacity = (capacity == 0) ? 64 : capacity * 2;
+                        split.subtrees = (par_subtree_t *)realloc(split.subtrees, capacity * sizeof(par_subtree_t));
+                    }
+
+                    par_subtree_t subtree = {};
+
+                    subtree.node   = children[child_index];
+                    subtree.parent = node;
+                    subtree.link   = child_links[child_index];
+                    subtree.size   = child_size;
+
+                    split.subtrees[split.subtrees_num++] = subtree;
+                }
+
+                child -= child_size;
+            }
+        }
+
+        stackDtor(&top_frames);
+    }
+
+    stackDtor(&frames);
+    stackDtor(&sizes);
+
+    if (split.subtrees_num == 0)
+        return split;
+
+    qsort(split.subtrees,  split.subtrees_num,  sizeof(par_subtree_t), cmpSubtrees);
+    qsort(split.top_nodes, split.top_nodes_num, sizeof(node_t *),      cmpNodes);
+
+    /* neighbouring subtrees are joined into tasks of about cut nodes */
+    split.task_starts = (size_t *)calloc(split.subtrees_num + 1, sizeof(size_t));
+
+    size_t task_size = 0;
+
+    for (size_t index = 0; index < split.subtrees_num; index++){
+        if (task_size == 0)
+            split.task_starts[split.tasks_num++] = index;
+
+        task_size += split.subtrees[index].size;
+
+        if (task_size >= cut)
+            task_size = 0;
+    }
+
+    split.task_starts[split.tasks_num] = split.subtrees_num;
+
+    return split;
+}
+
+static void splitDtor(par_split_t * split)
+{
+    free(split->subtrees);
+    free(split->task_starts);
+    free(split->top_nodes);
+
+    *split = {};
+}
+
+static par_subtree_t * findSubtree(const par_split_t * split, node_t ** link)
+{
+    par_subtree_t key = {};
+    key.link = link;
+
+    return (par_subtree_t *)bsearch(&key, split->subtrees, split->subtrees_num, sizeof(par_subtree_t), cmpSubtrees);
+}
+
+static bool isTopNode(const par_split_t * split, node_t * node)
+{
+    return bsearch(&node, split->top_nodes, split->top_nodes_num, sizeof(node_t *), cmpNodes) != NULL;
+}
+
+node_t * makeDerivativeLazy(diff_t * diff, node_t * expr_node, unsigned int var_index)
+{
+    assert(diff);
+    assert(expr_node);
+
+    if (!hasDerivativeRules(expr_node, var_index))
+        return NULL;
+
+    return newDrvNode(exprCopy(expr_node), var_index);
+}
+
+static node_t * expandOnce(node_t * deferred);
+
+/// applies the rule to the expression under deferred node, its operand has to be already expanded
+static node_t * expandOnce(node_t * deferred)
+{
+    node_t * expr_node = deferred->left;
+    unsigned int var_index = val_(deferred).var;
+
+    assert(type_(expr_node) != DRV);
+
+    node_t * result = NULL;
+
+    switch (type_(expr_node)){
+        case NUM:
+            result = newNumNode(0.);
+            break;
+
+        case VAR:
+            result = newNumNode((val_(expr_node).var == var_index) ? 1. : 0.);
+            break;
+
+        case OPR: {
+            enum oper op_num = val_(expr_node).op;
+
+            diff_func_t diffFunc = opers[op_num].diffFunc;
+            assert(diffFunc && "lazy derivatives are made only of expressions with rules");
+
+            bool binary = opers[op_num].binary;
+
+            node_t * d_left  = NULL;
+            node_t * d_right = NULL;
+
+            /* operands used by the rule are copied under deferred derivatives and moved into the result,
+               unused ones are moved under deferred derivatives */
+            if (usesOperands(op_num)){
+                d_left  = newDrvNode(exprCopy(expr_node->left), var_index);
+                d_right = binary ? newDrvNode(exprCopy(expr_node->right), var_index) : NULL;
+            }
+            else {
+                d_left  = newDrvNode(expr_node->left, var_index);
+                d_right = binary ? newDrvNode(expr_node->right, var_index) : NULL;
+            }
+
+            trace_span_t span = traceBeginStr("deferred derivative", "op", opers[op_num].name);
+            result = diffFunc(expr_node, var_index, d_left, d_right, usesOperands(op_num));
+            traceEnd(&span);
+
+            break;
+        }
+
+        default:
+            assert(0 && "incorrect elem type");
+            break;
+    }
+
+    exprDelNode(expr_node);
+
+    return result;
+}
+
+void expandDeferred(node_t * node)
+{
+    assert(node);
+
+    if (type_(node) != DRV)
+        return;
+
+    /* derivative of derivative is expanded from the innermost one */
+    trav_stack_t<node_t *> chain;
+    stackInit(&chain);
+
+    for (node_t * cur_node = node; type_(cur_node) == DRV; cur_node = cur_node->left)
+        stackPush(&chain, cur_node);
+
+    while (chain.size > 0){
+        node_t * deferred = stackPop(&chain);
+        node_t * result = expandOnce(deferred);
+
+        assert(type_(result) != DRV);
+
+        /* result is moved into deferred node so pointers to it stay valid */
+        *(expr_elem_t *)deferred->data = *(expr_elem_t *)result->data;
+
+        deferred->left  = result->left;
+        deferred->right = result->right;
+        deferred->color_for_dump = result->color_for_dump;
+
+        if (deferred->left  != NULL) deferred->left ->parent = deferred;
+        if (deferred->right != NULL) deferred->right->parent = deferred;
+
+        exprDelNode(result);
+    }
+
+    stackDtor(&chain);
+
+    /* hashes of ancestors are recomputed when they are needed, upper ones are already stale if this one is */
+    for (node_t * ancestor = node->parent; ancestor != NULL; ancestor = ancestor->parent){
+        expr_elem_t * elem = (expr_elem_t *)ancestor->data;
+
+        if (elem->stale_hash)
+            break;
+
+        elem->stale_hash = true;
+    }
+}
+
+void expandAllDeferred(node_t * node)
+{
+    if (node == NULL)
+        return;
+
+    node_t * root = node;
+    bool expanded = false;
+
+    trav_stack_t<node_t *> nodes;
+    stackInit(&nodes);
+
+    stackPush(&nodes, node);
+
+    while (nodes.size > 0){
+        node = stackPop(&nodes);
+
+        if (type_(node) == DRV){
+            expandDeferred(node);
+            expanded = true;
+        }
+
+        if (node->left != NULL)
+            stackPush(&nodes, node->left);
+
+        if (node->right != NULL)
+            stackPush(&nodes, node->right);
+    }
+
+    stackDtor(&nodes);
+
+    /* hashes of nodes above expanded ones are changed */
+    if (expanded)
+        exprRehashTree(root);
+}
+
+double calcOper(enum oper op_num, double left_val, double right_val)
+{
+    double new_val = 0.;
+
+    switch (op_num){
+        case ADD:
+            new_val = left_val + right_val;
+            break;
+
+        case SUB:
+            new_val = left_val - right_val;
+            break;
+
+        case MUL:
+            new_val = left_val * right_val;
+            break;
+
+        case DIV:
+            new_val = left_val / right_val;
+            break;
+
+        case POW:
+            new_val = pow(left_val, right_val);
+            break;
+
+        case FAC:
+            new_val = (left_val > MAX_FACTORIAL_ARG) ? INFINITY : factorial((long unsigned int)left_val);
+            break;
+
+        case SIN:
+            new_val = sin(left_val);
+            break;
+
+        case COS:
+            new_val = cos(left_val);
+            break;
+
+        case TAN:
+            new_val = tan(left_val);
+            break;
+
+        case LN:
+            new_val = log(left_val);
+            break;
+
+        case LOG:
+            new_val = log(right_val) / log(left_val);
+            break;
+
+        default:
+            fprintf(stderr, "CANNOT CALCULATE THIS OPERATION: %d\n", op_num);
+            exit(1);
+    }
+    return new_val;
+}
+
+static double evaluateRecursive(node_t * node, const double * var_values, size_t depth);
+
+static double evaluateIterative(node_t * node, const double * var_values);
+
+double evaluate(diff_t * diff, node_t * node)
+{
+    assert(node);
+    assert(diff);
+
+    logPrint(LOG_DEBUG_PLUS, "entered evaluate for root %p\n", node);
+
+    statsCount(STAT_EVALUATIONS, 1);
+
+    return evaluateRecursive(node, diff->var_values, 0);
+}
+
+double evaluateWithValues(node_t * node, const double * var_values)
+{
+    assert(node);
+    assert(var_values);
+
+    statsCount(STAT_EVALUATIONS, 1);
+
+    return evaluateRecursive(node, var_values, 0);
+}
+
+static double evaluateRecursive(node_t * node, const double * var_values, size_t depth)
+{
+    if (depth == RECURSIVE_WALK_DEPTH)
+        return evaluateIterative(node, var_values);
+
+    if (type_(node) == DRV)
+        expandDeferred(node);
+
+    if (type_(node) == NUM)
+        return val_(node).number;
+
+    if (type_(node) == VAR)
+        return var_values[val_(node).var];
+
+    enum oper op_num = val_(node).op;
+
+    double  left_val = evaluateRecursive(node->left, var_values, depth + 1);
+    double right_val = opers[op_num].binary ? evaluateRecursive(node->right, var_values, depth + 1) : 0.;
+
+    return calcOper(op_num, left_val, right_val);
+}
+
+static double evaluateIterative(node_t * node, const double * var_values)
+{
+    trav_stack_t<trav_frame_t> frames;
+    trav_stack_t<double> values;
+
+    stackInit(&frames);
+    stackInit(&values);
+
+    stackPush(&frames, {node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node = frame.node;
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        if (type_(node) == NUM){
+            stackPush(&values, val_(node).number);
+            continue;
+        }
+
+        if (type_(node) == VAR){
+            stackPush(&values, var_values[val_(node).var]);
+            continue;
+        }
+
+        enum oper op_num = val_(node).op;
+
+        if (!frame.expanded){
+            stackPush(&frames, {node, true});
+
+            if (opers[op_num].binary)
+                stackPush(&frames, {node->right, false});
+
+            stackPush(&frames, {node->left, false});
+            continue;
+        }
+
+        double right_val = opers[op_num].binary ? stackPop(&values) : 0.;
+        double  left_val = stackPop(&values);
+
+        stackPush(&values, calcOper(op_num, left_val, right_val));
+    }
+
+    double result = stackPop(&values);
+
+    stackDtor(&frames);
+    stackDtor(&values);
+
+    return result;
+}
+
+typedef node_t * (*node_rule_t)(node_t * node, node_t * parent, bool * changed_tree);
+
+static node_t * simplify(node_t * node, thread_pool_t * pool);
+
+static node_t * transformParallel(node_t * node, node_rule_t rule, bool * changed_tree, thread_pool_t * pool);
+
+static node_t * foldNode(node_t * node, node_t * parent, bool * changed_tree);
+
+static node_t * delNeutralNode(node_t * node, node_t * parent, bool * changed_tree);
+
+node_t * simplifyExpression(node_t * node)
+{
+    return simplify(node, NULL);
+}
+
+node_t * simplifyExpressionParallel(node_t * node, thread_pool_t * pool)
+{
+    assert(node);
+
+    if (pool == NULL || threadPoolSize(pool) == 1)
+        return simplify(node, NULL);
+
+    /* tasks must not expand nodes of the shared tree */
+    expandAllDeferred(node);
+
+    return simplify(node, pool);
+}
+
+static node_t * simplify(node_t * node, thread_pool_t * pool)
+{
+    assert(node);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_SIMPLIFY);
+
+    bool changing = true;
+    long pass = 0;
+
+    while (changing){
+        changing = false;
+
+        trace_span_t span = traceBeginNum("simplify pass", "pass", pass++);
+
+        node = transformParallel(node, foldNode,       &changing, pool);
+        node = transformParallel(node, delNeutralNode, &changing, pool);
+
+        traceEnd(&span);
+        statsCount(STAT_SIMPLIFY_PASSES, 1);
+    }
+
+    statsPhaseEnd(timer);
+
+    return node;
+}
+
+/// frame of transformation, result of the rule is written to link (child pointer in parent)
+typedef struct {
+    node_t * node;
+    node_t * parent;
+    node_t ** link;
+    bool expanded;
+} link_frame_t;
+
+static node_t * transformTree(node_t * node, node_t * parent, node_rule_t rule, bool * changed_tree, const par_split_t * split);
+
+typedef struct {
+    node_rule_t rule;
+    par_split_t * split;
+} par_transform_t;
+
+static void transformTask(void * context, size_t task_index, size_t thread_index);
+
+static void transformTask(void * context, size_t task_index, size_t thread_index)
+{
+    par_transform_t * task = (par_transform_t *)context;
+    par_split_t * split = task->split;
+
+    (void) thread_index;
+
+    for (size_t index = split->task_starts[task_index]; index < split->task_starts[task_index + 1]; index++){
+        par_subtree_t * subtree = split->subtrees + index;
+
+        *(subtree->link) = transformTree(subtree->node, subtree->parent, task->rule, &(subtree->changed), NULL);
+    }
+}
+
+/// subtrees are transformed by tasks, then the top part uses their results, same as transformTree() of the whole tree
+static node_t * transformParallel(node_t * node, node_rule_t rule, bool * changed_tree, thread_pool_t * pool)
+{
+    if (pool == NULL)
+        return transformTree(node, NULL, rule, changed_tree, NULL);
+
+    par_split_t split = splitTree(node, threadPoolSize(pool));
+
+    par_transform_t task = {.rule = rule, .split = &split};
+
+    if (split.tasks_num > 0)
+        threadPoolFor(pool, split.tasks_num, transformTask, &task);
+
+    for (size_t index = 0; index < split.subtrees_num; index++)
+        if (split.subtrees[index].changed)
+            *changed_tree = true;
+
+    node = transformTree(node, NULL, rule, changed_tree, &split);
+
+    splitDtor(&split);
+
+    return node;
+}
+
+/// applies rule to every operation after its operands, subtrees of split (NULL - none) are already transformed
+static node_t * transformTree(node_t * node, node_t * parent, node_rule_t rule, bool * changed_tree, const par_split_t * split)
+{
+    if (node == NULL)
+        return NULL;
+
+    node_t * result = node;
+
+    trav_stack_t<link_frame_t> frames;
+    stackInit(&frames);
+
+    stackPush(&frames, {node, parent, &result, false});
+
+    while (frames.size > 0){
+        link_frame_t frame = stackPop(&frames);
+
+        if (type_(frame.node) == DRV)
+            expandDeferred(frame.node);
+
+        if (type_(frame.node) != OPR)
+            continue;
+
+        if (frame.expanded){
+            /* operands could be replaced by rules, so hash is updated before the rule */
+            exprRehash(frame.node);
+
+            *frame.link = rule(frame.node, frame.parent, changed_tree);
+            continue;
+        }
+
+        frame.expanded = true;
+        stackPush(&frames, frame);
+
+        if (frame.node->right != NULL && (split == NULL || findSubtree(split, &(frame.node->right)) == NULL))
+            stackPush(&frames, {frame.node->right, frame.node, &(frame.node->right), false});
+
+        if (split == NULL || findSubtree(split, &(frame.node->left)) == NULL)
+            stackPush(&frames, {frame.node->left, frame.node, &(frame.node->left), false});
+    }
+
+    stackDtor(&frames);
+
+    return result;
+}
+
+node_t * foldConstants(node_t * node, node_t * parent, bool * changed_tree)
+{
+    return transformTree(node, parent, foldNode, changed_tree, NULL);
+}
+
+static node_t * foldNode(node_t * node, node_t * parent, bool * changed_tree)
+{
+    enum oper op_num = val_(node).op;
+
+    double new_val = 0.;
+
+    if (opers[op_num].binary){
+        if (type_(node->left) == NUM && type_(node->right) == NUM){
+            double  left_val = val_(node->left ).number;
+            double right_val = val_(node->right).number;
+
+            new_val = calcOper(op_num, left_val, right_val);
+        }
+        else
+            return node;
+    }
+    else {
+        if (type_(node->left) == NUM){
+            double val = val_(node->left).number;
+            new_val = calcOper(op_num, val, 0);
+        }
+        else
+            return node;
+    }
+
+    exprDestroy(node);
+
+    node_t * new_node = newNumNode(new_val);
+    new_node->parent = parent;
+
+    *changed_tree = true;
+    statsCount(STAT_RULE_FOLD_CONSTANTS, 1);
+
+    return new_node;
+}
+
+static node_t * delNeutralInCommutatives(node_t * node, node_t * parent, bool * changed_tree);
+
+static node_t * delNeutralInNonCommutatives(node_t * node, node_t * parent, bool * changed_tree);
+
+node_t * deleteNeutral(node_t * node, node_t * parent, bool * changed_tree)
+{
+    return transformTree(node, parent, delNeutralNode, changed_tree, NULL);
+}
+
+static node_t * delNeutralNode(node_t * node, node_t * parent, bool * changed_tree)
+{
+    if (opers[val_(node).op].commutative)
+        return delNeutralInCommutatives(node, parent, changed_tree);
+
+    return delNeutralInNonCommutatives(node, parent, changed_tree);
+}
+
+static node_t * delNeutralInCommutatives(node_t * node, node_t * parent, bool * changed_tree)
+{
+    assert(node);
+    assert(type_(node) == OPR);
+
+    bool last_changed = *changed_tree;
+    *changed_tree = true;
+
+    node_t * cur_node = node->left;
+    node_t * another_node = node->right;
+    while (cur_node != NULL) {
+        if (type_(cur_node) == NUM){
+            switch (val_(node).op){
+                case MUL:
+                    logPrint(LOG_DEBUG_PLUS, "in mul case...\n");
+                    /* x*1 = x */
+                    if (val_(cur_node).number == 1.){
+                        exprDelNode(cur_node);
+                        exprDelNode(node);
+                        statsCount(STAT_RULE_MUL_ONE, 1);
+
+                        another_node->parent = parent;
+                        return another_node;
+                    }
+                    /* x*0 = 0 */
+                    else if (val_(cur_node).number == 0.){
+                        exprDestroy(another_node);
+                        exprDelNode(node);
+                        statsCount(STAT_RULE_MUL_ZERO, 1);
+
+                        cur_node->parent = parent;
+                        return cur_node;
+                    }
+                    break;
+                case ADD:
+                    logPrint(LOG_DEBUG_PLUS, "in add case...\n");
+                    if (val_(cur_node).number == 0.){
+                        exprDelNode(cur_node);
+                        exprDelNode(node);
+                        statsCount(STAT_RULE_ADD_ZERO, 1);
+
+                        another_node->parent = parent;
+                        return another_node;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (cur_node == node->left){
+            cur_node     = node->right;
+            another_node = node->left;
+        }
+        else
+            cur_node = NULL;
+    }
+
+    *changed_tree = last_changed;
+
+    return node;
+}
+
+static node_t * delNeutralInNonCommutatives(node_t * node, node_t * parent, bool * changed_tree)
+{
+    assert(node);
+    assert(type_(node) == OPR);
+
+    node_t * left  = node->left;
+    node_t * right = node->right;
+
+    bool last_changed = *changed_tree;
+    *changed_tree = true;
+
+    switch (val_(node).op){
+        case DIV:
+            if (type_(right) == NUM){
+                if (val_(right).number == 1.){
+                    exprDelNode(right);
+                    exprDelNode(node);
+                    statsCount(STAT_RULE_DIV_ONE, 1);
+
+                    left->parent = parent;
+
+                    return left;
+                }
+            }
+            break;
+
+        case SUB:
+            if (type_(right) == NUM){
+                if (val_(right).number == 0.){
+                    exprDelNode(right);
+                    exprDelNode(node);
+                    statsCount(STAT_RULE_SUB_ZERO, 1);
+
+                    left->parent = parent;
+
+                    return left;
+                }
+            }
+            /* x-x = 0, equal hashes are checked first */
+            if (exprEqual(left, right)){
+                exprDestroy(node);
+                statsCount(STAT_RULE_SUB_SELF, 1);
+
+                node_t * zero = newNumNode(0.);
+                zero->parent = parent;
+
+                return zero;
+            }
+            break;
+        case POW:
+            if (type_(right) == NUM){
+                if (val_(right).number == 1.){
+                    exprDelNode(right);
+                    exprDelNode(node);
+                    statsCount(STAT_RULE_POW_ONE, 1);
+
+                    left->parent = parent;
+
+                    return left;
+                }
+                else if (val_(right).number == 0.){
+                    exprDestroy(node);
+                    statsCount(STAT_RULE_POW_ZERO, 1);
+
+                    node_t * new_node = newNumNode(1.);
+                    new_node->parent = parent;
+
+                    return new_node;
+                }
+            }
+            if (type_(left) == NUM){
+                if (val_(left).number == 1. || val_(left).number == 0.){
+                    exprDestroy(right);
+                    exprDelNode(node);
+                    statsCount(STAT_RULE_POW_BASE, 1);
+
+                    left->parent = parent;
+
+                    return left;
+                }
+            }
+            break;
+    }
+
+    *changed_tree = last_changed;
+
+    return node;
+}
+
+const size_t BUFFER_LEN = 32;
+
+node_t * readEquationPrefix(diff_t * diff, FILE * input_file)
+{
     node_t * node = NULL;
 
-    fscanf(input_file, " ( ");
+    fscanf(input_file, " ( ");
+
+    char buffer[BUFFER_LEN] = "";
+    fscanf(input_file, " %[^() ] ", buffer);
+
+    size_t oper_index = symLookup(&(diff->oper_table), buffer);
+    if (oper_index != SYM_NONE){
+        const oper_t * operation = opers + oper_index;
+
+        if (operation->binary){
+            node_t * left_operand  = readEquationPrefix(diff, input_file);
+            node_t * right_operand = readEquationPrefix(diff, input_file);
+
+            node = newOprNode(operation->num, left_operand, right_operand);
+        }
+        else {
+            node_t * operand  = readEquationPrefix(diff, input_file);
+
+            node = newOprNode(operation->num, operand, NULL);
+        }
+    }
+    else {
+        double number = 0.;
+        if (sscanf(buffer, "%lg", &number) > 0){
+            node = newNumNode(number);
+        }
+
+        else {
+            node = getVarNode(diff, buffer);
+        }
+    }
+
+    fscanf(input_file, " )");
+
+    return node;
+}
+
+void setVariables(diff_t * diff)
+{
+    for (size_t var_index = 0; var_index < diff->var_num; var_index++){
+        printf("enter value of variable '%s':\n", diff->var_names[var_index]);
+        scanf(" %lg", diff->var_values + var_index);
+        printf("scanned\n");
+    }
+}
+
+void exprElemToStr(char * str, void * data)
+{
+    expr_elem_t * elem = (expr_elem_t *)data;
+
+    switch (elem->type){
+        case OPR:
+            sprintf(str, "type = 'OPR', operation '%s' ", opers[elem->val.op].name);
+            break;
+
+        case NUM:
+            sprintf(str, "type = 'NUM', value.number = %lg", elem->val.number);
+            break;
+
+        case VAR:
+            sprintf(str, "type = 'VAR', value.var    = %u", elem->val.var);
+            break;
+
+        case DRV:
+            sprintf(str, "type = 'DRV', value.var    = %u", elem->val.var);
+            break;
+
+        default:
+            logPrint(LOG_RELEASE, "incorrect elem type in elemToStr\n");
+            break;
+    }
+}
+
+nth_derivative_t makeNthDerivative(diff_t * diff, node_t * expr_node, unsigned int var_index, size_t order, const diff_budget_t * budget)
+{
+    assert(diff);
+    assert(expr_node);
+
+    nth_derivative_t nth = {};
+
+    nth.var_index = var_index;
+
+    nth.derivatives = (node_t **)calloc(order + 1, sizeof(node_t *));
+    nth.node_counts = (size_t  *)calloc(order + 1, sizeof(size_t));
+
+    nth.derivatives[0] = simplifyExpression(exprCopy(expr_node));
+    nth.node_counts[0] = treeSize(nth.derivatives[0]);
+
+    nth.orders_num  = 1;
+    nth.total_nodes = nth.node_counts[0];
+
+    extendNthDerivative(diff, &nth, order, budget);
+
+    return nth;
+}
+
+static bool fitsInBudget(const diff_budget_t * budget, size_t nodes_num);
+
+static bool fitsInBudget(const diff_budget_t * budget, size_t nodes_num)
+{
+    if (budget == NULL)
+        return true;
+
+    if (budget->max_nodes != 0 && nodes_num > budget->max_nodes)
+        return false;
+
+    const size_t NODE_BYTES = sizeof(node_t) + sizeof(expr_elem_t);
+
+    if (budget->max_bytes != 0 && nodes_num > budget->max_bytes / NODE_BYTES)
+        return false;
+
+    return true;
+}
+
+deriv_status_t extendNthDerivative(diff_t * diff, nth_derivative_t * nth, size_t order, const diff_budget_t * budget)
+{
+    assert(diff);
+    assert(nth);
+    assert(nth->orders_num > 0);
+
+    if (nth->status != DERIV_SUCCESS || order < nth->orders_num)
+        return nth->status;
+
+    nth->derivatives = (node_t **)realloc(nth->derivatives, (order + 1) * sizeof(node_t *));
+    nth->node_counts = (size_t  *)realloc(nth->node_counts, (order + 1) * sizeof(size_t));
+
+    while (nth->orders_num <= order){
+        node_t * prev_derivative = nth->derivatives[nth->orders_num - 1];
+
+        /* checking before making so a derivative over the budget is not made at all, the budget limits
+           retained derivatives: operand derivatives that the rules drop or copy are not counted */
+        size_t predicted_size = derivativeSize(prev_derivative, nth->var_index);
+
+        if (predicted_size == SIZE_MAX){
+            nth->status = DERIV_NOT_DIFFERENTIABLE;
+            break;
+        }
+
+        if (predicted_size > SIZE_MAX - nth->total_nodes || !fitsInBudget(budget, nth->total_nodes + predicted_size)){
+            logPrint(LOG_DEBUG, "derivative #%zu needs %zu nodes, budget exceeded (%zu nodes used)\n",
+                                nth->orders_num, predicted_size, nth->total_nodes);
+
+            nth->status = DERIV_BUDGET_EXCEEDED;
+            break;
+        }
+
+        trace_span_t span = traceBeginNum("nth derivative", "order", (long)nth->orders_num);
+
+        node_t * derivative = makeDerivative(diff, prev_derivative, nth->var_index);
+        derivative = simplifyExpression(derivative);
+
+        traceEnd(&span);
+
+        size_t node_count = treeSize(derivative);
+
+        logPrint(LOG_DEBUG, "derivative #%zu: %zu nodes (%zu before simplification)\n",
+                            nth->orders_num, node_count, predicted_size);
+
+        nth->derivatives[nth->orders_num] = derivative;
+        nth->node_counts[nth->orders_num] = node_count;
+
+        nth->total_nodes += node_count;
+        nth->orders_num++;
+    }
+
+    return nth->status;
+}
+
+void nthDerivativeDtor(nth_derivative_t * nth)
+{
+    assert(nth);
+
+    for (size_t order = 0; order < nth->orders_num; order++)
+        exprDestroy(nth->derivatives[order]);
+
+    free(nth->derivatives);
+    free(nth->node_counts);
+
+    nth->derivatives = NULL;
+    nth->node_counts = NULL;
+    nth->orders_num  = 0;
+}
+
+size_t taylorDerivatives(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point,
+                         size_t members_num, double * derivatives)
+{
+    assert(diff);
+    assert(expr_node);
+    assert(derivatives || members_num == 0);
+
+    /* expression may not contain the variable at all, but the result is about it */
+    diffReserveVars(diff, var_index + 1);
+    diff->var_values[var_index] = diff_point;
+
+    if (members_num == 0)
+        return 0;
+
+    /* every derivative is needed only to make the next one, so it is consumed */
+    node_t * cur_derivative = simplifyExpression(exprCopy(expr_node));
+
+    size_t evaluated = 0;
+
+    for (size_t order = 0; order < members_num; order++){
+        trace_span_t member_span = traceBeginNum("taylor member", "order", (long)order);
+
+        derivatives[evaluated++] = evaluate(diff, cur_derivative);
+
+        bool last_member = (order + 1 == members_num) ||
+                           (derivativeSize(cur_derivative, var_index) == SIZE_MAX);
+
+        if (!last_member)
+            cur_derivative = simplifyExpression(makeDerivativeConsume(diff, cur_derivative, var_index));
+
+        traceEnd(&member_span);
+
+        if (last_member)
+            break;
+    }
+
+    exprDestroy(cur_derivative);
+
+    return evaluated;
+}
+
+node_t * taylorSeries(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point, size_t last_member_index)
+{
+    assert(diff);
+    assert(expr_node);
+
+    trace_span_t span = traceBeginNum("taylorSeries", "members", (long)last_member_index);
+
+    double * derivatives = (double *)calloc(last_member_index + 1, sizeof(double));
+    size_t members_num = taylorDerivatives(diff, expr_node, var_index, diff_point, last_member_index, derivatives);
+
+    node_t * taylor = newNumNode(0.);
+
+    for (size_t taylor_index = 0; taylor_index < members_num; taylor_index++){
+        taylor = newOprNode(ADD,
+                    taylor,
+                    newOprNode(MUL,
+                        newOprNode(DIV,
+                            newNumNode(derivatives[taylor_index]),
+                            newOprNode(FAC, newNumNode((double)taylor_index), NULL)),
+                        newOprNode(POW,
+                            newOprNode(SUB,
+                                newVarNode(var_index),
+                                newNumNode(diff_point)
+                            ),
+                            newNumNode((double)taylor_index)
+                        )
+                    )
+                );
+    }
+
+    free(derivatives);
+
+    traceEnd(&span);
+
+    return taylor;
+}
+
+static uint64_t mixHash(uint64_t hash);
+
+static uint64_t elemHash(const expr_elem_t * elem, const node_t * left, const node_t * right);
+
+static void refreshHashes(const node_t * node);
+
+node_t * newOprNode(enum oper op_num, node_t * left, node_t * right)
+{
+    expr_elem_t operation = {};
+    operation.type = OPR;
+    operation.val.var = op_num;
+    operation.hash = elemHash(&operation, left, right);
+
+    statsNodes(1, 0);
+
+    return newNode(&operation, sizeof(operation), left, right, OPR_COLOR);
+}
+
+node_t * newNumNode(double num)
+{
+    expr_elem_t number = {};
+    number.type = NUM;
+    number.val.number = num;
+    number.hash = exprHashNum(num);
+
+    statsNodes(1, 0);
+
+    return newNode(&number, sizeof(number), NULL, NULL, NUM_COLOR);
+}
+
+node_t * newVarNode(unsigned int var_index)
+{
+    expr_elem_t variable = {};
+    variable.type = VAR;
+    variable.val.var = var_index;
+    variable.hash = exprHashVar(var_index);
+
+    statsNodes(1, 0);
+
+    return newNode(&variable, sizeof(variable), NULL, NULL, VAR_COLOR);
+}
+
+node_t * newDrvNode(node_t * expr_node, unsigned int var_index)
+{
+    assert(expr_node);
+
+    expr_elem_t deferred = {};
+    deferred.type = DRV;
+    deferred.val.var = var_index;
+    deferred.hash = elemHash(&deferred, expr_node, NULL);
+
+    statsNodes(1, 0);
+
+    return newNode(&deferred, sizeof(deferred), expr_node, NULL, DRV_COLOR);
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+static const uint64_t HASH_SEED = 0x9E3779B97F4A7C15ull;
+
+static uint64_t mixHash(uint64_t hash)
+{
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+
+    return hash ^ (hash >> 31);
+}
+
+uint64_t exprHashNum(double number)
+{
+    uint64_t bits = 0;
+    memcpy(&bits, &number, sizeof(bits));
+
+    return mixHash(((uint64_t)NUM + 1) * HASH_SEED ^ bits);
+}
+
+uint64_t exprHashVar(unsigned int var_index)
+{
+    return mixHash(((uint64_t)VAR + 1) * HASH_SEED + var_index);
+}
+
+uint64_t exprHashOpr(enum oper op_num, uint64_t left_hash, uint64_t right_hash)
+{
+    uint64_t hash = mixHash(((uint64_t)OPR + 1) * HASH_SEED + (uint64_t)op_num);
+
+    /* sum does not depend on order of operands */
+    if (opers[op_num].commutative)
+        return mixHash(hash + mixHash(left_hash) + mixHash(right_hash));
+
+    return mixHash(mixHash(hash + left_hash) + right_hash);
+}
+
+/// hash of the node with these operands, missing operand has zero hash
+static uint64_t elemHash(const expr_elem_t * elem, const node_t * left, const node_t * right)
+{
+    uint64_t left_hash  = (left  != NULL) ? exprHash(left)  : 0;
+    uint64_t right_hash = (right != NULL) ? exprHash(right) : 0;
+
+    switch (elem->type){
+        case NUM:
+            return exprHashNum(elem->val.number);
+
+        case VAR:
+            return exprHashVar(elem->val.var);
+
+        case OPR:
+            return exprHashOpr(elem->val.op, left_hash, right_hash);
+
+        case DRV:
+            return mixHash(mixHash(((uint64_t)DRV + 1) * HASH_SEED + elem->val.var) + left_hash);
+
+        default:
+            assert(0 && "incorrect elem type");
+            return 0;
+    }
+}
+
+uint64_t exprHash(const node_t * node)
+{
+    assert(node);
 
-    char buffer[BUFFER_LEN] = "";
-    fscanf(input_file, " %[^() ] ", buffer);
+    expr_elem_t * elem = (expr_elem_t *)node->data;
 
-    name_t * oper_in_table = tableLookup(&(diff->oper_table), buffer);
-    if (oper_in_table != NULL){
-        oper_t * operation = (oper_t *)(oper_in_table->data);
+    if (elem->stale_hash)
+        refreshHashes(node);
 
-        if (operation->binary){
-            node_t * left_operand  = readEquationPrefix(diff, input_file);
-            node_t * right_operand = readEquationPrefix(diff, input_file);
+    return elem->hash;
+}
 
-            node = newOprNode(operation->num, left_operand, right_operand);
+/// recomputes stale hashes of the subtree, operands before operations
+static void refreshHashes(const node_t * node)
+{
+    trav_stack_t<trav_frame_t> frames;
+    stackInit(&frames);
+
+    stackPush(&frames, {(node_t *)node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        expr_elem_t * elem = (expr_elem_t *)frame.node->data;
+
+        if (frame.expanded){
+            elem->hash = elemHash(elem, frame.node->left, frame.node->right);
+            elem->stale_hash = false;
+            continue;
         }
-        else {
-            node_t * operand  = readEquationPrefix(diff, input_file);
 
-            node = newOprNode(operation->num, operand, NULL);
+        stackPush(&frames, {frame.node, true});
+
+        if (frame.node->right != NULL && ((expr_elem_t *)frame.node->right->data)->stale_hash)
+            stackPush(&frames, {frame.node->right, false});
+
+        if (frame.node->left != NULL && ((expr_elem_t *)frame.node->left->data)->stale_hash)
+            stackPush(&frames, {frame.node->left, false});
+    }
+
+    stackDtor(&frames);
+}
+
+void exprRehash(node_t * node)
+{
+    assert(node);
+
+    expr_elem_t * elem = (expr_elem_t *)node->data;
+
+    elem->hash = elemHash(elem, node->left, node->right);
+    elem->stale_hash = false;
+}
+
+void exprRehashTree(node_t * node)
+{
+    if (node == NULL)
+        return;
+
+    trav_stack_t<trav_frame_t> frames;
+    stackInit(&frames);
+
+    stackPush(&frames, {node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+
+        if (frame.expanded || (frame.node->left == NULL && frame.node->right == NULL)){
+            exprRehash(frame.node);
+            continue;
         }
+
+        stackPush(&frames, {frame.node, true});
+
+        if (frame.node->right != NULL)
+            stackPush(&frames, {frame.node->right, false});
+
+        if (frame.node->left != NULL)
+            stackPush(&frames, {frame.node->left, false});
     }
-    else {
-        double number = 0.;
-        if (sscanf(buffer, "%lg", &number) > 0){
-            node = newNumNode(number);
+
+    stackDtor(&frames);
+}
+
+/// pair of nodes compared by exprEqual()
+typedef struct {
+    const node_t * first;
+    const node_t * second;
+} node_pair_t;
+
+static bool equalTrees(const node_t * first, const node_t * second, bool commutative);
+
+static bool equalTrees(const node_t * first, const node_t * second, bool commutative)
+{
+    trav_stack_t<node_pair_t> pairs;
+    stackInit(&pairs);
+
+    stackPush(&pairs, {first, second});
+
+    bool equal = true;
+
+    while (equal && pairs.size > 0){
+        node_pair_t pair = stackPop(&pairs);
+
+        first  = pair.first;
+        second = pair.second;
+
+        if (first == second)
+            continue;
+
+        if (first == NULL || second == NULL || exprHash(first) != exprHash(second)){
+            equal = false;
+            break;
         }
 
-        else {
-            node = getVarNode(diff, buffer);
+        const expr_elem_t * first_elem  = (const expr_elem_t *)first ->data;
+        const expr_elem_t * second_elem = (const expr_elem_t *)second->data;
+
+        if (first_elem->type != second_elem->type){
+            equal = false;
+            break;
+        }
+
+        switch (first_elem->type){
+            case NUM:
+                equal = (memcmp(&first_elem->val.number, &second_elem->val.number, sizeof(double)) == 0);
+                break;
+
+            case VAR: case DRV:
+                equal = (first_elem->val.var == second_elem->val.var);
+                break;
+
+            case OPR:
+                equal = (first_elem->val.op == second_elem->val.op);
+                break;
+
+            default:
+                equal = false;
+                break;
         }
+
+        /* swapped operands are chosen by their hashes */
+        bool swapped = commutative && first_elem->type == OPR && opers[first_elem->val.op].commutative &&
+                       first->left != NULL && second->right != NULL &&
+                       exprHash(first->left) == exprHash(second->right) &&
+                       exprHash(first->left) != exprHash(second->left);
+
+        stackPush(&pairs, {first->left,  swapped ? second->right : second->left});
+        stackPush(&pairs, {first->right, swapped ? second->left  : second->right});
     }
 
-    fscanf(input_file, " )");
+    stackDtor(&pairs);
 
-    return node;
+    return equal;
 }
 
-void setVariables(diff_t * diff)
+bool exprEqual(const node_t * first, const node_t * second)
 {
-    for (size_t var_index = 0; var_index < diff->var_num; var_index++){
-        printf("enter value of variable '%s':\n", diff->vars[var_index].name);
-        scanf(" %lg", &(diff->vars[var_index].value));
-        printf("scanned\n");
-    }
+    return equalTrees(first, second, false);
 }
 
-void exprElemToStr(char * str, void * data)
+bool exprEqualCommutative(const node_t * first, const node_t * second)
 {
-    expr_elem_t * elem = (expr_elem_t *)data;
+    return equalTrees(first, second, true);
+}
 
-    switch (elem->type){
-        case OPR:
-            sprintf(str, "type = 'OPR', operation '%s' ", opers[elem->val.op].name);
-            break;
+/// frame of copying, ready is the copy made by a task of parallel version
+typedef struct {
+    node_t * node;
+    bool expanded;
 
-        case NUM:
-            sprintf(str, "type = 'NUM', value.number = %lg", elem->val.number);
-            break;
+    node_t * ready;
+} copy_frame_t;
 
-        case VAR:
-            sprintf(str, "type = 'VAR', value.var    = %u", elem->val.var);
-            break;
+static node_t * copyTree(node_t * node, const par_split_t * split);
 
-        default:
-            logPrint(LOG_RELEASE, "incorrect elem type in elemToStr\n");
-            break;
+static node_t * copyRecursive(node_t * node, size_t depth, size_t * size);
+
+static node_t * copyIterative(node_t * node, const par_split_t * split, size_t * size);
+
+static node_t * copyParallel(node_t * node);
+
+node_t * exprCopy(node_t * node)
+{
+    if (node == NULL)
+        return NULL;
+
+    if (par_copy.split != NULL)
+        return copyParallel(node);
+
+    return copyTree(node, NULL);
+}
+
+/// copies of subtrees of split (NULL - serial) are taken ready
+static node_t * copyTree(node_t * node, const par_split_t * split)
+{
+    size_t size = 0;
+
+    node_t * copy = (split != NULL) ? copyIterative(node, split, &size) : copyRecursive(node, 0, &size);
+
+    statsCount(STAT_TREE_COPY_NODES, size);
+    statsNodes((int64_t)size, 0);
+
+    return copy;
+}
+
+/// size is increased by the number of copied nodes
+static node_t * copyRecursive(node_t * node, size_t depth, size_t * size)
+{
+    if (depth == RECURSIVE_WALK_DEPTH)
+        return copyIterative(node, NULL, size);
+
+    node_t * left  = (node->left  != NULL) ? copyRecursive(node->left,  depth + 1, size) : NULL;
+    node_t * right = (node->right != NULL) ? copyRecursive(node->right, depth + 1, size) : NULL;
+
+    node_t * copy = newNode(node->data, node->elem_size, left, right, node->color_for_dump);
+
+    if (left  != NULL) left ->parent = copy;
+    if (right != NULL) right->parent = copy;
+
+    (*size)++;
+
+    return copy;
+}
+
+static node_t * copyIterative(node_t * node, const par_split_t * split, size_t * size)
+{
+    trav_stack_t<copy_frame_t> frames;
+    trav_stack_t<node_t *> copies;
+
+    stackInit(&frames);
+    stackInit(&copies);
+
+    stackPush(&frames, {node, false, NULL});
+
+    while (frames.size > 0){
+        copy_frame_t frame = stackPop(&frames);
+        node = frame.node;
+
+        if (frame.ready != NULL){
+            stackPush(&copies, frame.ready);
+            continue;
+        }
+
+        bool has_children = (node->left != NULL || node->right != NULL);
+
+        if (has_children && !frame.expanded){
+            stackPush(&frames, {node, true, NULL});
+
+            if (node->right != NULL){
+                par_subtree_t * right = (split != NULL) ? findSubtree(split, &(node->right)) : NULL;
+                stackPush(&frames, {node->right, false, (right != NULL) ? right->result : NULL});
+            }
+
+            if (node->left != NULL){
+                par_subtree_t * left = (split != NULL) ? findSubtree(split, &(node->left)) : NULL;
+                stackPush(&frames, {node->left, false, (left != NULL) ? left->result : NULL});
+            }
+
+            continue;
+        }
+
+        node_t * right = (node->right != NULL) ? stackPop(&copies) : NULL;
+        node_t * left  = (node->left  != NULL) ? stackPop(&copies) : NULL;
+
+        node_t * copy = newNode(node->data, node->elem_size, left, right, node->color_for_dump);
+
+        if (left  != NULL) left ->parent = copy;
+        if (right != NULL) right->parent = copy;
+
+        stackPush(&copies, copy);
+        (*size)++;
     }
+
+    node_t * copy = stackPop(&copies);
+
+    stackDtor(&frames);
+    stackDtor(&copies);
+
+    return copy;
 }
 
-node_t * taylorSeries(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point, size_t last_member_index)
+static void copyTask(void * context, size_t task_index, size_t thread_index);
+
+static void copyTask(void * context, size_t task_index, size_t thread_index)
 {
-    assert(diff);
-    assert(expr_node);
+    par_subtree_t * subtrees = (par_subtree_t *)context;
 
-    diff->vars[var_index].value = diff_point;
+    (void) thread_index;
 
-    node_t * taylor = newNumNode(0.);
-    node_t * cur_derivative = treeCopy(expr_node);
+    subtrees[task_index].result = copyTree(subtrees[task_index].node, NULL);
+}
 
-    for (size_t taylor_index = 0; taylor_index < last_member_index; taylor_index++){
-        double cur_derivative_num = evaluate(diff, cur_derivative);
+/// copies operand of the top part of parallel derivative, its subtrees from the split are copied by tasks
+static node_t * copyParallel(node_t * node)
+{
+    const par_split_t * split = par_copy.split;
 
-        taylor = newOprNode(ADD,
-                    taylor,
-                    newOprNode(MUL,
-                        newOprNode(DIV,
-                            newNumNode(cur_derivative_num),
-                            newOprNode(FAC, newNumNode(taylor_index), NULL)),
-                        newOprNode(POW,
-                            newOprNode(SUB,
-                                newVarNode(var_index),
-                                newNumNode(diff_point)
-                            ),
-                            newNumNode((double)taylor_index)
-                        )
-                    )
-                );
+    if (!isTopNode(split, node))
+        return copyTree(node, NULL);
+
+    par_split_t copy_split = {};
+    size_t capacity = 0;
+
+    trav_stack_t<node_t *> nodes;
+    stackInit(&nodes);
+
+    stackPush(&nodes, node);
+
+    while (nodes.size > 0){
+        node_t * top_node = stackPop(&nodes);
 
-        node_t * old_derivative = cur_derivative;
+        node_t ** links[2] = {&(top_node->left), &(top_node->right)};
 
-        cur_derivative = makeDerivative(diff, cur_derivative, 0);
-        cur_derivative = simplifyExpression(cur_derivative);
+        for (size_t link_index = 0; link_index < 2; link_index++){
+            if (*links[link_index] == NULL)
+                continue;
 
-        treeDestroy(old_derivative);
+            par_subtree_t * subtree = findSubtree(split, links[link_index]);
+
+            if (subtree == NULL){
+                stackPush(&nodes, *links[link_index]);
+                continue;
+            }
+
+            if (copy_split.subtrees_num == capacity){
+                capacity = (capacity == 0) ? 64 : capacity * 2;
+                copy_split.subtrees = (par_subtree_t *)realloc(copy_split.subtrees, capacity * sizeof(par_subtree_t));
+            }
+
+            copy_split.subtrees[copy_split.subtrees_num] = *subtree;
+            copy_split.subtrees[copy_split.subtrees_num].result = NULL;
+            copy_split.subtrees_num++;
+        }
     }
 
-    treeDestroy(cur_derivative);
+    stackDtor(&nodes);
 
-    return taylor;
+    threadPoolFor(par_copy.pool, copy_split.subtrees_num, copyTask, copy_split.subtrees);
+
+    qsort(copy_split.subtrees, copy_split.subtrees_num, sizeof(par_subtree_t), cmpSubtrees);
+
+    node_t * copy = copyTree(node, &copy_split);
+
+    splitDtor(&copy_split);
+
+    return copy;
 }
 
-node_t * newOprNode(enum oper op_num, node_t * left, node_t * right)
+static void destroyRecursive(node_t * node, size_t depth, size_t * size);
+
+static void destroyIterative(node_t * node, size_t * size);
+
+void exprDestroy(node_t * node)
 {
-    expr_elem_t operation = {};
-    operation.type = OPR;
-    operation.val.var = op_num;
+    if (node == NULL)
+        return;
 
-    return newNode(&operation, sizeof(operation), left, right, OPR_COLOR);
+    size_t size = 0;
+
+    destroyRecursive(node, 0, &size);
+
+    statsNodes(0, (int64_t)size);
 }
 
-node_t * newNumNode(double num)
+/// size is increased by the number of deleted nodes
+static void destroyRecursive(node_t * node, size_t depth, size_t * size)
 {
-    expr_elem_t number = {};
-    number.type = NUM;
-    number.val.number = num;
+    if (depth == RECURSIVE_WALK_DEPTH){
+        destroyIterative(node, size);
+        return;
+    }
 
-    return newNode(&number, sizeof(number), NULL, NULL, NUM_COLOR);
+    if (node->left  != NULL) destroyRecursive(node->left,  depth + 1, size);
+    if (node->right != NULL) destroyRecursive(node->right, depth + 1, size);
+
+    delNode(node);
+    (*size)++;
 }
 
-node_t * newVarNode(unsigned int var_index)
+static void destroyIterative(node_t * node, size_t * size)
 {
-    expr_elem_t variable = {};
-    variable.type = VAR;
-    variable.val.var = var_index;
+    trav_stack_t<node_t *> nodes;
+    stackInit(&nodes);
 
-    return newNode(&variable, sizeof(variable), NULL, NULL, VAR_COLOR);
+    stackPush(&nodes, node);
+
+    while (nodes.size > 0){
+        node = stackPop(&nodes);
+
+        if (node->left != NULL)
+            stackPush(&nodes, node->left);
+
+        if (node->right != NULL)
+            stackPush(&nodes, node->right);
+
+        delNode(node);
+        (*size)++;
+    }
+
+    stackDtor(&nodes);
+}
+
+void exprDelNode(node_t * node)
+{
+    statsNodes(0, 1);
+
+    delNode(node);
 }
 
 void diffDump(diff_t * diff)
@@ -520,59 +2052,157 @@ void diffDump(diff_t * diff)
         logPrint(LOG_DEBUG, "\tvariable #%u:\n"
                             "\t\tname:  %s\n"
                             "\t\tvalue: %lg\n",
-                             var_index, diff->vars[var_index].name, diff->vars[var_index].value);
+                             var_index, diff->var_names[var_index], diff->var_values[var_index]);
     }
 
     logPrint(LOG_DEBUG, "<h2>---DIFFERENTIATOR DUMP END---</h2>\n");
 }
 
+static void pushVar(diff_t * diff, const char * var_name);
+
+/// appends variable to the registry, its index is var_num, the name must be already in var_table
+static void pushVar(diff_t * diff, const char * var_name)
+{
+    if (diff->var_num == diff->var_capacity){
+        diff->var_capacity = (diff->var_capacity == 0) ? MIN_VAR_CAPACITY : diff->var_capacity * 2;
+
+        diff->var_names  = (char **) realloc(diff->var_names,  diff->var_capacity * sizeof(char *));
+        diff->var_values = (double *)realloc(diff->var_values, diff->var_capacity * sizeof(double));
+    }
+
+    diff->var_names [diff->var_num] = strdup(var_name);
+    diff->var_values[diff->var_num] = 0.;
+
+    diff->var_num++;
+}
+
 node_t * getVarNode(diff_t * diff, char * var_name)
 {
-    unsigned int var_index = 0;
+    /* one probe both finds old variable and registers new one */
+    size_t var_index = symInsert(&(diff->var_table), var_name, diff->var_num);
 
-    name_t * variable = tableLookup(&(diff->var_table), var_name);
+    if (var_index == diff->var_num)
+        pushVar(diff, var_name);
 
-    if (variable == NULL){
-        tableInsert(&(diff->var_table), var_name, &(diff->var_num), sizeof(diff->var_num));
-        var_index = diff->var_num;
+    return newVarNode((unsigned int)var_index);
+}
 
-        strncpy(diff->vars[var_index].name, var_name, NAME_MAX_LEN - 1);
+void diffReserveVars(diff_t * diff, unsigned int var_num)
+{
+    assert(diff);
 
-        diff->var_num++;
-    }
-    else {
-        var_index = *(unsigned int *)(variable->data);
-    }
+    char var_name[GENERATED_VAR_NAME_LEN] = {};
+
+    while (diff->var_num < var_num){
+        snprintf(var_name, GENERATED_VAR_NAME_LEN, "x_%u", diff->var_num);
 
-    return newVarNode(var_index);
+        /* name is taken by other variable, every attempt makes a new name, so the loop ends */
+        for (unsigned int attempt = 0; symInsert(&(diff->var_table), var_name, diff->var_num) != diff->var_num; attempt++)
+            snprintf(var_name, GENERATED_VAR_NAME_LEN, "x_%u_%u", diff->var_num, attempt);
+
+        pushVar(diff, var_name);
+    }
 }
 
 size_t countVars(node_t * node, unsigned int var_index)
 {
     assert(node);
 
-    if (type_(node) == NUM)
-        return 0;
+    size_t vars_num = 0;
+
+    trav_stack_t<node_t *> nodes;
+    stackInit(&nodes);
+
+    stackPush(&nodes, node);
 
-    if (type_(node) == VAR){
-        if (val_(node).var == var_index)
-            return 1;
+    while (nodes.size > 0){
+        node = stackPop(&nodes);
 
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        if (type_(node) == VAR && val_(node).var == var_index)
+            vars_num++;
+
+        if (type_(node) == OPR){
+            if (opers[val_(node).op].binary)
+                stackPush(&nodes, node->right);
+
+            stackPush(&nodes, node->left);
+        }
+    }
+
+    stackDtor(&nodes);
+
+    return vars_num;
+}
+
+void collectVars(node_t * node, bool * vars_in_tree)
+{
+    assert(vars_in_tree);
+
+    if (node == NULL)
+        return;
+
+    trav_stack_t<node_t *> nodes;
+    stackInit(&nodes);
+
+    stackPush(&nodes, node);
+
+    while (nodes.size > 0){
+        node = stackPop(&nodes);
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        if (type_(node) == VAR)
+            vars_in_tree[val_(node).var] = true;
+
+        if (type_(node) == OPR){
+            if (node->right != NULL)
+                stackPush(&nodes, node->right);
+
+            stackPush(&nodes, node->left);
+        }
+    }
+
+    stackDtor(&nodes);
+}
+
+size_t treeSize(node_t * node)
+{
+    if (node == NULL)
         return 0;
+
+    size_t size = 0;
+
+    trav_stack_t<node_t *> nodes;
+    stackInit(&nodes);
+
+    stackPush(&nodes, node);
+
+    while (nodes.size > 0){
+        node = stackPop(&nodes);
+        size++;
+
+        if (node->left != NULL)
+            stackPush(&nodes, node->left);
+
+        if (node->right != NULL)
+            stackPush(&nodes, node->right);
     }
 
-    if (opers[val_(node).op].binary)
-        return countVars(node->left, var_index) + countVars(node->right, var_index);
+    stackDtor(&nodes);
 
-    return countVars(node->left, var_index);
+    return size;
 }
 
-long unsigned int factorial(long unsigned int number)
+double factorial(long unsigned int number)
 {
-    long unsigned int ans = 1;
+    double ans = 1.;
 
-    while (number != 0)
-        ans *= (number--);
+    while (number > 1)
+        ans *= (double)(number--);
 
     return ans;
 }
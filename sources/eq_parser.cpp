@@ -8,6 +8,8 @@
 #include "bintree.h"
 #include "differ.h"
 #include "eq_parser.h"
+#include "trace.h"
+#include "trav_stack.h"
 #include "logger.h"
 
 typedef enum {
@@ -16,6 +18,18 @@ typedef enum {
     HARD_ERROR
 } parser_status_t;
 
+typedef enum {
+    PARSER_OPER,
+    PARSER_BRACKET,
+    PARSER_FUNC         ///< opening bracket of the function argument
+} parser_item_t;
+
+/// operation or opening bracket waiting for its operands
+typedef struct {
+    parser_item_t type;
+    enum oper op;
+} parser_op_t;
+
 typedef struct {
     parser_status_t status;
     const char * orig_str;
@@ -26,15 +40,13 @@ static parser_context parserInit(const char * string);
 
 static void syntaxError(const char * expected, char real);
 
-static node_t * getExpr   (diff_t * diff, parser_context * context);
-
-static node_t * getMulDiv (diff_t * diff, parser_context * context);
+static int binaryPriority(enum oper op_num);
 
-static node_t * getPower(diff_t * diff, parser_context * context);
+static void reduceOperation(trav_stack_t<parser_op_t> * ops, trav_stack_t<node_t *> * operands);
 
-static node_t * getPrimary(diff_t * diff, parser_context * context);
+static node_t * getExpr   (diff_t * diff, parser_context * context);
 
-static node_t * getFunc(diff_t * diff, parser_context * context);
+static void getFunc(diff_t * diff, parser_context * context, enum oper * op_num);
 
 static node_t * getVar(diff_t * diff, parser_context * context);
 
@@ -60,10 +72,16 @@ node_t * parseEquation(diff_t * diff, const char * string)
     assert(diff);
     assert(string);
 
+    stats_timer_t timer = statsPhaseBegin(PHASE_PARSE);
+    trace_span_t span = traceBegin("parseEquation");
+
     parser_context context = parserInit(string);
 
     node_t * node = getExpr(diff, &context);
 
+    traceEnd(&span);
+    statsPhaseEnd(timer);
+
     if (node == NULL){
         fprintf(stderr, "failed to parse expression\n");
         return NULL;
@@ -77,129 +95,159 @@ node_t * parseEquation(diff_t * diff, const char * string)
     return node;
 }
 
-static node_t * getExpr(diff_t * diff, parser_context * context)
+static int binaryPriority(enum oper op_num)
 {
-    assert(diff);
-    assert(context);
+    switch (op_num){
+        case ADD: case SUB:
+            return 1;
 
-    node_t * node = getMulDiv(diff, context);
+        case MUL: case DIV:
+            return 2;
 
-    if (context->status == HARD_ERROR)
-        return NULL;
+        case POW:
+            return 3;
 
-    while (*(context->cur_str) == '+' || *(context->cur_str) == '-'){
-        int oper = *(context->cur_str);
-        (context->cur_str)++;
+        default:
+            return 0;
+    }
+}
 
-        node_t * node2 = getMulDiv(diff, context);
+/// makes node of the operation on the top of the operations stack
+static void reduceOperation(trav_stack_t<parser_op_t> * ops, trav_stack_t<node_t *> * operands)
+{
+    parser_op_t op = stackPop(ops);
 
-        if (context->status == HARD_ERROR)
-            return NULL;
+    /* operation is pushed only after its left operand and reduced only after the right one */
+    assert(operands->size >= 2);
 
-        if (oper == '+')
-            node = newOprNode(ADD, node, node2);
-        else
-            node = newOprNode(SUB, node, node2);
-    }
+    node_t * right = stackPop(operands);
+    node_t * left  = stackPop(operands);
 
-    return node;
+    stackPush(operands, newOprNode(op.op, left, right));
 }
 
-static node_t * getMulDiv(diff_t * diff, parser_context * context)
+/* operator precedence parsing with explicit stacks, so nesting depth is not limited by the call stack;
+   grammar is the same as in grammar.txt: ^ is right associative, others are left associative */
+static node_t * getExpr(diff_t * diff, parser_context * context)
 {
     assert(diff);
     assert(context);
 
-    node_t * node = getPower(diff, context);
+    trav_stack_t<parser_op_t> ops;
+    trav_stack_t<node_t *> operands;
 
-    if (context->status == HARD_ERROR)
-        return NULL;
+    stackInit(&ops);
+    stackInit(&operands);
 
-    while (*(context->cur_str) == '*' || *(context->cur_str) == '/'){
-        int op = *(context->cur_str);
-        (context->cur_str)++;
+    bool expect_operand = true;
 
-        node_t * node2 = getPower(diff, context);
+    while (context->status != HARD_ERROR){
+        char cur_char = *(context->cur_str);
 
-        if (context->status == HARD_ERROR)
-            return NULL;
+        if (expect_operand){
+            if (cur_char == '('){
+                stackPush(&ops, {PARSER_BRACKET, ADD});
+                context->cur_str++;
+                continue;
+            }
 
-        if (op == '*')
-            node = newOprNode(MUL, node, node2);
-        else
-            node = newOprNode(DIV, node, node2);
-    }
+            enum oper func_op = ADD;
+            getFunc(diff, context, &func_op);
 
-    return node;
-}
+            if (context->status == SUCCESS){
+                stackPush(&ops, {PARSER_FUNC, func_op});
+                continue;
+            }
+            else if (context->status == HARD_ERROR)
+                break;
 
-static node_t * getPower(diff_t * diff, parser_context * context)
-{
-    assert(diff);
-    assert(context);
+            node_t * operand = getVar(diff, context);
 
-    node_t * node = getPrimary(diff, context);
+            if (context->status == SOFT_ERROR)
+                operand = getNumber(diff, context);
 
-    if (context->status == HARD_ERROR)
-        return NULL;
+            if (context->status != SUCCESS)
+                break;
 
-    while (*(context->cur_str) == '^'){
-        (context->cur_str)++;
+            stackPush(&operands, operand);
+            expect_operand = false;
+            continue;
+        }
 
-        node_t * node2 = getPower(diff, context);
+        enum oper op_num = ADD;
 
-        if (context->status == HARD_ERROR)
-            return NULL;
+        switch (cur_char){
+            case '+': op_num = ADD; break;
+            case '-': op_num = SUB; break;
+            case '*': op_num = MUL; break;
+            case '/': op_num = DIV; break;
+            case '^': op_num = POW; break;
 
-        node = newOprNode(POW, node, node2);
-    }
+            case ')': {
+                while (ops.size > 0 && stackTop(&ops)->type == PARSER_OPER)
+                    reduceOperation(&ops, &operands);
 
-    return node;
+                /* bracket of the caller, it is checked by parseEquation() */
+                if (ops.size == 0)
+                    break;
 
-}
+                parser_op_t bracket = stackPop(&ops);
 
-static node_t * getPrimary(diff_t * diff, parser_context * context)
-{
-    assert(diff);
-    assert(context);
+                if (bracket.type == PARSER_FUNC){
+                    node_t * arg_tree = stackPop(&operands);
+                    stackPush(&operands, newOprNode(bracket.op, arg_tree, NULL));
+                }
 
-    if (*(context->cur_str) == '('){
-        (context->cur_str)++;
+                context->cur_str++;
+                continue;
+            }
 
-        node_t * node = getExpr(diff, context);
+            default:
+                break;
+        }
 
-        if (*(context->cur_str) != ')'){
-            context->status = HARD_ERROR;
-            syntaxError(")", *(context->cur_str));
+        if (!strchr("+-*/^", cur_char) || cur_char == '\0')
+            break;
+
+        int priority = binaryPriority(op_num);
 
-            return NULL;
+        while (ops.size > 0 && stackTop(&ops)->type == PARSER_OPER){
+            int top_priority = binaryPriority(stackTop(&ops)->op);
+
+            if (top_priority > priority || (top_priority == priority && op_num != POW))
+                reduceOperation(&ops, &operands);
+            else
+                break;
         }
 
+        stackPush(&ops, {PARSER_OPER, op_num});
         context->cur_str++;
 
-        return node;
+        expect_operand = true;
     }
 
-    node_t * func = getFunc(diff, context);
+    while (context->status != HARD_ERROR && ops.size > 0){
+        if (stackTop(&ops)->type != PARSER_OPER){
+            context->status = HARD_ERROR;
+            syntaxError(")", *(context->cur_str));
+            break;
+        }
 
-    if (context->status == SUCCESS)
-        return func;
+        reduceOperation(&ops, &operands);
+    }
 
-    else if (context->status == HARD_ERROR)
-        return NULL;
+    node_t * node = NULL;
 
-    node_t * var = getVar(diff, context);
-    if (context->status == SUCCESS)
-        return var;
+    if (context->status != HARD_ERROR)
+        node = stackPop(&operands);
 
-    else if (context->status == HARD_ERROR)
-        return NULL;
+    while (operands.size > 0)
+        exprDestroy(stackPop(&operands));
 
-    node_t * number = getNumber(diff, context);
-    if (context->status == SUCCESS)
-        return number;
+    stackDtor(&ops);
+    stackDtor(&operands);
 
-    return NULL;
+    return node;
 }
 
 static node_t * getNumber(diff_t * diff, parser_context * context)
@@ -250,10 +298,12 @@ static node_t * getVar(diff_t * diff, parser_context * context)
     return getVarNode(diff, var_name);
 }
 
-static node_t * getFunc(diff_t * diff, parser_context * context)
+/// reads name of function and opening bracket, its argument is parsed by getExpr()
+static void getFunc(diff_t * diff, parser_context * context, enum oper * op_num)
 {
     assert(diff);
     assert(context);
+    assert(op_num);
 
     logPrint(LOG_DEBUG_PLUS, "entered getFunc(), cur_str = '%s'\n", context->cur_str);
 
@@ -265,47 +315,29 @@ static node_t * getFunc(diff_t * diff, parser_context * context)
         context->cur_str = start;
         context->status = SOFT_ERROR;
 
-        return NULL;
+        return;
     }
 
     if (*(context->cur_str) != '('){
         context->cur_str = start;
         context->status = SOFT_ERROR;
 
-        return NULL;
+        return;
     }
 
     context->cur_str++;
 
-    name_t * func = tableLookup(&(diff->oper_table), func_name);
-    if (func == NULL){
+    size_t oper_index = symLookup(&(diff->oper_table), func_name);
+    if (oper_index == SYM_NONE){
         syntaxError("one of the functions", 'n');   //TODO - refactor syntaxError
         context->status = HARD_ERROR;
 
-        return NULL;
-    }
-
-    node_t * arg_tree = getExpr(diff, context);
-    if (context->status != SUCCESS)
-        return NULL;
-
-    if (*(context->cur_str) != ')'){
-        treeDestroy(arg_tree);
-
-        syntaxError(")", *(context->cur_str));
-        context->status = HARD_ERROR;
-
-        return NULL;
+        return;
     }
 
-    context->cur_str++;
-
-    oper_t * operation = (oper_t *)(func->data);
-    enum oper op_num = operation->num;
+    *op_num = opers[oper_index].num;
 
     context->status = SUCCESS;
-
-    return newOprNode(op_num, arg_tree, NULL);
 }
 
 static bool getName(char * name, parser_context * context, size_t name_max_len)
@@ -0,0 +1,761 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "flat_expr.h"
+#include "differ.h"
+#include "bintree.h"
+#include "trav_stack.h"
+#include "logger.h"
+
+static uint32_t addTree(flat_expr_t * flat, node_t * node);
+
+static node_t * makeTree(const flat_expr_t * flat, uint32_t index);
+
+static uint32_t addNum(flat_expr_t * flat, double number);
+
+static uint32_t addOpr(flat_expr_t * flat, enum oper op, uint32_t left, uint32_t right);
+
+static bool isNum(const flat_expr_t * flat, uint32_t index, double number);
+
+static flat_expr_t compact(const flat_expr_t * flat, uint32_t root);
+
+static void hashNewNodes(const flat_expr_t * flat, uint64_t ** hashes, size_t * hashed_num);
+
+static bool flatEqual(const flat_expr_t * flat, const uint64_t * hashes, uint32_t first, uint32_t second);
+
+static uint32_t deleteNeutralNode(flat_expr_t * flat, const uint64_t * hashes, enum oper op, uint32_t left, uint32_t right);
+
+static flat_expr_t simplifyPass(const flat_expr_t * flat, bool fold_constants, bool delete_neutral);
+
+flat_expr_t flatCtor()
+{
+    flat_expr_t flat = {};
+
+    return flat;
+}
+
+void flatDtor(flat_expr_t * flat)
+{
+    assert(flat);
+
+    free(flat->types);
+    free(flat->ops);
+    free(flat->left);
+    free(flat->right);
+    free(flat->values);
+
+    *flat = {};
+}
+
+uint32_t flatAddNode(flat_expr_t * flat, enum elem_type type, enum oper op, flat_value_t value, uint32_t left, uint32_t right)
+{
+    assert(flat);
+    assert(flat->size < FLAT_NONE);
+
+    if (flat->size == flat->capacity){
+        flat->capacity = (flat->capacity == 0) ? 64 : flat->capacity * 2;
+
+        flat->types  = (uint8_t      *)realloc(flat->types,  flat->capacity * sizeof(uint8_t));
+        flat->ops    = (uint8_t      *)realloc(flat->ops,    flat->capacity * sizeof(uint8_t));
+        flat->left   = (uint32_t     *)realloc(flat->left,   flat->capacity * sizeof(uint32_t));
+        flat->right  = (uint32_t     *)realloc(flat->right,  flat->capacity * sizeof(uint32_t));
+        flat->values = (flat_value_t *)realloc(flat->values, flat->capacity * sizeof(flat_value_t));
+    }
+
+    size_t index = flat->size++;
+
+    flat->types [index] = (uint8_t)type;
+    flat->ops   [index] = (uint8_t)op;
+    flat->left  [index] = left;
+    flat->right [index] = right;
+    flat->values[index] = value;
+
+    return (uint32_t)index;
+}
+
+uint32_t flatRoot(const flat_expr_t * flat)
+{
+    assert(flat);
+
+    return (flat->size == 0) ? FLAT_NONE : (uint32_t)(flat->size - 1);
+}
+
+static uint32_t addNum(flat_expr_t * flat, double number)
+{
+    flat_value_t value = {};
+    value.number = number;
+
+    return flatAddNode(flat, NUM, ADD, value, FLAT_NONE, FLAT_NONE);
+}
+
+static uint32_t addOpr(flat_expr_t * flat, enum oper op, uint32_t left, uint32_t right)
+{
+    flat_value_t value = {};
+
+    return flatAddNode(flat, OPR, op, value, left, right);
+}
+
+static bool isNum(const flat_expr_t * flat, uint32_t index, double number)
+{
+    return index != FLAT_NONE && flat->types[index] == NUM && flat->values[index].number == number;
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+/// adds nodes of the tree in postorder
+static uint32_t addTree(flat_expr_t * flat, node_t * node)
+{
+    assert(node);
+
+    trav_stack_t<trav_frame_t> frames;
+    trav_stack_t<uint32_t> indices;
+
+    stackInit(&frames);
+    stackInit(&indices);
+
+    stackPush(&frames, {node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node = frame.node;
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        flat_value_t value = {};
+
+        switch (type_(node)){
+            case NUM:
+                value.number = val_(node).number;
+                stackPush(&indices, flatAddNode(flat, NUM, ADD, value, FLAT_NONE, FLAT_NONE));
+                break;
+
+            case VAR:
+                value.var = val_(node).var;
+                stackPush(&indices, flatAddNode(flat, VAR, ADD, value, FLAT_NONE, FLAT_NONE));
+                break;
+
+            case OPR: {
+                enum oper op_num = val_(node).op;
+
+                if (!frame.expanded){
+                    stackPush(&frames, {node, true});
+
+                    if (opers[op_num].binary)
+                        stackPush(&frames, {node->right, false});
+
+                    stackPush(&frames, {node->left, false});
+                    break;
+                }
+
+                uint32_t right = opers[op_num].binary ? stackPop(&indices) : FLAT_NONE;
+                uint32_t left  = stackPop(&indices);
+
+                stackPush(&indices, flatAddNode(flat, OPR, op_num, value, left, right));
+                break;
+            }
+
+            default:
+                assert(0 && "incorrect elem type");
+                break;
+        }
+    }
+
+    uint32_t root = stackPop(&indices);
+
+    stackDtor(&frames);
+    stackDtor(&indices);
+
+    return root;
+}
+
+flat_expr_t flatFromTree(node_t * node)
+{
+    assert(node);
+
+    flat_expr_t flat = flatCtor();
+
+    addTree(&flat, node);
+
+    return flat;
+}
+
+/// flat frame of postorder traversal
+typedef struct {
+    uint32_t index;
+    bool expanded;
+} flat_frame_t;
+
+static node_t * makeTree(const flat_expr_t * flat, uint32_t index)
+{
+    trav_stack_t<flat_frame_t> frames;
+    trav_stack_t<node_t *> nodes;
+
+    stackInit(&frames);
+    stackInit(&nodes);
+
+    stackPush(&frames, {index, false});
+
+    while (frames.size > 0){
+        flat_frame_t frame = stackPop(&frames);
+        index = frame.index;
+
+        switch (flat->types[index]){
+            case NUM:
+                stackPush(&nodes, newNumNode(flat->values[index].number));
+                break;
+
+            case VAR:
+                stackPush(&nodes, newVarNode(flat->values[index].var));
+                break;
+
+            case OPR: {
+                enum oper op_num = (enum oper)flat->ops[index];
+
+                if (!frame.expanded){
+                    stackPush(&frames, {index, true});
+
+                    if (opers[op_num].binary)
+                        stackPush(&frames, {flat->right[index], false});
+
+                    stackPush(&frames, {flat->left[index], false});
+                    break;
+                }
+
+                node_t * right = opers[op_num].binary ? stackPop(&nodes) : NULL;
+                node_t * left  = stackPop(&nodes);
+
+                node_t * node = newOprNode(op_num, left, right);
+
+                left->parent = node;
+                if (right != NULL)
+                    right->parent = node;
+
+                stackPush(&nodes, node);
+                break;
+            }
+
+            default:
+                assert(0 && "incorrect elem type");
+                break;
+        }
+    }
+
+    node_t * root = stackPop(&nodes);
+
+    stackDtor(&frames);
+    stackDtor(&nodes);
+
+    return root;
+}
+
+node_t * flatToTree(const flat_expr_t * flat)
+{
+    assert(flat);
+    assert(flat->size > 0);
+
+    return makeTree(flat, flatRoot(flat));
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+double flatEvaluate(const flat_expr_t * flat, const double * var_values, double * regs)
+{
+    assert(flat);
+    assert(flat->size > 0);
+
+    statsCount(STAT_EVALUATIONS, 1);
+
+    double * own_regs = NULL;
+    if (regs == NULL){
+        own_regs = (double *)calloc(flat->size, sizeof(double));
+        regs = own_regs;
+    }
+
+    for (size_t index = 0; index < flat->size; index++){
+        switch (flat->types[index]){
+            case NUM:
+                regs[index] = flat->values[index].number;
+                break;
+
+            case VAR:
+                assert(var_values);
+                regs[index] = var_values[flat->values[index].var];
+                break;
+
+            case OPR: {
+                enum oper op_num = (enum oper)flat->ops[index];
+
+                regs[index] = calcOper(op_num, regs[flat->left[index]],
+                                       opers[op_num].binary ? regs[flat->right[index]] : 0.);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    double result = regs[flat->size - 1];
+
+    free(own_regs);
+
+    return result;
+}
+
+size_t flatCountVars(const flat_expr_t * flat, unsigned int var_index)
+{
+    assert(flat);
+
+    if (flat->size == 0)
+        return 0;
+
+    size_t * counts = (size_t *)calloc(flat->size, sizeof(size_t));
+
+    for (size_t index = 0; index < flat->size; index++){
+        if (flat->types[index] == VAR)
+            counts[index] = (flat->values[index].var == var_index) ? 1 : 0;
+
+        else if (flat->types[index] == OPR){
+            counts[index] = counts[flat->left[index]];
+
+            if (flat->right[index] != FLAT_NONE)
+                counts[index] += counts[flat->right[index]];
+        }
+    }
+
+    size_t result = counts[flat->size - 1];
+
+    free(counts);
+
+    return result;
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+/// copy of the expression with only nodes reachable from root, root becomes the last node
+static flat_expr_t compact(const flat_expr_t * flat, uint32_t root)
+{
+    flat_expr_t result = flatCtor();
+
+    if (root == FLAT_NONE)
+        return result;
+
+    bool * reachable = (bool *)calloc(root + 1, sizeof(bool));
+    uint32_t * new_index = (uint32_t *)calloc(root + 1, sizeof(uint32_t));
+
+    reachable[root] = true;
+
+    /* parents are after children, so one backward pass marks everything */
+    for (size_t index = root + 1; index-- > 0; ){
+        if (!reachable[index] || flat->types[index] != OPR)
+            continue;
+
+        reachable[flat->left[index]] = true;
+
+        if (flat->right[index] != FLAT_NONE)
+            reachable[flat->right[index]] = true;
+    }
+
+    for (size_t index = 0; index <= root; index++){
+        if (!reachable[index])
+            continue;
+
+        uint32_t left  = (flat->left [index] == FLAT_NONE) ? FLAT_NONE : new_index[flat->left [index]];
+        uint32_t right = (flat->right[index] == FLAT_NONE) ? FLAT_NONE : new_index[flat->right[index]];
+
+        new_index[index] = flatAddNode(&result, (enum elem_type)flat->types[index], (enum oper)flat->ops[index],
+                                       flat->values[index], left, right);
+    }
+
+    free(new_index);
+    free(reachable);
+
+    return result;
+}
+
+/// computes hashes of nodes added after the last call, they are equal to hashes of the same trees
+static void hashNewNodes(const flat_expr_t * flat, uint64_t ** hashes, size_t * hashed_num)
+{
+    if (*hashed_num == flat->size)
+        return;
+
+    *hashes = (uint64_t *)realloc(*hashes, flat->capacity * sizeof(uint64_t));
+
+    for (size_t index = *hashed_num; index < flat->size; index++){
+        switch (flat->types[index]){
+            case NUM:
+                (*hashes)[index] = exprHashNum(flat->values[index].number);
+                break;
+
+            case VAR:
+                (*hashes)[index] = exprHashVar(flat->values[index].var);
+                break;
+
+            case OPR:
+                (*hashes)[index] = exprHashOpr((enum oper)flat->ops[index], (*hashes)[flat->left[index]],
+                                               (flat->right[index] == FLAT_NONE) ? 0 : (*hashes)[flat->right[index]]);
+                break;
+
+            default:
+                assert(0 && "incorrect elem type");
+                break;
+        }
+    }
+
+    *hashed_num = flat->size;
+}
+
+/// pair of nodes compared by flatEqual()
+typedef struct {
+    uint32_t first;
+    uint32_t second;
+} index_pair_t;
+
+/// same as exprEqual(), shared operands are equal by index
+static bool flatEqual(const flat_expr_t * flat, const uint64_t * hashes, uint32_t first, uint32_t second)
+{
+    trav_stack_t<index_pair_t> pairs;
+    stackInit(&pairs);
+
+    stackPush(&pairs, {first, second});
+
+    bool equal = true;
+
+    while (equal && pairs.size > 0){
+        index_pair_t pair = stackPop(&pairs);
+
+        if (pair.first == pair.second)
+            continue;
+
+        if (pair.first == FLAT_NONE || pair.second == FLAT_NONE || hashes[pair.first] != hashes[pair.second] ||
+            flat->types[pair.first] != flat->types[pair.second]){
+            equal = false;
+            break;
+        }
+
+        switch (flat->types[pair.first]){
+            case NUM:
+                equal = (memcmp(&flat->values[pair.first].number, &flat->values[pair.second].number, sizeof(double)) == 0);
+                break;
+
+            case VAR:
+                equal = (flat->values[pair.first].var == flat->values[pair.second].var);
+                break;
+
+            case OPR:
+                equal = (flat->ops[pair.first] == flat->ops[pair.second]);
+
+                stackPush(&pairs, {flat->left [pair.first], flat->left [pair.second]});
+                stackPush(&pairs, {flat->right[pair.first], flat->right[pair.second]});
+                break;
+
+            default:
+                equal = false;
+                break;
+        }
+    }
+
+    stackDtor(&pairs);
+
+    return equal;
+}
+
+/// applies rules of deleteNeutral() to operation on already simplified operands,
+/// returns index of the result or FLAT_NONE if no rule is applicable
+static uint32_t deleteNeutralNode(flat_expr_t * flat, const uint64_t * hashes, enum oper op, uint32_t left, uint32_t right)
+{
+    switch (op){
+        case MUL:
+            /* x*1 = x, x*0 = 0, left operand is checked first as in the tree */
+            if (isNum(flat, left, 1.)){
+                statsCount(STAT_RULE_MUL_ONE, 1);
+                return right;
+            }
+            if (isNum(flat, left, 0.)){
+                statsCount(STAT_RULE_MUL_ZERO, 1);
+                return left;
+            }
+            if (isNum(flat, right, 1.)){
+                statsCount(STAT_RULE_MUL_ONE, 1);
+                return left;
+            }
+            if (isNum(flat, right, 0.)){
+                statsCount(STAT_RULE_MUL_ZERO, 1);
+                return right;
+            }
+            break;
+
+        case ADD:
+            if (isNum(flat, left, 0.)){
+                statsCount(STAT_RULE_ADD_ZERO, 1);
+                return right;
+            }
+            if (isNum(flat, right, 0.)){
+                statsCount(STAT_RULE_ADD_ZERO, 1);
+                return left;
+            }
+            break;
+
+        case DIV:
+            if (isNum(flat, right, 1.)){
+                statsCount(STAT_RULE_DIV_ONE, 1);
+                return left;
+            }
+            break;
+
+        case SUB:
+            if (isNum(flat, right, 0.)){
+                statsCount(STAT_RULE_SUB_ZERO, 1);
+                return left;
+            }
+            if (flatEqual(flat, hashes, left, right)){
+                statsCount(STAT_RULE_SUB_SELF, 1);
+                return addNum(flat, 0.);
+            }
+            break;
+
+        case POW:
+            if (isNum(flat, right, 1.)){
+                statsCount(STAT_RULE_POW_ONE, 1);
+                return left;
+            }
+            if (isNum(flat, right, 0.)){
+                statsCount(STAT_RULE_POW_ZERO, 1);
+                return addNum(flat, 1.);
+            }
+            if (isNum(flat, left, 1.) || isNum(flat, left, 0.)){
+                statsCount(STAT_RULE_POW_BASE, 1);
+                return left;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return FLAT_NONE;
+}
+
+/// operands are simplified before their parents, so one pass gives the same result as cycle in simplifyExpression()
+static flat_expr_t simplifyPass(const flat_expr_t * flat, bool fold_constants, bool delete_neutral)
+{
+    assert(flat);
+
+    if (flat->size == 0)
+        return flatCtor();
+
+    flat_expr_t result = flatCtor();
+    uint32_t * new_index = (uint32_t *)calloc(flat->size, sizeof(uint32_t));
+
+    uint64_t * hashes = NULL;
+    size_t hashed_num = 0;
+
+    for (size_t index = 0; index < flat->size; index++){
+        if (flat->types[index] != OPR){
+            new_index[index] = flatAddNode(&result, (enum elem_type)flat->types[index], ADD, flat->values[index],
+                                           FLAT_NONE, FLAT_NONE);
+            continue;
+        }
+
+        enum oper op_num = (enum oper)flat->ops[index];
+        bool binary = opers[op_num].binary;
+
+        uint32_t left  = new_index[flat->left[index]];
+        uint32_t right = binary ? new_index[flat->right[index]] : FLAT_NONE;
+
+        if (fold_constants && result.types[left] == NUM && (!binary || result.types[right] == NUM)){
+            double value = calcOper(op_num, result.values[left].number, binary ? result.values[right].number : 0.);
+
+            statsCount(STAT_RULE_FOLD_CONSTANTS, 1);
+
+            new_index[index] = addNum(&result, value);
+            continue;
+        }
+
+        if (delete_neutral){
+            hashNewNodes(&result, &hashes, &hashed_num);
+
+            uint32_t simplified = deleteNeutralNode(&result, hashes, op_num, left, right);
+
+            if (simplified != FLAT_NONE){
+                new_index[index] = simplified;
+                continue;
+            }
+        }
+
+        new_index[index] = addOpr(&result, op_num, left, right);
+    }
+
+    /* operands dropped by rules are still in result */
+    flat_expr_t compacted = compact(&result, new_index[flat->size - 1]);
+
+    flatDtor(&result);
+    free(new_index);
+    free(hashes);
+
+    return compacted;
+}
+
+flat_expr_t flatFoldConstants(const flat_expr_t * flat)
+{
+    return simplifyPass(flat, true, false);
+}
+
+flat_expr_t flatDeleteNeutral(const flat_expr_t * flat)
+{
+    return simplifyPass(flat, false, true);
+}
+
+flat_expr_t flatSimplify(const flat_expr_t * flat)
+{
+    stats_timer_t timer = statsPhaseBegin(PHASE_SIMPLIFY);
+
+    flat_expr_t result = simplifyPass(flat, true, true);
+
+    statsCount(STAT_SIMPLIFY_PASSES, 1);
+    statsPhaseEnd(timer);
+
+    return result;
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+flat_expr_t flatDerivative(const flat_expr_t * flat, unsigned int var_index)
+{
+    assert(flat);
+
+    if (flat->size == 0)
+        return flatCtor();
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_DERIVATIVE);
+
+    /* expression itself is the first part of the result, so operands are referenced instead of copied */
+    flat_expr_t result = flatCtor();
+
+    for (size_t index = 0; index < flat->size; index++)
+        flatAddNode(&result, (enum elem_type)flat->types[index], (enum oper)flat->ops[index], flat->values[index],
+                    flat->left[index], flat->right[index]);
+
+    uint32_t * deriv   = (uint32_t *)calloc(flat->size, sizeof(uint32_t));
+    bool     * depends = (bool     *)calloc(flat->size, sizeof(bool));
+
+    bool differentiable = true;
+
+    /* derivatives of operands are ready when operation is reached */
+    for (size_t index = 0; index < flat->size && differentiable; index++){
+        uint32_t node = (uint32_t)index;
+
+        if (flat->types[index] == NUM){
+            deriv[index] = addNum(&result, 0.);
+            continue;
+        }
+
+        if (flat->types[index] == VAR){
+            depends[index] = (flat->values[index].var == var_index);
+            deriv[index] = addNum(&result, depends[index] ? 1. : 0.);
+            continue;
+        }
+
+        enum oper op_num = (enum oper)flat->ops[index];
+
+        uint32_t left  = flat->left [index];
+        uint32_t right = flat->right[index];
+
+        uint32_t d_left  = deriv[left];
+        uint32_t d_right = (right == FLAT_NONE) ? FLAT_NONE : deriv[right];
+
+        depends[index] = depends[left] || (right != FLAT_NONE && depends[right]);
+
+        uint32_t d_node = FLAT_NONE;
+
+        switch (op_num){
+            case ADD:
+            case SUB:
+                d_node = addOpr(&result, op_num, d_left, d_right);
+                break;
+
+            case MUL:
+                d_node = addOpr(&result, ADD,
+                            addOpr(&result, MUL, d_left, right),
+                            addOpr(&result, MUL, left, d_right));
+                break;
+
+            case DIV:
+                d_node = addOpr(&result, DIV,
+                            addOpr(&result, SUB,
+                                addOpr(&result, MUL, d_left, right),
+                                addOpr(&result, MUL, left, d_right)),
+                            addOpr(&result, POW, right, addNum(&result, 2.)));
+                break;
+
+            case POW:
+                if (!depends[left]){
+                    if (!depends[right])
+                        d_node = addNum(&result, 0.);
+                    else
+                        d_node = addOpr(&result, MUL,
+                                    addOpr(&result, MUL, node, addOpr(&result, LN, left, FLAT_NONE)),
+                                    d_right);
+                }
+                else if (!depends[right]){
+                    d_node = addOpr(&result, MUL,
+                                addOpr(&result, MUL,
+                                    right,
+                                    addOpr(&result, POW, left, addOpr(&result, SUB, right, addNum(&result, 1.)))),
+                                d_left);
+                }
+                else {
+                    d_node = addOpr(&result, MUL,
+                                node,
+                                addOpr(&result, ADD,
+                                    addOpr(&result, DIV, addOpr(&result, MUL, d_left, right), left),
+                                    addOpr(&result, MUL, addOpr(&result, LN, left, FLAT_NONE), d_right)));
+                }
+                break;
+
+            case SIN:
+                d_node = addOpr(&result, MUL, addOpr(&result, COS, left, FLAT_NONE), d_left);
+                break;
+
+            case COS:
+                d_node = addOpr(&result, MUL,
+                            addOpr(&result, SIN, left, FLAT_NONE),
+                            addOpr(&result, MUL, d_left, addNum(&result, -1.)));
+                break;
+
+            case TAN:
+                d_node = addOpr(&result, DIV,
+                            d_left,
+                            addOpr(&result, POW, addOpr(&result, COS, left, FLAT_NONE), addNum(&result, 2.)));
+                break;
+
+            case LN:
+                d_node = addOpr(&result, DIV, d_left, left);
+                break;
+
+            case LOG:
+            case FAC:
+            default:
+                differentiable = false;
+                break;
+        }
+
+        deriv[index] = d_node;
+    }
+
+    flat_expr_t derivative = differentiable ? compact(&result, deriv[flat->size - 1]) : flatCtor();
+
+    if (!differentiable)
+        logPrint(LOG_RELEASE, "no rule for derivative in flat expression\n");
+
+    flatDtor(&result);
+    free(deriv);
+    free(depends);
+
+    statsPhaseEnd(timer);
+
+    return derivative;
+}
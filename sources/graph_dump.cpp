@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "graph_dump.h"
+#include "job_queue.h"
+#include "logger.h"
+#include "trace.h"
+
+const size_t GRAPH_LABEL_LEN = 128;
+const size_t GRAPH_PATH_LEN  = 256;
+
+/// directory, "/graph_", number and extension
+const size_t GRAPH_FILE_NAME_LEN = GRAPH_PATH_LEN + 64;
+
+const size_t GRAPH_NO_PARENT = SIZE_MAX;
+
+const char * const CUT_COLOR = "#DDDDDD";
+
+/// node of the copied top part of the tree
+typedef struct {
+    char label[GRAPH_LABEL_LEN];
+    uint32_t color;
+
+    size_t parent;              ///< GRAPH_NO_PARENT for the root
+    bool is_left;
+    bool is_cut;                ///< stands for subtree that is not drawn
+} graph_node_t;
+
+/// node of the tree waiting for copying
+typedef struct {
+    node_t * node;
+    size_t graph_index;
+} copied_node_t;
+
+/// graph drawn by the background thread, it owns the copy of nodes
+typedef struct {
+    graph_node_t * nodes;
+    size_t nodes_num;
+
+    char dot_name[GRAPH_FILE_NAME_LEN];
+    char png_name[GRAPH_FILE_NAME_LEN];
+} graph_job_t;
+
+#ifdef _DEBUG
+bool graph_dump_enabled = true;
+#else
+bool graph_dump_enabled = false;
+#endif
+
+static struct {
+    job_queue_t * queue;
+
+    char dir[GRAPH_PATH_LEN];
+    size_t node_budget;
+    size_t dumps_num;
+} graphs = {};
+
+static size_t addGraphNode(graph_job_t * job, size_t parent, bool is_left);
+
+static void writeDot(const graph_job_t * job, FILE * dot_file);
+
+static void drawGraph(void * arg);
+
+void graphDumpStart(const char * dir, size_t node_budget)
+{
+    assert(dir);
+    assert(node_budget > 0);
+
+    if (!graph_dump_enabled || graphs.queue != NULL)
+        return;
+
+    strncpy(graphs.dir, dir, GRAPH_PATH_LEN - 1);
+
+    graphs.node_budget = node_budget;
+    graphs.queue = jobQueueCtor(1, GRAPH_DUMP_MAX_PENDING);
+}
+
+void graphDumpStop()
+{
+    if (graphs.queue == NULL)
+        return;
+
+    jobQueueDtor(graphs.queue);
+
+    graphs.queue = NULL;
+}
+
+static size_t addGraphNode(graph_job_t * job, size_t parent, bool is_left)
+{
+    size_t index = job->nodes_num++;
+
+    graph_node_t * node = job->nodes + index;
+
+    node->parent  = parent;
+    node->is_left = is_left;
+
+    return index;
+}
+
+void graphDump(node_t * root_node, elemtostr_func_t elemToStr)
+{
+    assert(elemToStr);
+
+    if (!graph_dump_enabled || graphs.queue == NULL || root_node == NULL)
+        return;
+
+    trace_span_t span = traceBegin("graphDump");
+
+    graph_job_t * job = (graph_job_t *)calloc(1, sizeof(graph_job_t));
+
+    /* every drawn node adds at most two cut ones */
+    job->nodes = (graph_node_t *)calloc(3 * graphs.node_budget + 1, sizeof(graph_node_t));
+
+    size_t dump_index = graphs.dumps_num++;
+
+    snprintf(job->dot_name, GRAPH_FILE_NAME_LEN, "%s/graph_%zu.dot", graphs.dir, dump_index);
+    snprintf(job->png_name, GRAPH_FILE_NAME_LEN, "%s/graph_%zu.png", graphs.dir, dump_index);
+
+    /* nodes are copied in breadth-first order, so the top levels are drawn */
+    copied_node_t * copied = (copied_node_t *)calloc(graphs.node_budget, sizeof(copied_node_t));
+    size_t copied_num = 0;
+
+    copied[copied_num++] = {root_node, addGraphNode(job, GRAPH_NO_PARENT, false)};
+
+    for (size_t index = 0; index < copied_num; index++){
+        node_t * node = copied[index].node;
+        graph_node_t * graph_node = job->nodes + copied[index].graph_index;
+
+        elemToStr(graph_node->label, node->data);
+        graph_node->color = node->color_for_dump;
+
+        node_t * children[] = {node->left, node->right};
+
+        for (size_t child_index = 0; child_index < 2; child_index++){
+            if (children[child_index] == NULL)
+                continue;
+
+            size_t child = addGraphNode(job, copied[index].graph_index, child_index == 0);
+
+            if (copied_num < graphs.node_budget)
+                copied[copied_num++] = {children[child_index], child};
+            else
+                job->nodes[child].is_cut = true;
+        }
+    }
+
+    free(copied);
+
+    /* image will appear when the thread draws it, name is relative to the log in the same directory */
+    logPrint(LOG_DEBUG, "<img src=\"graph_%zu.png\">\n", dump_index);
+
+    jobQueuePush(graphs.queue, drawGraph, job);
+
+    traceEnd(&span);
+}
+
+static void writeDot(const graph_job_t * job, FILE * dot_file)
+{
+    fprintf(dot_file, "digraph tree {\n"
+                      "\tnode [shape = box, style = \"rounded, filled\"];\n");
+
+    for (size_t index = 0; index < job->nodes_num; index++){
+        const graph_node_t * node = job->nodes + index;
+
+        if (node->is_cut)
+            fprintf(dot_file, "\tnode%zu [label = \"...\", fillcolor = \"%s\"];\n", index, CUT_COLOR);
+        else
+            fprintf(dot_file, "\tnode%zu [label = \"%s\", fillcolor = \"#%06" PRIX32 "\"];\n", index, node->label,
+                              node->color >> 8);
+
+        if (node->parent != GRAPH_NO_PARENT)
+            fprintf(dot_file, "\tnode%zu -> node%zu [color = \"%s\"];\n", node->parent, index,
+                              node->is_left ? LEFT_COLOR : RIGHT_COLOR);
+    }
+
+    fprintf(dot_file, "}\n");
+}
+
+/// job of the background thread: writes dot file and runs graphviz
+static void drawGraph(void * arg)
+{
+    graph_job_t * job = (graph_job_t *)arg;
+
+    trace_span_t span = traceBeginNum("drawGraph", "nodes", (long)job->nodes_num);
+
+    FILE * dot_file = fopen(job->dot_name, "w");
+
+    if (dot_file != NULL){
+        writeDot(job, dot_file);
+        fclose(dot_file);
+
+        char system_str[2 * GRAPH_FILE_NAME_LEN + 32] = "";
+        snprintf(system_str, sizeof(system_str), "dot -Tpng %s -o %s", job->dot_name, job->png_name);
+
+        if (system(system_str) != 0)
+            fprintf(stderr, "graphviz failed on %s\n", job->dot_name);
+    }
+
+    traceEnd(&span);
+
+    free(job->nodes);
+    free(job);
+}
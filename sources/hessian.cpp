@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hessian.h"
+#include "differ.h"
+#include "bintree.h"
+#include "trav_stack.h"
+#include "logger.h"
+
+/// set of unique nodes: node is identified by its element and pointers to (already unique) children
+typedef struct {
+    node_t ** slots;
+    size_t capacity;
+    size_t size;
+} node_set_t;
+
+static uint64_t nodeKeyHash(node_t * node);
+
+static bool nodeKeyEqual(node_t * first, node_t * second);
+
+static void nodeSetInsert(node_set_t * set, node_t * node);
+
+static node_t * shareNode(node_set_t * set, node_t * node);
+
+static node_t * shareTree(node_set_t * set, node_t * node);
+
+static void shareTrees(hessian_t * hessian);
+
+static node_t * makeEntry(diff_t * diff, node_t * expr_node, unsigned int var_index, bool * failed);
+
+static void destroyEntries(hessian_t * hessian);
+
+static bool * selectVars(node_t * expr_node, const bool * vars, size_t var_num);
+
+static uint64_t nodeKeyHash(node_t * node)
+{
+    uint64_t val_bits = 0;
+    memcpy(&val_bits, &(val_(node).number), sizeof(val_bits));
+
+    if (type_(node) != NUM)
+        val_bits = (type_(node) == VAR) ? (uint64_t)val_(node).var : (uint64_t)val_(node).op;
+
+    uint64_t hash = ((uint64_t)type_(node) + 1) * 0x9E3779B97F4A7C15ull;
+
+    hash = (hash ^ val_bits              ) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (uintptr_t)node->left ) * 0x94D049BB133111EBull;
+    hash = (hash ^ (uintptr_t)node->right) * 0x9E3779B97F4A7C15ull;
+
+    return hash ^ (hash >> 29);
+}
+
+static bool nodeKeyEqual(node_t * first, node_t * second)
+{
+    if (type_(first) != type_(second) || first->left != second->left || first->right != second->right)
+        return false;
+
+    switch (type_(first)){
+        case NUM:
+            return memcmp(&(val_(first).number), &(val_(second).number), sizeof(double)) == 0;
+
+        case VAR:
+            return val_(first).var == val_(second).var;
+
+        case OPR:
+            return val_(first).op == val_(second).op;
+
+        default:
+            return false;
+    }
+}
+
+static void nodeSetInsert(node_set_t * set, node_t * node)
+{
+    /* load factor is not more than 1/2 */
+    if (2 * (set->size + 1) > set->capacity){
+        size_t old_capacity = set->capacity;
+        node_t ** old_slots = set->slots;
+
+        set->capacity = (old_capacity == 0) ? 256 : old_capacity * 2;
+        set->slots = (node_t **)calloc(set->capacity, sizeof(node_t *));
+
+        for (size_t slot = 0; slot < old_capacity; slot++){
+            if (old_slots[slot] == NULL)
+                continue;
+
+            size_t new_slot = nodeKeyHash(old_slots[slot]) & (set->capacity - 1);
+            while (set->slots[new_slot] != NULL)
+                new_slot = (new_slot + 1) & (set->capacity - 1);
+
+            set->slots[new_slot] = old_slots[slot];
+        }
+
+        free(old_slots);
+    }
+
+    size_t slot = nodeKeyHash(node) & (set->capacity - 1);
+    while (set->slots[slot] != NULL)
+        slot = (slot + 1) & (set->capacity - 1);
+
+    set->slots[slot] = node;
+    set->size++;
+}
+
+/// result of sharing is written to link (child pointer in parent)
+typedef struct {
+    node_t * node;
+    node_t ** link;
+    bool expanded;
+} share_frame_t;
+
+/// replaces every node of the tree by unique one, children are shared before parents
+static node_t * shareTree(node_set_t * set, node_t * node)
+{
+    if (node == NULL)
+        return NULL;
+
+    node_t * result = node;
+
+    trav_stack_t<share_frame_t> frames;
+    stackInit(&frames);
+
+    stackPush(&frames, {node, &result, false});
+
+    while (frames.size > 0){
+        share_frame_t frame = stackPop(&frames);
+
+        if (frame.expanded){
+            *frame.link = shareNode(set, frame.node);
+            continue;
+        }
+
+        if (type_(frame.node) == DRV)
+            expandDeferred(frame.node);
+
+        frame.expanded = true;
+        stackPush(&frames, frame);
+
+        if (frame.node->right != NULL)
+            stackPush(&frames, {frame.node->right, &(frame.node->right), false});
+
+        if (frame.node->left != NULL)
+            stackPush(&frames, {frame.node->left, &(frame.node->left), false});
+    }
+
+    stackDtor(&frames);
+
+    return result;
+}
+
+/// returns unique node equal to the node with already unique children, node is deleted if there is already equal one
+static node_t * shareNode(node_set_t * set, node_t * node)
+{
+    if (set->capacity > 0){
+        size_t slot = nodeKeyHash(node) & (set->capacity - 1);
+
+        while (set->slots[slot] != NULL){
+            if (nodeKeyEqual(set->slots[slot], node)){
+                /* children are unique nodes owned by the set, only this node is a duplicate */
+                exprDelNode(node);
+                statsCount(STAT_MEMO_HITS, 1);
+
+                return set->slots[slot];
+            }
+
+            slot = (slot + 1) & (set->capacity - 1);
+        }
+    }
+
+    nodeSetInsert(set, node);
+
+    return node;
+}
+
+static void shareTrees(hessian_t * hessian)
+{
+    node_set_t set = {};
+
+    size_t var_num = hessian->var_num;
+
+    for (size_t row = 0; row < var_num; row++)
+        hessian->gradient[row] = shareTree(&set, hessian->gradient[row]);
+
+    if (hessian->hessian != NULL){
+        for (size_t row = 0; row < var_num; row++){
+            for (size_t col = row; col < var_num; col++){
+                node_t * entry = shareTree(&set, hessian->hessian[row * var_num + col]);
+
+                hessian->hessian[row * var_num + col] = entry;
+                hessian->hessian[col * var_num + row] = entry;
+            }
+        }
+    }
+
+    hessian->nodes = (node_t **)calloc(set.size + 1, sizeof(node_t *));
+    hessian->nodes_num = 0;
+
+    for (size_t slot = 0; slot < set.capacity; slot++)
+        if (set.slots[slot] != NULL)
+            hessian->nodes[hessian->nodes_num++] = set.slots[slot];
+
+    free(set.slots);
+}
+
+/// simplified derivative or NULL if it is zero, failed is set if the expression has no derivative rule
+static node_t * makeEntry(diff_t * diff, node_t * expr_node, unsigned int var_index, bool * failed)
+{
+    if (*failed)
+        return NULL;
+
+    if (derivativeSize(expr_node, var_index) == SIZE_MAX){
+        logPrint(LOG_RELEASE, "cannot differentiate by variable '%s': expression has no derivative rule\n",
+                              diff->var_names[var_index]);
+        *failed = true;
+
+        return NULL;
+    }
+
+    node_t * derivative = makeDerivative(diff, expr_node, var_index);
+    derivative = simplifyExpression(derivative);
+
+    if (type_(derivative) == NUM && val_(derivative).number == 0.){
+        exprDestroy(derivative);
+        return NULL;
+    }
+
+    return derivative;
+}
+
+/// destroys not yet shared entries and makes the result empty
+static void destroyEntries(hessian_t * hessian)
+{
+    size_t var_num = hessian->var_num;
+
+    for (size_t row = 0; row < var_num; row++)
+        exprDestroy(hessian->gradient[row]);
+
+    /* only upper triangle is filled before sharing */
+    if (hessian->hessian != NULL){
+        for (size_t row = 0; row < var_num; row++)
+            for (size_t col = row; col < var_num; col++)
+                exprDestroy(hessian->hessian[row * var_num + col]);
+    }
+
+    free(hessian->gradient);
+    free(hessian->hessian);
+
+    *hessian = {};
+}
+
+/// variables of the expression that are in vars (all if vars is NULL)
+static bool * selectVars(node_t * expr_node, const bool * vars, size_t var_num)
+{
+    bool * selected = (bool *)calloc(var_num + 1, sizeof(bool));
+    collectVars(expr_node, selected);
+
+    if (vars != NULL)
+        for (size_t var_index = 0; var_index < var_num; var_index++)
+            selected[var_index] = selected[var_index] && vars[var_index];
+
+    return selected;
+}
+
+hessian_t makeGradient(diff_t * diff, node_t * expr_node, const bool * vars)
+{
+    assert(diff);
+    assert(expr_node);
+
+    hessian_t hessian = {};
+
+    size_t var_num = diff->var_num;
+
+    hessian.var_num  = var_num;
+    hessian.gradient = (node_t **)calloc(var_num + 1, sizeof(node_t *));
+
+    bool * vars_in_expr = selectVars(expr_node, vars, var_num);
+
+    bool failed = false;
+
+    /* derivative by variable that is not in the expression is zero */
+    for (unsigned int var_index = 0; var_index < var_num; var_index++){
+        if (!vars_in_expr[var_index])
+            continue;
+
+        hessian.gradient[var_index] = makeEntry(diff, expr_node, var_index, &failed);
+
+        if (hessian.gradient[var_index] != NULL)
+            hessian.gradient_nonzero++;
+    }
+
+    free(vars_in_expr);
+
+    if (failed){
+        destroyEntries(&hessian);
+        return hessian;
+    }
+
+    shareTrees(&hessian);
+
+    return hessian;
+}
+
+hessian_t makeHessian(diff_t * diff, node_t * expr_node, const bool * vars)
+{
+    assert(diff);
+    assert(expr_node);
+
+    hessian_t hessian = {};
+
+    size_t var_num = diff->var_num;
+
+    hessian.var_num  = var_num;
+    hessian.gradient = (node_t **)calloc(var_num + 1, sizeof(node_t *));
+    hessian.hessian  = (node_t **)calloc(var_num * var_num + 1, sizeof(node_t *));
+
+    bool * vars_in_expr = selectVars(expr_node, vars, var_num);
+
+    bool failed = false;
+
+    for (unsigned int var_index = 0; var_index < var_num; var_index++){
+        if (vars_in_expr[var_index])
+            hessian.gradient[var_index] = makeEntry(diff, expr_node, var_index, &failed);
+    }
+
+    /* depends[i * var_num + j] - gradient[i] depends on x_j */
+    bool * depends = (bool *)calloc(var_num * var_num + 1, sizeof(bool));
+    size_t * sizes = (size_t *)calloc(var_num + 1, sizeof(size_t));
+
+    for (size_t row = 0; row < var_num; row++){
+        if (hessian.gradient[row] == NULL)
+            continue;
+
+        hessian.gradient_nonzero++;
+
+        collectVars(hessian.gradient[row], depends + row * var_num);
+        sizes[row] = treeSize(hessian.gradient[row]);
+    }
+
+    for (size_t row = 0; row < var_num; row++){
+        for (size_t col = row; col < var_num; col++){
+            /* d2f/dxi dxj = d2f/dxj dxi so it is zero if any of gradient components does not depend on other variable */
+            if (!depends[row * var_num + col] || !depends[col * var_num + row])
+                continue;
+
+            /* differentiating smaller gradient component */
+            node_t * entry = (sizes[row] <= sizes[col]) ? makeEntry(diff, hessian.gradient[row], (unsigned int)col, &failed)
+                                                         : makeEntry(diff, hessian.gradient[col], (unsigned int)row, &failed);
+
+            hessian.hessian[row * var_num + col] = entry;
+
+            if (entry != NULL)
+                hessian.hessian_nonzero++;
+        }
+    }
+
+    free(sizes);
+    free(depends);
+    free(vars_in_expr);
+
+    if (failed){
+        destroyEntries(&hessian);
+        return hessian;
+    }
+
+    shareTrees(&hessian);
+
+    logPrint(LOG_DEBUG, "hessian of %zu variables: %zu nonzero gradient components, %zu nonzero entries in upper triangle, "
+                        "%zu unique nodes\n", var_num, hessian.gradient_nonzero, hessian.hessian_nonzero, hessian.nodes_num);
+
+    return hessian;
+}
+
+void hessianDtor(hessian_t * hessian)
+{
+    assert(hessian);
+
+    for (size_t node_index = 0; node_index < hessian->nodes_num; node_index++)
+        exprDelNode(hessian->nodes[node_index]);
+
+    free(hessian->nodes);
+    free(hessian->gradient);
+    free(hessian->hessian);
+
+    *hessian = {};
+}
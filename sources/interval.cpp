@@ -0,0 +1,659 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "interval.h"
+#include "differ.h"
+#include "bintree.h"
+#include "trav_stack.h"
+#include "logger.h"
+
+static const double PI = 3.14159265358979323846;
+
+/// relative slack used when looking for extremums and poles, makes enclosures only wider
+static const double PERIOD_EPS = 1e-12;
+
+static const interval_t EMPTY_INTERVAL  = {NAN, NAN};
+static const interval_t ENTIRE_INTERVAL = {-INFINITY, INFINITY};
+
+static interval_t roundOut(interval_t interval);
+
+static double mulBound(double first, double second);
+
+static bool containsPeriodicPoint(interval_t interval, double offset, double period);
+
+static interval_t mulInterval(interval_t left, interval_t right);
+
+static interval_t divInterval(interval_t left, interval_t right);
+
+static interval_t powInterval(interval_t base, interval_t exponent);
+
+static interval_t intPowInterval(interval_t base, long int exponent);
+
+static interval_t realPowInterval(interval_t base, interval_t exponent);
+
+static interval_t joinInterval(interval_t first, interval_t second);
+
+static interval_t sinInterval(interval_t arg);
+
+static interval_t cosInterval(interval_t arg);
+
+static interval_t tanInterval(interval_t arg);
+
+static interval_t lnInterval(interval_t arg);
+
+static interval_t facInterval(interval_t arg);
+
+interval_t intervalMake(double lo, double hi)
+{
+    interval_t interval = {};
+
+    interval.lo = lo;
+    interval.hi = hi;
+
+    return interval;
+}
+
+bool intervalIsEmpty(interval_t interval)
+{
+    return isnan(interval.lo) || isnan(interval.hi) || interval.lo > interval.hi;
+}
+
+static interval_t roundOut(interval_t interval)
+{
+    if (intervalIsEmpty(interval))
+        return EMPTY_INTERVAL;
+
+    interval.lo = nextafter(interval.lo, -INFINITY);
+    interval.hi = nextafter(interval.hi,  INFINITY);
+
+    return interval;
+}
+
+/* 0 * inf is 0 for bounds because bound 0 is reached only in point 0 */
+static double mulBound(double first, double second)
+{
+    if (first == 0. || second == 0.)
+        return 0.;
+
+    return first * second;
+}
+
+interval_t calcOperInterval(enum oper op_num, interval_t left, interval_t right)
+{
+    if (intervalIsEmpty(left))
+        return EMPTY_INTERVAL;
+
+    if (opers[op_num].binary && intervalIsEmpty(right))
+        return EMPTY_INTERVAL;
+
+    switch (op_num){
+        case ADD:
+            return roundOut(intervalMake(left.lo + right.lo, left.hi + right.hi));
+
+        case SUB:
+            return roundOut(intervalMake(left.lo - right.hi, left.hi - right.lo));
+
+        case MUL:
+            return mulInterval(left, right);
+
+        case DIV:
+            return divInterval(left, right);
+
+        case POW:
+            return powInterval(left, right);
+
+        case SIN:
+            return sinInterval(left);
+
+        case COS:
+            return cosInterval(left);
+
+        case TAN:
+            return tanInterval(left);
+
+        case LN:
+            return lnInterval(left);
+
+        case LOG:
+            return divInterval(lnInterval(right), lnInterval(left));
+
+        case FAC:
+            return facInterval(left);
+
+        default:
+            fprintf(stderr, "CANNOT CALCULATE THIS OPERATION ON INTERVALS: %d\n", op_num);
+            exit(1);
+    }
+}
+
+interval_t evaluateInterval(diff_t * diff, node_t * node, const interval_t * var_ranges)
+{
+    assert(diff);
+    assert(node);
+    assert(var_ranges);
+
+    trav_stack_t<trav_frame_t> frames;
+    trav_stack_t<interval_t> values;
+
+    stackInit(&frames);
+    stackInit(&values);
+
+    stackPush(&frames, {node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node = frame.node;
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        if (type_(node) == NUM){
+            stackPush(&values, intervalMake(val_(node).number, val_(node).number));
+            continue;
+        }
+
+        if (type_(node) == VAR){
+            stackPush(&values, var_ranges[val_(node).var]);
+            continue;
+        }
+
+        enum oper op_num = val_(node).op;
+
+        if (!frame.expanded){
+            stackPush(&frames, {node, true});
+
+            if (opers[op_num].binary)
+                stackPush(&frames, {node->right, false});
+
+            stackPush(&frames, {node->left, false});
+            continue;
+        }
+
+        interval_t right = opers[op_num].binary ? stackPop(&values) : EMPTY_INTERVAL;
+        interval_t left  = stackPop(&values);
+
+        stackPush(&values, calcOperInterval(op_num, left, right));
+    }
+
+    interval_t result = stackPop(&values);
+
+    stackDtor(&frames);
+    stackDtor(&values);
+
+    return result;
+}
+
+static interval_t mulInterval(interval_t left, interval_t right)
+{
+    double products[] = {
+        mulBound(left.lo, right.lo),
+        mulBound(left.lo, right.hi),
+        mulBound(left.hi, right.lo),
+        mulBound(left.hi, right.hi)
+    };
+
+    interval_t result = intervalMake(products[0], products[0]);
+
+    for (size_t index = 1; index < sizeof(products) / sizeof(*products); index++){
+        result.lo = fmin(result.lo, products[index]);
+        result.hi = fmax(result.hi, products[index]);
+    }
+
+    return roundOut(result);
+}
+
+static interval_t divInterval(interval_t left, interval_t right)
+{
+    /* x / 0 is undefined everywhere */
+    if (right.lo == 0. && right.hi == 0.)
+        return EMPTY_INTERVAL;
+
+    /* pole inside of the divisor */
+    if (right.lo <= 0. && right.hi >= 0.)
+        return ENTIRE_INTERVAL;
+
+    interval_t reciprocal = roundOut(intervalMake(1. / right.hi, 1. / right.lo));
+
+    return mulInterval(left, reciprocal);
+}
+
+static interval_t intPowInterval(interval_t base, long int exponent)
+{
+    if (exponent == 0)
+        return intervalMake(1., 1.);
+
+    if (exponent < 0)
+        return divInterval(intervalMake(1., 1.), intPowInterval(base, -exponent));
+
+    double lo_pow = pow(base.lo, (double)exponent);
+    double hi_pow = pow(base.hi, (double)exponent);
+
+    /* odd power is monotonic */
+    if (exponent % 2 == 1)
+        return roundOut(intervalMake(lo_pow, hi_pow));
+
+    if (base.lo >= 0.)
+        return roundOut(intervalMake(lo_pow, hi_pow));
+
+    if (base.hi <= 0.)
+        return roundOut(intervalMake(hi_pow, lo_pow));
+
+    return roundOut(intervalMake(0., fmax(lo_pow, hi_pow)));
+}
+
+/// smallest interval containing both, empty ones are ignored
+static interval_t joinInterval(interval_t first, interval_t second)
+{
+    if (intervalIsEmpty(first))
+        return second;
+
+    if (intervalIsEmpty(second))
+        return first;
+
+    return intervalMake(fmin(first.lo, second.lo), fmax(first.hi, second.hi));
+}
+
+static interval_t powInterval(interval_t base, interval_t exponent)
+{
+    const double MAX_INT_EXPONENT = 1 << 20;
+
+    /* negative base has real powers only with integer exponents, they are joined one by one */
+    const double MAX_JOINED_EXPONENTS = 64;
+
+    if (exponent.lo == exponent.hi && exponent.lo == floor(exponent.lo) && fabs(exponent.lo) < MAX_INT_EXPONENT)
+        return intPowInterval(base, (long int)exponent.lo);
+
+    if (base.lo >= 0.)
+        return realPowInterval(base, exponent);
+
+    interval_t result = (base.hi >= 0.) ? realPowInterval(intervalMake(0., base.hi), exponent) : EMPTY_INTERVAL;
+
+    double first_int = ceil (exponent.lo);
+    double last_int  = floor(exponent.hi);
+
+    /* no integer exponent, only non-negative part of the base counts */
+    if (first_int > last_int)
+        return result;
+
+    if (last_int - first_int >= MAX_JOINED_EXPONENTS || fmax(fabs(first_int), fabs(last_int)) >= MAX_INT_EXPONENT)
+        return ENTIRE_INTERVAL;
+
+    interval_t negative_base = intervalMake(base.lo, fmin(base.hi, 0.));
+
+    for (double int_exponent = first_int; int_exponent <= last_int; int_exponent++)
+        result = joinInterval(result, intPowInterval(negative_base, (long int)int_exponent));
+
+    return result;
+}
+
+/// power of non-negative base
+static interval_t realPowInterval(interval_t base, interval_t exponent)
+{
+    /* for positive base pow is monotonic in both arguments so extremums are in corners */
+    double corners[] = {
+        pow(base.lo, exponent.lo),
+        pow(base.lo, exponent.hi),
+        pow(base.hi, exponent.lo),
+        pow(base.hi, exponent.hi)
+    };
+
+    interval_t result = intervalMake(corners[0], corners[0]);
+
+    for (size_t index = 1; index < sizeof(corners) / sizeof(*corners); index++){
+        result.lo = fmin(result.lo, corners[index]);
+        result.hi = fmax(result.hi, corners[index]);
+    }
+
+    return roundOut(result);
+}
+
+/// checks if there is a point offset + k * period in the interval (with slack)
+static bool containsPeriodicPoint(interval_t interval, double offset, double period)
+{
+    double slack = PERIOD_EPS * fmax(1., fmax(fabs(interval.lo), fabs(interval.hi)));
+
+    double k = ceil((interval.lo - slack - offset) / period);
+    double point = offset + k * period;
+
+    return point <= interval.hi + slack;
+}
+
+static interval_t sinInterval(interval_t arg)
+{
+    if (isinf(arg.lo) || isinf(arg.hi) || arg.hi - arg.lo >= 2 * PI)
+        return intervalMake(-1., 1.);
+
+    double lo_sin = sin(arg.lo);
+    double hi_sin = sin(arg.hi);
+
+    interval_t result = roundOut(intervalMake(fmin(lo_sin, hi_sin), fmax(lo_sin, hi_sin)));
+
+    if (containsPeriodicPoint(arg, PI / 2, 2 * PI))
+        result.hi = 1.;
+
+    if (containsPeriodicPoint(arg, -PI / 2, 2 * PI))
+        result.lo = -1.;
+
+    result.lo = fmax(result.lo, -1.);
+    result.hi = fmin(result.hi,  1.);
+
+    return result;
+}
+
+static interval_t cosInterval(interval_t arg)
+{
+    if (isinf(arg.lo) || isinf(arg.hi) || arg.hi - arg.lo >= 2 * PI)
+        return intervalMake(-1., 1.);
+
+    double lo_cos = cos(arg.lo);
+    double hi_cos = cos(arg.hi);
+
+    interval_t result = roundOut(intervalMake(fmin(lo_cos, hi_cos), fmax(lo_cos, hi_cos)));
+
+    if (containsPeriodicPoint(arg, 0., 2 * PI))
+        result.hi = 1.;
+
+    if (containsPeriodicPoint(arg, PI, 2 * PI))
+        result.lo = -1.;
+
+    result.lo = fmax(result.lo, -1.);
+    result.hi = fmin(result.hi,  1.);
+
+    return result;
+}
+
+static interval_t tanInterval(interval_t arg)
+{
+    if (isinf(arg.lo) || isinf(arg.hi) || arg.hi - arg.lo >= PI)
+        return ENTIRE_INTERVAL;
+
+    /* pole pi/2 + k*pi inside */
+    if (containsPeriodicPoint(arg, PI / 2, PI))
+        return ENTIRE_INTERVAL;
+
+    return roundOut(intervalMake(tan(arg.lo), tan(arg.hi)));
+}
+
+static interval_t lnInterval(interval_t arg)
+{
+    if (arg.hi <= 0.)
+        return EMPTY_INTERVAL;
+
+    double lo_ln = (arg.lo <= 0.) ? -INFINITY : log(arg.lo);
+
+    return roundOut(intervalMake(lo_ln, log(arg.hi)));
+}
+
+static interval_t facInterval(interval_t arg)
+{
+    if (arg.hi < 0.)
+        return EMPTY_INTERVAL;
+
+    double lo_arg = floor(fmax(arg.lo, 0.));
+    double hi_arg = floor(arg.hi);
+
+    double lo_fac = (lo_arg > MAX_FACTORIAL_ARG) ? INFINITY : factorial((long unsigned int)lo_arg);
+    double hi_fac = (hi_arg > MAX_FACTORIAL_ARG) ? INFINITY : factorial((long unsigned int)hi_arg);
+
+    return intervalMake(lo_fac, hi_fac);
+}
+
+/*------------------------------------------------------------------------------------------*/
+
+typedef struct {
+    interval_t box;
+    double upper;
+} bb_box_t;
+
+typedef struct {
+    bb_box_t * boxes;
+    size_t size;
+    size_t capacity;
+} bb_heap_t;
+
+static void heapPush(bb_heap_t * heap, bb_box_t box);
+
+static bb_box_t heapPop(bb_heap_t * heap);
+
+static void heapPush(bb_heap_t * heap, bb_box_t box)
+{
+    assert(heap);
+
+    if (heap->size == heap->capacity){
+        heap->capacity = (heap->capacity == 0) ? 64 : heap->capacity * 2;
+        heap->boxes = (bb_box_t *)realloc(heap->boxes, heap->capacity * sizeof(bb_box_t));
+    }
+
+    size_t index = heap->size++;
+
+    while (index > 0){
+        size_t parent = (index - 1) / 2;
+
+        if (heap->boxes[parent].upper >= box.upper)
+            break;
+
+        heap->boxes[index] = heap->boxes[parent];
+        index = parent;
+    }
+
+    heap->boxes[index] = box;
+}
+
+static bb_box_t heapPop(bb_heap_t * heap)
+{
+    assert(heap);
+    assert(heap->size > 0);
+
+    bb_box_t top  = heap->boxes[0];
+    bb_box_t last = heap->boxes[--heap->size];
+
+    size_t index = 0;
+
+    while (2 * index + 1 < heap->size){
+        size_t child = 2 * index + 1;
+
+        if (child + 1 < heap->size && heap->boxes[child + 1].upper > heap->boxes[child].upper)
+            child++;
+
+        if (last.upper >= heap->boxes[child].upper)
+            break;
+
+        heap->boxes[index] = heap->boxes[child];
+        index = child;
+    }
+
+    if (heap->size > 0)
+        heap->boxes[index] = last;
+
+    return top;
+}
+
+static interval_t * makeVarRanges(diff_t * diff, unsigned int var_index);
+
+static interval_t signedInterval(interval_t interval, double sign);
+
+static interval_t boundMaximum(diff_t * diff, node_t * node, interval_t * ranges, unsigned int var_index,
+                               interval_t domain, double tolerance, size_t max_evals, double sign, size_t * evals);
+
+static interval_t * makeVarRanges(diff_t * diff, unsigned int var_index)
+{
+    assert(diff);
+
+    size_t ranges_num = (var_index < diff->var_num) ? diff->var_num : var_index + 1;
+    interval_t * ranges = (interval_t *)calloc(ranges_num, sizeof(interval_t));
+
+    for (size_t index = 0; index < diff->var_num; index++)
+        ranges[index] = intervalMake(diff->var_values[index], diff->var_values[index]);
+
+    return ranges;
+}
+
+static interval_t signedInterval(interval_t interval, double sign)
+{
+    if (sign > 0)
+        return interval;
+
+    return intervalMake(-interval.hi, -interval.lo);
+}
+
+/// finds enclosure of max(sign * f) over domain, best-first branch and bound
+static interval_t boundMaximum(diff_t * diff, node_t * node, interval_t * ranges, unsigned int var_index,
+                               interval_t domain, double tolerance, size_t max_evals, double sign, size_t * evals)
+{
+    bb_heap_t heap = {};
+
+    double best_lower   = -INFINITY;
+    double upper_bound  = -INFINITY;
+
+    size_t evals_limit = *evals + max_evals;
+
+    ranges[var_index] = domain;
+    interval_t start_enclosure = signedInterval(evaluateInterval(diff, node, ranges), sign);
+    (*evals)++;
+
+    if (intervalIsEmpty(start_enclosure))
+        return start_enclosure;
+
+    bb_box_t start = {.box = domain, .upper = start_enclosure.hi};
+    heapPush(&heap, start);
+
+    while (heap.size > 0){
+        bb_box_t cur = heapPop(&heap);
+
+        /* all other boxes in heap have less upper bound */
+        if (cur.upper <= best_lower)
+            break;
+
+        double mid = cur.box.lo + (cur.box.hi - cur.box.lo) / 2;
+
+        if (cur.upper - best_lower <= tolerance || *evals >= evals_limit){
+            upper_bound = fmax(upper_bound, cur.upper);
+            break;
+        }
+
+        /* box cannot be split anymore */
+        if (mid <= cur.box.lo || mid >= cur.box.hi){
+            upper_bound = fmax(upper_bound, cur.upper);
+            continue;
+        }
+
+        interval_t halves[] = {
+            intervalMake(cur.box.lo, mid),
+            intervalMake(mid, cur.box.hi)
+        };
+
+        for (size_t half_index = 0; half_index < sizeof(halves) / sizeof(*halves); half_index++){
+            interval_t half = halves[half_index];
+
+            ranges[var_index] = half;
+            interval_t enclosure = signedInterval(evaluateInterval(diff, node, ranges), sign);
+
+            double half_mid = half.lo + (half.hi - half.lo) / 2;
+            ranges[var_index] = intervalMake(half_mid, half_mid);
+            interval_t point = signedInterval(evaluateInterval(diff, node, ranges), sign);
+
+            *evals += 2;
+
+            if (intervalIsEmpty(enclosure))
+                continue;
+
+            if (!intervalIsEmpty(point))
+                best_lower = fmax(best_lower, point.lo);
+
+            if (enclosure.hi > best_lower){
+                bb_box_t new_box = {.box = half, .upper = enclosure.hi};
+                heapPush(&heap, new_box);
+            }
+        }
+    }
+
+    free(heap.boxes);
+
+    upper_bound = fmax(upper_bound, best_lower);
+
+    return intervalMake(best_lower, upper_bound);
+}
+
+range_bounds_t findRangeBounds(diff_t * diff, node_t * node, unsigned int var_index,
+                               interval_t domain, double tolerance, size_t max_evals)
+{
+    assert(diff);
+    assert(node);
+
+    range_bounds_t bounds = {};
+
+    interval_t * ranges = makeVarRanges(diff, var_index);
+
+    interval_t max_enclosure = boundMaximum(diff, node, ranges, var_index, domain, tolerance, max_evals,  1., &(bounds.evaluations));
+    interval_t min_enclosure = boundMaximum(diff, node, ranges, var_index, domain, tolerance, max_evals, -1., &(bounds.evaluations));
+
+    bounds.max = max_enclosure;
+    bounds.min = signedInterval(min_enclosure, -1.);
+
+    free(ranges);
+
+    logPrint(LOG_DEBUG, "range bounds on [%lg, %lg]: min in [%lg, %lg], max in [%lg, %lg], %zu evaluations\n",
+                        domain.lo, domain.hi, bounds.min.lo, bounds.min.hi, bounds.max.lo, bounds.max.hi, bounds.evaluations);
+
+    return bounds;
+}
+
+size_t findRootFreeRegions(diff_t * diff, node_t * node, unsigned int var_index, interval_t domain,
+                           double min_width, interval_t * regions, size_t max_regions)
+{
+    assert(diff);
+    assert(node);
+    assert(regions);
+
+    interval_t * ranges = makeVarRanges(diff, var_index);
+
+    size_t stack_capacity = 64;
+    size_t stack_size = 0;
+    interval_t * stack = (interval_t *)calloc(stack_capacity, sizeof(interval_t));
+
+    stack[stack_size++] = domain;
+
+    size_t regions_num = 0;
+
+    while (stack_size > 0){
+        interval_t box = stack[--stack_size];
+
+        ranges[var_index] = box;
+        interval_t enclosure = evaluateInterval(diff, node, ranges);
+
+        /* 0 is not in the enclosure (or function is undefined) */
+        if (intervalIsEmpty(enclosure) || enclosure.lo > 0. || enclosure.hi < 0.){
+            if (regions_num > 0 && regions[regions_num - 1].hi == box.lo)
+                regions[regions_num - 1].hi = box.hi;
+
+            else if (regions_num < max_regions)
+                regions[regions_num++] = box;
+
+            else
+                break;
+
+            continue;
+        }
+
+        double mid = box.lo + (box.hi - box.lo) / 2;
+
+        if (box.hi - box.lo <= min_width || mid <= box.lo || mid >= box.hi)
+            continue;
+
+        if (stack_size + 2 > stack_capacity){
+            stack_capacity *= 2;
+            stack = (interval_t *)realloc(stack, stack_capacity * sizeof(interval_t));
+        }
+
+        /* left half is processed first so regions are sorted */
+        stack[stack_size++] = intervalMake(mid, box.hi);
+        stack[stack_size++] = intervalMake(box.lo, mid);
+    }
+
+    free(stack);
+    free(ranges);
+
+    return regions_num;
+}
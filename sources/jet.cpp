@@ -0,0 +1,502 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+#include "jet.h"
+#include "differ.h"
+#include "bintree.h"
+#include "trav_stack.h"
+#include "stats.h"
+
+/// jets for intermediate results of composite operations
+static const size_t TEMP_JETS = 4;
+
+/// points evaluated by one task of evaluateWithDerivativesBatch()
+static const size_t POINTS_PER_TASK = 64;
+
+/// @brief state of jet evaluation, every jet is value, gradient (var_num) and upper triangle of hessian (row by row)
+typedef struct {
+    size_t var_num;
+    size_t order;
+    size_t jet_size;
+
+    double * stack;             ///< jets of operands waiting for their operation
+    size_t stack_size;          ///< in jets
+    size_t stack_capacity;
+
+    double * temps;
+} jet_ctx_t;
+
+/// shared state of evaluateWithDerivativesBatch() tasks
+typedef struct {
+    node_t * expr_node;
+    const double * points;
+    size_t points_num;
+    size_t var_num;
+
+    double * values;
+    double * gradients;
+    double * hessians;
+
+    jet_ctx_t * ctxs;           ///< one for every thread
+} batch_ctx_t;
+
+static jet_ctx_t jetCtxCtor(size_t var_num, size_t order);
+
+static void jetCtxDtor(jet_ctx_t * ctx);
+
+static double * jetPush(jet_ctx_t * ctx);
+
+static void jetConst(const jet_ctx_t * ctx, double * jet, double value);
+
+static void jetVar(const jet_ctx_t * ctx, double * jet, double value, unsigned int var_index);
+
+static void jetFill(const jet_ctx_t * ctx, double * jet, double value, double derivative);
+
+static bool jetIsConst(const jet_ctx_t * ctx, const double * jet);
+
+static void jetAddSub(const jet_ctx_t * ctx, double * res, const double * u, const double * v, double sign);
+
+static void jetMul(const jet_ctx_t * ctx, double * res, const double * u, const double * v);
+
+static void jetChain(const jet_ctx_t * ctx, double * res, const double * u, double f0, double f1, double f2);
+
+static void jetOper(jet_ctx_t * ctx, enum oper op_num, double * res, const double * u, const double * v);
+
+static const double * jetEvaluate(jet_ctx_t * ctx, node_t * node, const double * point);
+
+static void writeDerivs(const jet_ctx_t * ctx, const double * jet, double * gradient, double * hessian);
+
+static void batchTask(void * context, size_t task_index, size_t thread_index);
+
+static jet_ctx_t jetCtxCtor(size_t var_num, size_t order)
+{
+    assert(order <= MAX_JET_ORDER);
+
+    jet_ctx_t ctx = {};
+
+    ctx.var_num  = var_num;
+    ctx.order    = order;
+    ctx.jet_size = 1 + ((order >= 1) ? var_num : 0) + ((order >= 2) ? var_num * (var_num + 1) / 2 : 0);
+
+    ctx.stack_capacity = 32;
+    ctx.stack = (double *)calloc(ctx.stack_capacity * ctx.jet_size, sizeof(double));
+    ctx.temps = (double *)calloc(TEMP_JETS * ctx.jet_size, sizeof(double));
+
+    return ctx;
+}
+
+static void jetCtxDtor(jet_ctx_t * ctx)
+{
+    free(ctx->stack);
+    free(ctx->temps);
+
+    *ctx = {};
+}
+
+/// new jet on the top of the stack, pointers to older jets are invalid after it
+static double * jetPush(jet_ctx_t * ctx)
+{
+    if (ctx->stack_size == ctx->stack_capacity){
+        ctx->stack_capacity *= 2;
+        ctx->stack = (double *)realloc(ctx->stack, ctx->stack_capacity * ctx->jet_size * sizeof(double));
+    }
+
+    return ctx->stack + (ctx->stack_size++) * ctx->jet_size;
+}
+
+static void jetConst(const jet_ctx_t * ctx, double * jet, double value)
+{
+    jetFill(ctx, jet, value, 0.);
+}
+
+static void jetVar(const jet_ctx_t * ctx, double * jet, double value, unsigned int var_index)
+{
+    jetFill(ctx, jet, value, 0.);
+
+    if (ctx->order >= 1)
+        jet[1 + var_index] = 1.;
+}
+
+/// value and the same number in all derivatives
+static void jetFill(const jet_ctx_t * ctx, double * jet, double value, double derivative)
+{
+    jet[0] = value;
+
+    for (size_t index = 1; index < ctx->jet_size; index++)
+        jet[index] = derivative;
+}
+
+static bool jetIsConst(const jet_ctx_t * ctx, const double * jet)
+{
+    for (size_t index = 1; index < ctx->jet_size; index++)
+        if (jet[index] != 0.)
+            return false;
+
+    return true;
+}
+
+static void jetAddSub(const jet_ctx_t * ctx, double * res, const double * u, const double * v, double sign)
+{
+    for (size_t index = 0; index < ctx->jet_size; index++)
+        res[index] = u[index] + sign * v[index];
+}
+
+/// res must not be u or v
+static void jetMul(const jet_ctx_t * ctx, double * res, const double * u, const double * v)
+{
+    size_t var_num = ctx->var_num;
+
+    res[0] = u[0] * v[0];
+
+    if (ctx->order < 1)
+        return;
+
+    const double * u_grad = u + 1;
+    const double * v_grad = v + 1;
+
+    for (size_t var = 0; var < var_num; var++)
+        res[1 + var] = u_grad[var] * v[0] + u[0] * v_grad[var];
+
+    if (ctx->order < 2)
+        return;
+
+    const double * u_hess = u_grad + var_num;
+    const double * v_hess = v_grad + var_num;
+    double * res_hess = res + 1 + var_num;
+
+    size_t pair = 0;
+
+    for (size_t row = 0; row < var_num; row++){
+        for (size_t col = row; col < var_num; col++, pair++){
+            res_hess[pair] = u_hess[pair] * v[0] + u_grad[row] * v_grad[col]
+                           + u_grad[col] * v_grad[row] + u[0] * v_hess[pair];
+        }
+    }
+}
+
+/// res = f(u) where f0, f1, f2 are f, f' and f'' at the value of u, res can be u
+static void jetChain(const jet_ctx_t * ctx, double * res, const double * u, double f0, double f1, double f2)
+{
+    size_t var_num = ctx->var_num;
+
+    /* hessian first: it needs gradient of u */
+    if (ctx->order >= 2){
+        const double * u_grad = u + 1;
+        const double * u_hess = u_grad + var_num;
+        double * res_hess = res + 1 + var_num;
+
+        size_t pair = 0;
+
+        for (size_t row = 0; row < var_num; row++)
+            for (size_t col = row; col < var_num; col++, pair++)
+                res_hess[pair] = f1 * u_hess[pair] + f2 * u_grad[row] * u_grad[col];
+    }
+
+    if (ctx->order >= 1){
+        for (size_t var = 0; var < var_num; var++)
+            res[1 + var] = f1 * u[1 + var];
+    }
+
+    res[0] = f0;
+}
+
+/// res = op(u, v), res must not be u or v, v is NULL for unary operations
+static void jetOper(jet_ctx_t * ctx, enum oper op_num, double * res, const double * u, const double * v)
+{
+    double * temp_first  = ctx->temps;
+    double * temp_second = ctx->temps + ctx->jet_size;
+    double * temp_third  = ctx->temps + 2 * ctx->jet_size;
+
+    double u0 = u[0];
+    double v0 = (v != NULL) ? v[0] : 0.;
+
+    switch (op_num){
+        case ADD:
+            jetAddSub(ctx, res, u, v,  1.);
+            break;
+
+        case SUB:
+            jetAddSub(ctx, res, u, v, -1.);
+            break;
+
+        case MUL:
+            jetMul(ctx, res, u, v);
+            break;
+
+        case DIV:
+            jetChain(ctx, temp_first, v, 1. / v0, -1. / (v0 * v0), 2. / (v0 * v0 * v0));
+            jetMul(ctx, res, u, temp_first);
+            break;
+
+        case POW: {
+            double value = pow(u0, v0);
+
+            /* the same cases as diffPow: constant exponent, constant base and general u^v = exp(v ln u) */
+            if (jetIsConst(ctx, v)){
+                double f1 = (v0 == 0.)              ? 0. : v0 * pow(u0, v0 - 1.);
+                double f2 = (v0 == 0. || v0 == 1.)  ? 0. : v0 * (v0 - 1.) * pow(u0, v0 - 2.);
+
+                jetChain(ctx, res, u, value, f1, f2);
+            }
+            else if (jetIsConst(ctx, u)){
+                double ln_base = log(u0);
+
+                jetChain(ctx, res, v, value, value * ln_base, value * ln_base * ln_base);
+            }
+            else {
+                jetChain(ctx, temp_first, u, log(u0), 1. / u0, -1. / (u0 * u0));
+                jetMul(ctx, temp_second, v, temp_first);
+                jetChain(ctx, res, temp_second, value, value, value);
+            }
+            break;
+        }
+
+        case SIN:
+            jetChain(ctx, res, u, sin(u0), cos(u0), -sin(u0));
+            break;
+
+        case COS:
+            jetChain(ctx, res, u, cos(u0), -sin(u0), -cos(u0));
+            break;
+
+        case TAN: {
+            double tangent = tan(u0);
+            double sec_sqr = 1. + tangent * tangent;
+
+            jetChain(ctx, res, u, tangent, sec_sqr, 2. * tangent * sec_sqr);
+            break;
+        }
+
+        case LN:
+            jetChain(ctx, res, u, log(u0), 1. / u0, -1. / (u0 * u0));
+            break;
+
+        case LOG: {
+            /* log_u(v) = ln(v) / ln(u) */
+            double ln_base = log(u0);
+
+            jetChain(ctx, temp_first,  v, log(v0),  1. / v0, -1. / (v0 * v0));
+            jetChain(ctx, temp_second, u, ln_base,  1. / u0, -1. / (u0 * u0));
+            jetChain(ctx, temp_third, temp_second, 1. / ln_base, -1. / (ln_base * ln_base), 2. / (ln_base * ln_base * ln_base));
+            jetMul(ctx, res, temp_first, temp_third);
+            break;
+        }
+
+        case FAC:
+            /* there is no rule for derivative of factorial */
+            jetFill(ctx, res, calcOper(FAC, u0, 0.), jetIsConst(ctx, u) ? 0. : NAN);
+            break;
+
+        default:
+            assert(0 && "unknown operation");
+            break;
+    }
+
+    /* value is the same as in evaluate() */
+    res[0] = calcOper(op_num, u0, v0);
+}
+
+/// returns jet of the tree, it is valid until the next evaluation with ctx
+static const double * jetEvaluate(jet_ctx_t * ctx, node_t * node, const double * point)
+{
+    trav_stack_t<trav_frame_t> frames;
+    stackInit(&frames);
+
+    ctx->stack_size = 0;
+
+    stackPush(&frames, {node, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node = frame.node;
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        switch (type_(node)){
+            case NUM:
+                jetConst(ctx, jetPush(ctx), val_(node).number);
+                break;
+
+            case VAR:
+                jetVar(ctx, jetPush(ctx), point[val_(node).var], val_(node).var);
+                break;
+
+            case OPR: {
+                enum oper op_num = val_(node).op;
+                bool binary = opers[op_num].binary;
+
+                if (!frame.expanded){
+                    stackPush(&frames, {node, true});
+
+                    if (binary)
+                        stackPush(&frames, {node->right, false});
+
+                    stackPush(&frames, {node->left, false});
+                    break;
+                }
+
+                /* operands are on the top of the stack, left is under right */
+                size_t operands_num = binary ? 2 : 1;
+                double * left  = ctx->stack + (ctx->stack_size - operands_num) * ctx->jet_size;
+                double * right = binary ? left + ctx->jet_size : NULL;
+
+                double * result = ctx->temps + (TEMP_JETS - 1) * ctx->jet_size;
+
+                jetOper(ctx, op_num, result, left, right);
+
+                memcpy(left, result, ctx->jet_size * sizeof(double));
+                ctx->stack_size -= operands_num - 1;
+                break;
+            }
+
+            default:
+                assert(0 && "unknown element type");
+                break;
+        }
+    }
+
+    stackDtor(&frames);
+
+    assert(ctx->stack_size == 1);
+
+    return ctx->stack;
+}
+
+/// unpacks derivatives of the jet, hessian is full symmetric matrix
+static void writeDerivs(const jet_ctx_t * ctx, const double * jet, double * gradient, double * hessian)
+{
+    size_t var_num = ctx->var_num;
+
+    if (gradient != NULL && ctx->order >= 1)
+        memcpy(gradient, jet + 1, var_num * sizeof(double));
+
+    if (hessian == NULL || ctx->order < 2)
+        return;
+
+    const double * packed = jet + 1 + var_num;
+    size_t pair = 0;
+
+    for (size_t row = 0; row < var_num; row++){
+        for (size_t col = row; col < var_num; col++, pair++){
+            hessian[row * var_num + col] = packed[pair];
+            hessian[col * var_num + row] = packed[pair];
+        }
+    }
+}
+
+eval_derivs_t evaluateWithDerivatives(diff_t * diff, node_t * expr_node, const double * point, size_t order)
+{
+    assert(diff);
+    assert(expr_node);
+    assert(order <= MAX_JET_ORDER);
+
+    statsCount(STAT_EVALUATIONS, 1);
+
+    if (point == NULL)
+        point = diff->var_values;
+
+    eval_derivs_t derivs = {};
+
+    derivs.var_num = diff->var_num;
+    derivs.order   = order;
+
+    if (order >= 1)
+        derivs.gradient = (double *)calloc(derivs.var_num + 1, sizeof(double));
+
+    if (order >= 2)
+        derivs.hessian  = (double *)calloc(derivs.var_num * derivs.var_num + 1, sizeof(double));
+
+    jet_ctx_t ctx = jetCtxCtor(derivs.var_num, order);
+
+    const double * jet = jetEvaluate(&ctx, expr_node, point);
+
+    derivs.value = jet[0];
+    writeDerivs(&ctx, jet, derivs.gradient, derivs.hessian);
+
+    jetCtxDtor(&ctx);
+
+    return derivs;
+}
+
+void evalDerivsDtor(eval_derivs_t * derivs)
+{
+    assert(derivs);
+
+    free(derivs->gradient);
+    free(derivs->hessian);
+
+    *derivs = {};
+}
+
+static void batchTask(void * context, size_t task_index, size_t thread_index)
+{
+    batch_ctx_t * batch = (batch_ctx_t *)context;
+    jet_ctx_t * ctx = batch->ctxs + thread_index;
+
+    size_t var_num = batch->var_num;
+
+    size_t first = task_index * POINTS_PER_TASK;
+    size_t last  = first + POINTS_PER_TASK;
+
+    if (last > batch->points_num)
+        last = batch->points_num;
+
+    for (size_t point_index = first; point_index < last; point_index++){
+        const double * jet = jetEvaluate(ctx, batch->expr_node, batch->points + point_index * var_num);
+
+        if (batch->values != NULL)
+            batch->values[point_index] = jet[0];
+
+        writeDerivs(ctx, jet, (batch->gradients != NULL) ? batch->gradients + point_index * var_num           : NULL,
+                              (batch->hessians  != NULL) ? batch->hessians  + point_index * var_num * var_num : NULL);
+    }
+}
+
+void evaluateWithDerivativesBatch(diff_t * diff, node_t * expr_node, const double * points, size_t points_num, size_t order,
+                                  double * values, double * gradients, double * hessians, thread_pool_t * pool)
+{
+    assert(diff);
+    assert(expr_node);
+    assert(points || points_num == 0);
+    assert(order <= MAX_JET_ORDER);
+
+    statsCount(STAT_EVALUATIONS, points_num);
+
+    /* tree is only read by threads */
+    expandAllDeferred(expr_node);
+
+    size_t threads_num = (pool != NULL) ? threadPoolSize(pool) : 1;
+
+    batch_ctx_t batch = {};
+
+    batch.expr_node  = expr_node;
+    batch.points     = points;
+    batch.points_num = points_num;
+    batch.var_num    = diff->var_num;
+    batch.values     = values;
+    batch.gradients  = gradients;
+    batch.hessians   = hessians;
+
+    batch.ctxs = (jet_ctx_t *)calloc(threads_num, sizeof(jet_ctx_t));
+
+    for (size_t thread_index = 0; thread_index < threads_num; thread_index++)
+        batch.ctxs[thread_index] = jetCtxCtor(batch.var_num, order);
+
+    size_t tasks_num = (points_num + POINTS_PER_TASK - 1) / POINTS_PER_TASK;
+
+    if (pool == NULL){
+        for (size_t task_index = 0; task_index < tasks_num; task_index++)
+            batchTask(&batch, task_index, 0);
+    }
+    else
+        threadPoolFor(pool, tasks_num, batchTask, &batch);
+
+    for (size_t thread_index = 0; thread_index < threads_num; thread_index++)
+        jetCtxDtor(batch.ctxs + thread_index);
+
+    free(batch.ctxs);
+}
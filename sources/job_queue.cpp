@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "job_queue.h"
+
+/// one pushed job
+typedef struct {
+    job_func_t func;
+    void * arg;
+} job_t;
+
+struct job_queue {
+    std::thread * workers = NULL;
+    size_t workers_num = 0;
+
+    std::mutex mutex = {};
+    std::condition_variable  push_cond = {};     ///< job is pushed or queue is stopping
+    std::condition_variable space_cond = {};     ///< job is taken
+    std::condition_variable  done_cond = {};     ///< job is done
+
+    job_t * jobs = NULL;                        ///< ring buffer of max_pending jobs
+    size_t max_pending = 0;
+    size_t first = 0;
+    size_t pending = 0;
+
+    size_t running = 0;
+    bool stopping = false;
+};
+
+static void workerLoop(job_queue_t * queue);
+
+job_queue_t * jobQueueCtor(size_t workers_num, size_t max_pending)
+{
+    assert(workers_num > 0);
+    assert(max_pending > 0);
+
+    job_queue_t * queue = new job_queue_t();
+
+    queue->max_pending = max_pending;
+    queue->jobs = (job_t *)calloc(max_pending, sizeof(job_t));
+
+    queue->workers_num = workers_num;
+    queue->workers = new std::thread[workers_num];
+
+    for (size_t worker_index = 0; worker_index < workers_num; worker_index++)
+        queue->workers[worker_index] = std::thread(workerLoop, queue);
+
+    return queue;
+}
+
+void jobQueueDtor(job_queue_t * queue)
+{
+    assert(queue);
+
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->stopping = true;
+    }
+    queue->push_cond.notify_all();
+
+    for (size_t worker_index = 0; worker_index < queue->workers_num; worker_index++)
+        queue->workers[worker_index].join();
+
+    free(queue->jobs);
+
+    delete [] queue->workers;
+    delete queue;
+}
+
+static void workerLoop(job_queue_t * queue)
+{
+    while (true){
+        job_t job = {};
+
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->push_cond.wait(lock, [&]{ return queue->stopping || queue->pending > 0; });
+
+            /* pending jobs are finished before stopping */
+            if (queue->pending == 0)
+                return;
+
+            job = queue->jobs[queue->first];
+
+            queue->first = (queue->first + 1) % queue->max_pending;
+            queue->pending--;
+            queue->running++;
+        }
+        queue->space_cond.notify_one();
+
+        job.func(job.arg);
+
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+
+            queue->running--;
+        }
+        queue->done_cond.notify_all();
+    }
+}
+
+void jobQueuePush(job_queue_t * queue, job_func_t func, void * arg)
+{
+    assert(queue);
+    assert(func);
+
+    {
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        queue->space_cond.wait(lock, [&]{ return queue->pending < queue->max_pending; });
+
+        queue->jobs[(queue->first + queue->pending) % queue->max_pending] = {func, arg};
+        queue->pending++;
+    }
+    queue->push_cond.notify_one();
+}
+
+void jobQueueWait(job_queue_t * queue)
+{
+    assert(queue);
+
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    queue->done_cond.wait(lock, [&]{ return queue->pending == 0 && queue->running == 0; });
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -9,11 +10,42 @@
 #include "logger.h"
 #include "eq_parser.h"
 #include "tex_dump.h"
+#include "trace.h"
+#include "graph_dump.h"
 
 const size_t BUFFER_LEN = 128;
 
-int main()
+const size_t LATEX_RUNS      = 2;
+const size_t TEX_MAX_PENDING = 64;
+
+/// command line options, everything that slows down the run is off by default
+typedef struct {
+    bool stats;     ///< --stats: counters and phase timers are written to logs/stats.json
+    bool trace;     ///< --trace: spans of all threads are written to logs/trace.json
+} options_t;
+
+static options_t parseOptions(int argc, const char * argv[]);
+
+static options_t parseOptions(int argc, const char * argv[])
+{
+    options_t options = {};
+
+    for (int arg_index = 1; arg_index < argc; arg_index++){
+        if (strcmp(argv[arg_index], "--stats") == 0)
+            options.stats = true;
+        else if (strcmp(argv[arg_index], "--trace") == 0)
+            options.trace = true;
+        else
+            fprintf(stderr, "unknown option '%s' is ignored\n", argv[arg_index]);
+    }
+
+    return options;
+}
+
+int main(int argc, const char * argv[])
 {
+    options_t options = parseOptions(argc, argv);
+
     mkdir("logs", 0777);
     logStart("logs/log.html", LOG_DEBUG, LOG_HTML);
     // logCancelBuffer();
@@ -21,57 +53,83 @@ int main()
     diff_t diff ={};
     diffInit(&diff);
 
-    treeSetDumpMode(DUMP_MEDIUM);
+    if (options.stats)
+        statsEnable(&diff.stats);
+
+    if (options.trace)
+        traceStart("logs/trace.json");
 
-    tex_dump_t tex = startTexDump("test.tex");
+    graphDumpStart("logs", GRAPH_DUMP_NODE_BUDGET);
+
+    tex_pipeline_t tex_pipeline = texPipelineCtor(LATEX_RUNS, TEX_MAX_PENDING);
+    tex_dump_t tex = startTexDumpAsync("test.tex", &tex_pipeline);
 
     char buffer[BUFFER_LEN] = {};
     scanf("%[^\n]", buffer);
 
     node_t * tree       = parseEquation(&diff, buffer);
 
-    treeDumpGraph(tree, exprElemToStr);
+    graphDump(tree, exprElemToStr);
 
     node_t * derivative = makeDerivative(&diff, tree, 0);
-    treeDumpGraph(derivative, exprElemToStr);
+    graphDump(derivative, exprElemToStr);
 
     node_t * taylor = taylorSeries(&diff, tree, 0, 0, 8);
-    treeDumpGraph(taylor, exprElemToStr);
+    graphDump(taylor, exprElemToStr);
 
     fprintf(tex.file, "Исходное выражение: \n\n");
     dumpToTEX(&tex, &diff, tree);
-    tree       = TexSimplifyExpression(&tex, &diff, tree);
+    tree       = TexSimplifySteps(&tex, &diff, tree, &DEFAULT_TEX_STEPS);
+
+    /* expression may have operations without derivative rule */
+    if (derivative != NULL){
+        fprintf(tex.file, "Ответ (1-я производная): \n\n");
 
-    fprintf(tex.file, "Ответ (1-я производная): \n\n");
+        node_t * derivativeCopy = exprCopy(derivative);
+        derivativeCopy = simplifyExpression(derivativeCopy);
+        dumpToTEX(&tex, &diff, derivativeCopy);
+        exprDestroy(derivativeCopy);
 
-    node_t * derivativeCopy = treeCopy(derivative);
-    derivativeCopy = simplifyExpression(derivativeCopy);
-    dumpToTEX(&tex, &diff, derivativeCopy);
-    treeDestroy(derivativeCopy);
+        texEndSection(&tex);
 
-    fprintf(tex.file, "\\vspace{5mm}\n");
+        fprintf(tex.file, "\\vspace{5mm}\n");
 
-    fprintf(tex.file, "Производная: \n\n");
-    dumpToTEX(&tex, &diff, derivative);
-    derivative = TexSimplifyExpression(&tex, &diff, derivative);
+        fprintf(tex.file, "Производная: \n\n");
+        dumpToTEX(&tex, &diff, derivative);
+        derivative = TexSimplifySteps(&tex, &diff, derivative, &DEFAULT_TEX_STEPS);
 
-    fprintf(tex.file, "\\vspace{5mm}\n");
+        fprintf(tex.file, "\\vspace{5mm}\n");
+    }
+    else
+        fprintf(tex.file, "Производная не найдена: нет правила дифференцирования. \n\n");
 
     fprintf(tex.file, "Разложение Тейлора в окрестности 0: \n\n");
     dumpToTEX(&tex, &diff, taylor);
-    taylor     = TexSimplifyExpression(&tex, &diff, taylor);
+    taylor     = TexSimplifySteps(&tex, &diff, taylor, &DEFAULT_TEX_STEPS);
 
     TexMakePlot(&tex, &diff, tree, -1., 1., 1000, 0, 10);
 
-    treeDumpGraph(derivative, exprElemToStr);
+    graphDump(derivative, exprElemToStr);
 
     endTexDump(&tex);
 
     diffDump(&diff);
 
-    treeDestroy(tree);
-    treeDestroy(derivative);
-    treeDestroy(taylor);
+    graphDumpStop();
+    texPipelineDtor(&tex_pipeline);
+    traceStop();
+
+    if (options.stats){
+        FILE * stats_file = fopen("logs/stats.json", "w");
+        if (stats_file != NULL){
+            statsDumpJSON(&diff.stats, stats_file);
+            fclose(stats_file);
+        }
+    }
+
+    exprDestroy(tree);
+    exprDestroy(derivative);
+    exprDestroy(taylor);
     diffDtor(&diff);
 
     logExit();
@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+#include "sampling.h"
+#include "differ.h"
+#include "bintree.h"
+#include "logger.h"
+
+typedef struct {
+    double left_x;
+    double left_y;
+
+    double right_x;
+    double right_y;
+
+    size_t depth;
+} segment_t;
+
+static void plotAddPoint(plot_t * plot, double x, double y);
+
+static double * makeVarValues(diff_t * diff, size_t values_num);
+
+static double evaluateAt(node_t * tree, double * var_values, unsigned int var_index, double x, plot_t * plot);
+
+static double plotHeight(const double * values, size_t values_num, double * low, double * high);
+
+static bool isJump(node_t * tree, double * var_values, unsigned int var_index, segment_t segment, plot_t * plot);
+
+static int cmpDouble(const void * first, const void * second);
+
+static size_t downsampleSegment(plot_point_t * points, size_t points_num, plot_point_t * dest, size_t max_pts);
+
+static size_t partEnd(const plot_t * plot, size_t part_start);
+
+static size_t nextPart(const plot_t * plot, size_t part_end);
+
+static void plotAddPoint(plot_t * plot, double x, double y)
+{
+    assert(plot);
+
+    /* do not make several breaks in a row */
+    if (isnan(y) && (plot->size == 0 || isnan(plot->points[plot->size - 1].y)))
+        return;
+
+    if (plot->size == plot->capacity){
+        plot->capacity = (plot->capacity == 0) ? 64 : plot->capacity * 2;
+        plot->points = (plot_point_t *)realloc(plot->points, plot->capacity * sizeof(plot_point_t));
+    }
+
+    plot->points[plot->size].x = x;
+    plot->points[plot->size].y = y;
+
+    plot->size++;
+}
+
+/// copy of variables values, so sampling does not change diff
+static double * makeVarValues(diff_t * diff, size_t values_num)
+{
+    assert(diff);
+
+    if (values_num < diff->var_num)
+        values_num = diff->var_num;
+
+    double * var_values = (double *)calloc(values_num + 1, sizeof(double));
+
+    if (diff->var_num > 0)
+        memcpy(var_values, diff->var_values, diff->var_num * sizeof(double));
+
+    return var_values;
+}
+
+static double evaluateAt(node_t * tree, double * var_values, unsigned int var_index, double x, plot_t * plot)
+{
+    var_values[var_index] = x;
+    plot->evaluations++;
+
+    double y = evaluateWithValues(tree, var_values);
+
+    return isfinite(y) ? y : NAN;
+}
+
+static int cmpDouble(const void * first, const void * second)
+{
+    double first_val  = *(const double *)first;
+    double second_val = *(const double *)second;
+
+    return (first_val > second_val) - (first_val < second_val);
+}
+
+/// height of the plot without outliers near poles (between 10th and 90th percentiles), low and high are the visible range
+static double plotHeight(const double * values, size_t values_num, double * low, double * high)
+{
+    double * finite = (double *)calloc(values_num + 1, sizeof(double));
+    size_t finite_num = 0;
+
+    for (size_t index = 0; index < values_num; index++)
+        if (isfinite(values[index]))
+            finite[finite_num++] = values[index];
+
+    double height = 0.;
+
+    *low  = 0.;
+    *high = 0.;
+
+    if (finite_num > 0){
+        qsort(finite, finite_num, sizeof(double), cmpDouble);
+
+        *low  = finite[finite_num / 10];
+        *high = finite[finite_num * 9 / 10];
+
+        height = *high - *low;
+
+        if (height == 0.)
+            height = finite[finite_num - 1] - finite[0];
+    }
+
+    free(finite);
+
+    if (height <= 0.)
+        height = 1.;
+
+    *low  -= height;
+    *high += height;
+
+    return height;
+}
+
+/// follows the half with bigger change: change of continuous function halves, jump or pole does not decrease
+static bool isJump(node_t * tree, double * var_values, unsigned int var_index, segment_t segment, plot_t * plot)
+{
+    const size_t JUMP_CHECK_DEPTH = 8;
+    const double MIN_JUMP_RATIO   = 0.25;
+
+    double start_change = fabs(segment.right_y - segment.left_y);
+
+    for (size_t depth = 0; depth < JUMP_CHECK_DEPTH; depth++){
+        double mid_x = segment.left_x + (segment.right_x - segment.left_x) / 2;
+        double mid_y = evaluateAt(tree, var_values, var_index, mid_x, plot);
+
+        if (isnan(mid_y))
+            return true;
+
+        if (fabs(mid_y - segment.left_y) > fabs(segment.right_y - mid_y)){
+            segment.right_x = mid_x;
+            segment.right_y = mid_y;
+        }
+        else {
+            segment.left_x = mid_x;
+            segment.left_y = mid_y;
+        }
+    }
+
+    return fabs(segment.right_y - segment.left_y) > MIN_JUMP_RATIO * start_change;
+}
+
+plot_t sampleAdaptive(diff_t * diff, node_t * tree, unsigned int var_index,
+                      double left_border, double right_border, const sampling_params_t * params)
+{
+    assert(diff);
+    assert(tree);
+    assert(params);
+    assert(params->initial_pts > 0);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_SAMPLING);
+
+    plot_t plot = {};
+
+    double * var_values = makeVarValues(diff, var_index + 1);
+
+    size_t initial_pts = params->initial_pts;
+    double step = (right_border - left_border) / (double)initial_pts;
+
+    double * initial_y = (double *)calloc(initial_pts + 1, sizeof(double));
+
+    for (size_t index = 0; index <= initial_pts; index++)
+        initial_y[index] = evaluateAt(tree, var_values, var_index, left_border + step * (double)index, &plot);
+
+    double low  = 0.;
+    double high = 0.;
+
+    double height    = plotHeight(initial_y, initial_pts + 1, &low, &high);
+    double max_error = params->tolerance * height;
+    double max_jump  = params->jump_fraction * height;
+
+    size_t stack_capacity = initial_pts + 2 * params->max_depth + 2;
+    segment_t * stack = (segment_t *)calloc(stack_capacity, sizeof(segment_t));
+    size_t stack_size = 0;
+
+    /* pushing in reverse order so segments are popped from left to right */
+    for (size_t index = initial_pts; index > 0; index--){
+        segment_t segment = {
+            .left_x  = left_border + step * (double)(index - 1),
+            .left_y  = initial_y[index - 1],
+            .right_x = (index == initial_pts) ? right_border : left_border + step * (double)index,
+            .right_y = initial_y[index],
+            .depth   = 0
+        };
+
+        stack[stack_size++] = segment;
+    }
+
+    plotAddPoint(&plot, left_border, initial_y[0]);
+
+    while (stack_size > 0){
+        segment_t segment = stack[--stack_size];
+
+        double mid_x = segment.left_x + (segment.right_x - segment.left_x) / 2;
+        double mid_y = evaluateAt(tree, var_values, var_index, mid_x, &plot);
+
+        bool left_defined  = !isnan(segment.left_y);
+        bool right_defined = !isnan(segment.right_y);
+        bool mid_defined   = !isnan(mid_y);
+
+        bool smooth = false;
+
+        if (left_defined && right_defined && mid_defined){
+            double chord_y = (segment.left_y + segment.right_y) / 2;
+            smooth = fabs(mid_y - chord_y) <= max_error;
+
+            /* segment is out of the visible range, no need to refine */
+            if (fmin(fmin(segment.left_y, segment.right_y), mid_y) > high ||
+                fmax(fmax(segment.left_y, segment.right_y), mid_y) < low)
+                smooth = true;
+        }
+        /* undefined everywhere on the segment */
+        else if (!left_defined && !right_defined && !mid_defined)
+            smooth = true;
+
+        if (!smooth && segment.depth < params->max_depth){
+            segment_t left_half  = {segment.left_x, segment.left_y, mid_x, mid_y, segment.depth + 1};
+            segment_t right_half = {mid_x, mid_y, segment.right_x, segment.right_y, segment.depth + 1};
+
+            stack[stack_size++] = right_half;
+            stack[stack_size++] = left_half;
+
+            continue;
+        }
+
+        /* the smallest segment still changes too much - pole or discontinuity */
+        bool is_break = !smooth && left_defined && right_defined && fabs(segment.right_y - segment.left_y) > max_jump
+                        && isJump(tree, var_values, var_index, segment, &plot);
+
+        plotAddPoint(&plot, mid_x, is_break ? NAN : mid_y);
+        plotAddPoint(&plot, segment.right_x, segment.right_y);
+    }
+
+    /* plot must not end with break */
+    if (plot.size > 0 && isnan(plot.points[plot.size - 1].y))
+        plot.size--;
+
+    free(stack);
+    free(initial_y);
+    free(var_values);
+
+    logPrint(LOG_DEBUG, "adaptive sampling on [%lg, %lg]: %zu points, %zu evaluations\n",
+                        left_border, right_border, plot.size, plot.evaluations);
+
+    statsPhaseEnd(timer);
+
+    return plot;
+}
+
+/// largest triangle three buckets for one continuous part, returns number of written points
+static size_t downsampleSegment(plot_point_t * points, size_t points_num, plot_point_t * dest, size_t max_pts)
+{
+    if (points_num <= max_pts || max_pts < 3){
+        size_t copy_num = (points_num <= max_pts) ? points_num : max_pts;
+
+        memcpy(dest, points, copy_num * sizeof(plot_point_t));
+        if (copy_num < points_num && copy_num > 0)
+            dest[copy_num - 1] = points[points_num - 1];
+
+        return copy_num;
+    }
+
+    size_t dest_size = 0;
+    double bucket_size = (double)(points_num - 2) / (double)(max_pts - 2);
+
+    size_t selected = 0;
+    dest[dest_size++] = points[0];
+
+    for (size_t bucket = 0; bucket < max_pts - 2; bucket++){
+        size_t bucket_start = 1 + (size_t)((double) bucket      * bucket_size);
+        size_t bucket_end   = 1 + (size_t)((double)(bucket + 1) * bucket_size);
+
+        size_t next_start = bucket_end;
+        size_t next_end   = 1 + (size_t)((double)(bucket + 2) * bucket_size);
+        if (next_end > points_num)
+            next_end = points_num;
+
+        double avg_x = 0., avg_y = 0.;
+        for (size_t index = next_start; index < next_end; index++){
+            avg_x += points[index].x;
+            avg_y += points[index].y;
+        }
+        avg_x /= (double)(next_end - next_start);
+        avg_y /= (double)(next_end - next_start);
+
+        double max_area = -1.;
+        size_t max_index = bucket_start;
+
+        for (size_t index = bucket_start; index < bucket_end; index++){
+            double area = fabs((points[selected].x - avg_x) * (points[index].y - points[selected].y) -
+                               (points[selected].x - points[index].x) * (avg_y - points[selected].y));
+
+            if (area > max_area){
+                max_area  = area;
+                max_index = index;
+            }
+        }
+
+        selected = max_index;
+        dest[dest_size++] = points[selected];
+    }
+
+    dest[dest_size++] = points[points_num - 1];
+
+    return dest_size;
+}
+
+/// end of the continuous part starting at part_start
+static size_t partEnd(const plot_t * plot, size_t part_start)
+{
+    size_t part_end = part_start;
+
+    while (part_end < plot->size && !isnan(plot->points[part_end].y))
+        part_end++;
+
+    return part_end;
+}
+
+/// start of the next part after the break at part_end, one break is enough for a jump
+static size_t nextPart(const plot_t * plot, size_t part_end)
+{
+    size_t part_start = part_end + 1;
+
+    while (part_start < plot->size && isnan(plot->points[part_start].y))
+        part_start++;
+
+    return part_start;
+}
+
+void downsamplePlot(plot_t * plot, size_t max_pts)
+{
+    assert(plot);
+
+    if (plot->size <= max_pts)
+        return;
+
+    /* ends of every part and breaks between parts are kept, they are taken out of the budget first */
+    size_t reserved  = 0;
+    size_t extra_num = 0;       ///< defined points above minimums of parts
+
+    for (size_t part_start = 0; part_start < plot->size; ){
+        size_t part_end = partEnd(plot, part_start);
+        size_t part_len = part_end - part_start;
+
+        size_t part_min = (part_len < 2) ? part_len : 2;
+
+        reserved  += part_min;
+        extra_num += part_len - part_min;
+
+        if (part_end < plot->size)
+            reserved++;
+
+        part_start = nextPart(plot, part_end);
+    }
+
+    size_t budget = (max_pts > reserved) ? max_pts - reserved : 0;
+
+    size_t new_capacity = ((max_pts > reserved) ? max_pts : reserved) + 1;
+    plot_point_t * new_points = (plot_point_t *)calloc(new_capacity, sizeof(plot_point_t));
+
+    size_t new_size = 0;
+
+    for (size_t part_start = 0; part_start < plot->size; ){
+        size_t part_end = partEnd(plot, part_start);
+        size_t part_len = part_end - part_start;
+
+        size_t part_min = (part_len < 2) ? part_len : 2;
+
+        /* rest of the budget is shared in proportion to points above the minimum, rounding down keeps the sum */
+        size_t part_budget = part_min;
+
+        if (extra_num > 0)
+            part_budget += budget * (part_len - part_min) / extra_num;
+
+        new_size += downsampleSegment(plot->points + part_start, part_len, new_points + new_size, part_budget);
+
+        if (part_end < plot->size)
+            new_points[new_size++] = plot->points[part_end];
+
+        part_start = nextPart(plot, part_end);
+    }
+
+    assert(new_size < new_capacity);
+
+    free(plot->points);
+
+    plot->points   = new_points;
+    plot->size     = new_size;
+    plot->capacity = new_capacity;
+}
+
+double gridAxisPoint(const grid_axis_t * axis, size_t point_index)
+{
+    assert(axis);
+
+    if (axis->num_of_pts < 2)
+        return axis->left_border;
+
+    double step = (axis->right_border - axis->left_border) / (double)(axis->num_of_pts - 1);
+
+    return axis->left_border + step * (double)point_index;
+}
+
+typedef struct {
+    node_t * tree;
+
+    const grid_axis_t * axes;
+    size_t axes_num;
+
+    double * results;
+    size_t points_num;
+    size_t chunk_size;
+
+    size_t values_num;
+    double * thread_values;     ///< variables values of every thread
+    size_t * thread_indices;    ///< current multi-index on the grid of every thread
+} grid_context_t;
+
+/// number of points evaluated by one task, big enough to hide scheduling cost
+static const size_t GRID_CHUNK_SIZE = 4096;
+
+static void sampleGridChunk(void * context, size_t task_index, size_t thread_index);
+
+static void sampleGridChunk(void * context, size_t task_index, size_t thread_index)
+{
+    grid_context_t * grid = (grid_context_t *)context;
+
+    double * var_values = grid->thread_values  + thread_index * grid->values_num;
+    size_t   * indices  = grid->thread_indices + thread_index * grid->axes_num;
+
+    size_t start = task_index * grid->chunk_size;
+    size_t end   = start + grid->chunk_size;
+    if (end > grid->points_num)
+        end = grid->points_num;
+
+    /* multi-index of the first point in the chunk */
+    size_t rest = start;
+    for (size_t axis_index = grid->axes_num; axis_index > 0; axis_index--){
+        const grid_axis_t * axis = grid->axes + axis_index - 1;
+
+        indices[axis_index - 1] = rest % axis->num_of_pts;
+        rest /= axis->num_of_pts;
+
+        var_values[axis->var_index] = gridAxisPoint(axis, indices[axis_index - 1]);
+    }
+
+    for (size_t point_index = start; point_index < end; point_index++){
+        grid->results[point_index] = evaluateWithValues(grid->tree, var_values);
+
+        /* next multi-index, last axis is the fastest */
+        for (size_t axis_index = grid->axes_num; axis_index > 0; axis_index--){
+            const grid_axis_t * axis = grid->axes + axis_index - 1;
+
+            indices[axis_index - 1]++;
+            bool carry = (indices[axis_index - 1] == axis->num_of_pts);
+            if (carry)
+                indices[axis_index - 1] = 0;
+
+            var_values[axis->var_index] = gridAxisPoint(axis, indices[axis_index - 1]);
+
+            if (!carry)
+                break;
+        }
+    }
+}
+
+void sampleGrid(diff_t * diff, node_t * tree, const grid_axis_t * axes, size_t axes_num,
+                double * results, thread_pool_t * pool)
+{
+    assert(diff);
+    assert(tree);
+    assert(axes);
+    assert(results);
+
+    grid_context_t grid = {};
+
+    grid.tree       = tree;
+    grid.axes       = axes;
+    grid.axes_num   = axes_num;
+    grid.results    = results;
+    grid.points_num = 1;
+    grid.chunk_size = GRID_CHUNK_SIZE;
+    grid.values_num = diff->var_num;
+
+    for (size_t axis_index = 0; axis_index < axes_num; axis_index++){
+        grid.points_num *= axes[axis_index].num_of_pts;
+
+        if (axes[axis_index].var_index >= grid.values_num)
+            grid.values_num = axes[axis_index].var_index + 1;
+    }
+
+    if (grid.points_num == 0)
+        return;
+
+    /* threads must not expand deferred derivatives of the shared tree */
+    expandAllDeferred(tree);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_SAMPLING);
+
+    size_t threads_num = (pool == NULL) ? 1 : threadPoolSize(pool);
+
+    double * base_values = makeVarValues(diff, grid.values_num);
+
+    grid.thread_values  = (double *)calloc(threads_num * grid.values_num + 1, sizeof(double));
+    grid.thread_indices = (size_t *)calloc(threads_num * axes_num + 1, sizeof(size_t));
+
+    for (size_t thread_index = 0; thread_index < threads_num; thread_index++)
+        for (size_t var_index = 0; var_index < grid.values_num; var_index++)
+            grid.thread_values[thread_index * grid.values_num + var_index] = base_values[var_index];
+
+    size_t tasks_num = (grid.points_num + grid.chunk_size - 1) / grid.chunk_size;
+
+    if (pool == NULL){
+        for (size_t task_index = 0; task_index < tasks_num; task_index++)
+            sampleGridChunk(&grid, task_index, 0);
+    }
+    else
+        threadPoolFor(pool, tasks_num, sampleGridChunk, &grid);
+
+    free(grid.thread_values);
+    free(grid.thread_indices);
+    free(base_values);
+
+    statsPhaseEnd(timer);
+
+    logPrint(LOG_DEBUG, "sampled grid of %zu points in %zu tasks on %zu threads\n", grid.points_num, tasks_num, threads_num);
+}
+
+void plotDtor(plot_t * plot)
+{
+    assert(plot);
+
+    free(plot->points);
+
+    plot->points   = NULL;
+    plot->size     = 0;
+    plot->capacity = 0;
+}
@@ -0,0 +1,723 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+#include "solver.h"
+#include "codegen.h"
+#include "hessian.h"
+#include "differ.h"
+#include "bintree.h"
+#include "logger.h"
+
+const size_t MAX_BACKTRACKS = 60;
+
+const double ARMIJO_SLOPE = 1e-4;
+
+/// compiled problem shared by all starting points
+typedef struct {
+    size_t var_num;
+
+    unsigned int * active;      ///< variables the expression depends on
+    size_t active_num;
+
+    expr_code_t value_code;     ///< value and derivatives by active variables
+    expr_code_t hessian_code;   ///< upper triangle of hessian by active variables, row by row
+    bool with_hessian;
+
+    size_t regs_num;
+
+    const solver_params_t * params;
+
+    double * points;
+    size_t point_stride;
+    const double * base_values;
+
+    solver_result_t * results;
+} problem_t;
+
+/// workspace of one run
+typedef struct {
+    double * regs;
+    double * var_values;
+    double * outputs;
+
+    double * x;
+    double * x_new;
+    double * grad;
+    double * grad_new;
+    double * dir;
+
+    double * hess_upper;
+    double * matrix;            ///< active_num * active_num
+    double * inv_hess;          ///< BFGS approximation of inverse hessian
+} workspace_t;
+
+static void addOutput(expr_code_t * code, node_t * node);
+
+static bool problemCtor(problem_t * problem, diff_t * diff, node_t * expr_node, const bool * active, bool with_hessian);
+
+static void problemDtor(problem_t * problem);
+
+static workspace_t workspaceCtor(const problem_t * problem);
+
+static void workspaceDtor(workspace_t * workspace);
+
+static double evalValue(const problem_t * problem, workspace_t * work, const double * x, double * grad);
+
+static void evalHessian(const problem_t * problem, workspace_t * work);
+
+static double maxAbs(const double * vector, size_t size);
+
+static double dot(const double * first, const double * second, size_t size);
+
+static bool solveGauss(double * matrix, double * rhs, size_t size);
+
+static bool solveCholesky(double * matrix, double * rhs, size_t size);
+
+static void dampedNewtonDirection(const problem_t * problem, workspace_t * work);
+
+static void updateInverseHessian(workspace_t * work, size_t size);
+
+static void runRoot(void * ctx, size_t task_index, size_t thread_index);
+
+static void runMinimize(void * ctx, size_t task_index, size_t thread_index);
+
+static void failTasks(solver_result_t * results, size_t points_num);
+
+static void runTasks(problem_t * problem, size_t points_num, pool_task_t task, thread_pool_t * pool);
+
+/// adds output, NULL is structurally zero
+static void addOutput(expr_code_t * code, node_t * node)
+{
+    if (node != NULL){
+        codeAddTree(code, node);
+        return;
+    }
+
+    node_t * zero = newNumNode(0.);
+    codeAddTree(code, zero);
+    exprDestroy(zero);
+}
+
+/// returns false if the expression can not be differentiated, problem is left empty then
+static bool problemCtor(problem_t * problem, diff_t * diff, node_t * expr_node, const bool * active, bool with_hessian)
+{
+    *problem = {};
+
+    problem->var_num = diff->var_num;
+    problem->active  = (unsigned int *)calloc(diff->var_num + 1, sizeof(unsigned int));
+
+    for (unsigned int var_index = 0; var_index < diff->var_num; var_index++)
+        if (active[var_index])
+            problem->active[problem->active_num++] = var_index;
+
+    /* only derivatives by active variables are evaluated */
+    hessian_t derivs = with_hessian ? makeHessian(diff, expr_node, active) : makeGradient(diff, expr_node, active);
+
+    if (derivs.gradient == NULL){
+        free(problem->active);
+        *problem = {};
+
+        return false;
+    }
+
+    problem->value_code = codeCtor();
+    codeAddTree(&problem->value_code, expr_node);
+
+    for (size_t row = 0; row < problem->active_num; row++)
+        addOutput(&problem->value_code, derivs.gradient[problem->active[row]]);
+
+    codeStrengthReduce(&problem->value_code);
+
+    problem->regs_num = problem->value_code.size;
+
+    problem->with_hessian = with_hessian;
+    if (with_hessian){
+        problem->hessian_code = codeCtor();
+
+        for (size_t row = 0; row < problem->active_num; row++)
+            for (size_t col = row; col < problem->active_num; col++)
+                addOutput(&problem->hessian_code, derivs.hessian[problem->active[row] * derivs.var_num + problem->active[col]]);
+
+        codeStrengthReduce(&problem->hessian_code);
+
+        if (problem->hessian_code.size > problem->regs_num)
+            problem->regs_num = problem->hessian_code.size;
+    }
+
+    hessianDtor(&derivs);
+
+    logPrint(LOG_DEBUG, "solver problem of %zu variables: %zu instructions for value and gradient, %zu for hessian\n",
+                        problem->active_num, problem->value_code.size, problem->hessian_code.size);
+
+    return true;
+}
+
+static void problemDtor(problem_t * problem)
+{
+    codeDtor(&problem->value_code);
+
+    if (problem->with_hessian)
+        codeDtor(&problem->hessian_code);
+
+    free(problem->active);
+
+    *problem = {};
+}
+
+static workspace_t workspaceCtor(const problem_t * problem)
+{
+    workspace_t work = {};
+
+    size_t size = problem->active_num;
+
+    work.regs       = (double *)calloc(problem->regs_num + 1, sizeof(double));
+    work.var_values = (double *)calloc(problem->var_num  + 1, sizeof(double));
+    work.outputs    = (double *)calloc(size + 1, sizeof(double));
+
+    work.x        = (double *)calloc(size + 1, sizeof(double));
+    work.x_new    = (double *)calloc(size + 1, sizeof(double));
+    work.grad     = (double *)calloc(size + 1, sizeof(double));
+    work.grad_new = (double *)calloc(size + 1, sizeof(double));
+    work.dir      = (double *)calloc(size + 1, sizeof(double));
+
+    work.hess_upper = (double *)calloc(size * (size + 1) / 2 + 1, sizeof(double));
+    work.matrix     = (double *)calloc(size * size + 1, sizeof(double));
+    work.inv_hess   = (double *)calloc(size * size + 1, sizeof(double));
+
+    return work;
+}
+
+static void workspaceDtor(workspace_t * work)
+{
+    free(work->regs);
+    free(work->var_values);
+    free(work->outputs);
+    free(work->x);
+    free(work->x_new);
+    free(work->grad);
+    free(work->grad_new);
+    free(work->dir);
+    free(work->hess_upper);
+    free(work->matrix);
+    free(work->inv_hess);
+
+    *work = {};
+}
+
+/// returns value at x and writes gradient by active variables to grad
+static double evalValue(const problem_t * problem, workspace_t * work, const double * x, double * grad)
+{
+    for (size_t row = 0; row < problem->active_num; row++)
+        work->var_values[problem->active[row]] = x[row];
+
+    codeEvaluate(&problem->value_code, work->var_values, work->regs, work->outputs);
+
+    memcpy(grad, work->outputs + 1, problem->active_num * sizeof(double));
+
+    return work->outputs[0];
+}
+
+/// fills work->matrix with hessian at point set by the last evalValue()
+static void evalHessian(const problem_t * problem, workspace_t * work)
+{
+    codeEvaluate(&problem->hessian_code, work->var_values, work->regs, work->hess_upper);
+
+    size_t size = problem->active_num;
+    size_t entry = 0;
+
+    for (size_t row = 0; row < size; row++){
+        for (size_t col = row; col < size; col++){
+            work->matrix[row * size + col] = work->hess_upper[entry];
+            work->matrix[col * size + row] = work->hess_upper[entry];
+            entry++;
+        }
+    }
+}
+
+static double maxAbs(const double * vector, size_t size)
+{
+    double max_abs = 0.;
+
+    for (size_t index = 0; index < size; index++)
+        if (!(fabs(vector[index]) <= max_abs))
+            max_abs = fabs(vector[index]);
+
+    return max_abs;
+}
+
+static double dot(const double * first, const double * second, size_t size)
+{
+    double result = 0.;
+
+    for (size_t index = 0; index < size; index++)
+        result += first[index] * second[index];
+
+    return result;
+}
+
+/// solves matrix * x = rhs in place of rhs with partial pivoting, matrix is destroyed
+static bool solveGauss(double * matrix, double * rhs, size_t size)
+{
+    for (size_t col = 0; col < size; col++){
+        size_t pivot = col;
+
+        for (size_t row = col + 1; row < size; row++)
+            if (fabs(matrix[row * size + col]) > fabs(matrix[pivot * size + col]))
+                pivot = row;
+
+        if (!(fabs(matrix[pivot * size + col]) > 0.))
+            return false;
+
+        if (pivot != col){
+            for (size_t index = 0; index < size; index++){
+                double temp = matrix[col * size + index];
+                matrix[col * size + index] = matrix[pivot * size + index];
+                matrix[pivot * size + index] = temp;
+            }
+
+            double temp = rhs[col];
+            rhs[col] = rhs[pivot];
+            rhs[pivot] = temp;
+        }
+
+        for (size_t row = col + 1; row < size; row++){
+            double factor = matrix[row * size + col] / matrix[col * size + col];
+
+            for (size_t index = col; index < size; index++)
+                matrix[row * size + index] -= factor * matrix[col * size + index];
+
+            rhs[row] -= factor * rhs[col];
+        }
+    }
+
+    for (size_t row = size; row-- > 0; ){
+        for (size_t index = row + 1; index < size; index++)
+            rhs[row] -= matrix[row * size + index] * rhs[index];
+
+        rhs[row] /= matrix[row * size + row];
+    }
+
+    return true;
+}
+
+/// solves matrix * x = rhs in place of rhs, returns false if matrix is not positive definite, matrix is destroyed
+static bool solveCholesky(double * matrix, double * rhs, size_t size)
+{
+    /* lower triangle becomes L: matrix = L * L^T */
+    for (size_t col = 0; col < size; col++){
+        double diag = matrix[col * size + col];
+
+        for (size_t index = 0; index < col; index++)
+            diag -= matrix[col * size + index] * matrix[col * size + index];
+
+        if (!(diag > 0.))
+            return false;
+
+        diag = sqrt(diag);
+        matrix[col * size + col] = diag;
+
+        for (size_t row = col + 1; row < size; row++){
+            double sum = matrix[row * size + col];
+
+            for (size_t index = 0; index < col; index++)
+                sum -= matrix[row * size + index] * matrix[col * size + index];
+
+            matrix[row * size + col] = sum / diag;
+        }
+    }
+
+    for (size_t row = 0; row < size; row++){
+        for (size_t index = 0; index < row; index++)
+            rhs[row] -= matrix[row * size + index] * rhs[index];
+
+        rhs[row] /= matrix[row * size + row];
+    }
+
+    for (size_t row = size; row-- > 0; ){
+        for (size_t index = row + 1; index < size; index++)
+            rhs[row] -= matrix[index * size + row] * rhs[index];
+
+        rhs[row] /= matrix[row * size + row];
+    }
+
+    return true;
+}
+
+/// direction -(H + shift * I)^-1 * grad with the smallest found shift making it positive definite,
+/// so it is always a descent direction
+static void dampedNewtonDirection(const problem_t * problem, workspace_t * work)
+{
+    size_t size = problem->active_num;
+
+    double scale = 0.;
+    for (size_t row = 0; row < size; row++)
+        if (fabs(work->matrix[row * size + row]) > scale)
+            scale = fabs(work->matrix[row * size + row]);
+
+    /* inv_hess is free in Newton methods, it keeps original hessian between attempts */
+    memcpy(work->inv_hess, work->matrix, size * size * sizeof(double));
+
+    double shift = 0.;
+
+    while (true){
+        memcpy(work->matrix, work->inv_hess, size * size * sizeof(double));
+
+        for (size_t row = 0; row < size; row++){
+            work->matrix[row * size + row] += shift;
+            work->dir[row] = -work->grad[row];
+        }
+
+        if (solveCholesky(work->matrix, work->dir, size))
+            return;
+
+        shift = (shift == 0.) ? 1e-3 * (scale + 1.) : shift * 4.;
+
+        /* hessian is not finite, falling back to gradient descent */
+        if (!isfinite(shift) || !isfinite(scale)){
+            for (size_t row = 0; row < size; row++)
+                work->dir[row] = -work->grad[row];
+
+            return;
+        }
+    }
+}
+
+/// BFGS update of inverse hessian by step x_new - x and gradient change grad_new - grad
+static void updateInverseHessian(workspace_t * work, size_t size)
+{
+    /* s = x_new - x is stored in x, y = grad_new - grad in grad, dir is H * y */
+    double * step = work->x;
+    double * grad_change = work->grad;
+
+    for (size_t row = 0; row < size; row++){
+        step[row] = work->x_new[row] - work->x[row];
+        grad_change[row] = work->grad_new[row] - work->grad[row];
+    }
+
+    double curvature = dot(step, grad_change, size);
+
+    /* update keeps matrix positive definite only when curvature is positive */
+    if (!(curvature > 1e-12 * sqrt(dot(step, step, size) * dot(grad_change, grad_change, size))))
+        return;
+
+    double * inv_hess = work->inv_hess;
+    double * hy = work->dir;
+
+    for (size_t row = 0; row < size; row++)
+        hy[row] = dot(inv_hess + row * size, grad_change, size);
+
+    double yhy = dot(grad_change, hy, size);
+    double rho = 1. / curvature;
+
+    /* H += rho^2 (y^T H y + s^T y) s s^T - rho (H y s^T + s y^T H) */
+    for (size_t row = 0; row < size; row++){
+        for (size_t col = 0; col < size; col++){
+            inv_hess[row * size + col] += rho * rho * (yhy + curvature) * step[row] * step[col]
+                                        - rho * (hy[row] * step[col] + step[row] * hy[col]);
+        }
+    }
+}
+
+static void runRoot(void * ctx, size_t task_index, size_t thread_index)
+{
+    (void) thread_index;
+
+    problem_t * problem = (problem_t *)ctx;
+    const solver_params_t * params = problem->params;
+
+    workspace_t work = workspaceCtor(problem);
+    memcpy(work.var_values, problem->base_values, problem->var_num * sizeof(double));
+
+    solver_result_t result = {SOLVER_MAX_ITERS, NAN, 0};
+
+    double x = problem->points[task_index];
+    double deriv = 0.;
+    double value = evalValue(problem, &work, &x, &deriv);
+
+    /* secant method keeps derivative estimate between iterations */
+    double prev_x = x;
+    double prev_value = value;
+
+    for (result.iters = 0; result.iters < params->max_iters; result.iters++){
+        if (!isfinite(value) || !isfinite(x)){
+            result.status = SOLVER_DIVERGED;
+            break;
+        }
+
+        if (fabs(value) <= params->tolerance){
+            result.status = SOLVER_CONVERGED;
+            break;
+        }
+
+        if (params->method == SOLVER_BFGS && result.iters > 0 && x != prev_x)
+            deriv = (value - prev_value) / (x - prev_x);
+
+        if (!(fabs(deriv) > 0.)){
+            result.status = SOLVER_DIVERGED;
+            break;
+        }
+
+        double step = -value / deriv;
+        double new_x = x + step;
+        double new_deriv = 0.;
+        double new_value = evalValue(problem, &work, &new_x, &new_deriv);
+
+        if (params->method == SOLVER_DAMPED_NEWTON){
+            size_t backtracks = 0;
+
+            while (!(fabs(new_value) < fabs(value)) && backtracks < MAX_BACKTRACKS){
+                step /= 2;
+                new_x = x + step;
+                new_value = evalValue(problem, &work, &new_x, &new_deriv);
+                backtracks++;
+            }
+
+            if (!(fabs(new_value) < fabs(value))){
+                result.status = SOLVER_STALLED;
+                break;
+            }
+        }
+
+        prev_x = x;
+        prev_value = value;
+
+        x = new_x;
+        value = new_value;
+        deriv = (params->method == SOLVER_BFGS) ? deriv : new_deriv;
+
+        if (fabs(x - prev_x) <= params->tolerance * (1. + fabs(x))){
+            result.status = isfinite(value) ? SOLVER_CONVERGED : SOLVER_DIVERGED;
+            result.iters++;
+            break;
+        }
+    }
+
+    result.value = value;
+
+    problem->points[task_index]  = x;
+    problem->results[task_index] = result;
+
+    workspaceDtor(&work);
+}
+
+static void runMinimize(void * ctx, size_t task_index, size_t thread_index)
+{
+    (void) thread_index;
+
+    problem_t * problem = (problem_t *)ctx;
+    const solver_params_t * params = problem->params;
+
+    size_t size = problem->active_num;
+    double * point = problem->points + task_index * problem->point_stride;
+
+    workspace_t work = workspaceCtor(problem);
+    memcpy(work.var_values, point, problem->var_num * sizeof(double));
+
+    for (size_t row = 0; row < size; row++)
+        work.x[row] = point[problem->active[row]];
+
+    for (size_t row = 0; row < size; row++)
+        work.inv_hess[row * size + row] = 1.;
+
+    solver_result_t result = {SOLVER_MAX_ITERS, NAN, 0};
+
+    double value = evalValue(problem, &work, work.x, work.grad);
+
+    for (result.iters = 0; result.iters < params->max_iters; result.iters++){
+        if (!isfinite(value) || !isfinite(maxAbs(work.x, size))){
+            result.status = SOLVER_DIVERGED;
+            break;
+        }
+
+        if (maxAbs(work.grad, size) <= params->tolerance){
+            result.status = SOLVER_CONVERGED;
+            break;
+        }
+
+        if (params->method == SOLVER_BFGS){
+            for (size_t row = 0; row < size; row++)
+                work.dir[row] = -dot(work.inv_hess + row * size, work.grad, size);
+
+            /* approximation lost positive definiteness because of rounding, restarting from identity */
+            if (!(dot(work.dir, work.grad, size) < 0.)){
+                for (size_t row = 0; row < size; row++){
+                    memset(work.inv_hess + row * size, 0, size * sizeof(double));
+                    work.inv_hess[row * size + row] = 1.;
+                    work.dir[row] = -work.grad[row];
+                }
+            }
+        }
+        else {
+            evalHessian(problem, &work);
+
+            if (params->method == SOLVER_NEWTON){
+                for (size_t row = 0; row < size; row++)
+                    work.dir[row] = -work.grad[row];
+
+                if (!solveGauss(work.matrix, work.dir, size)){
+                    result.status = SOLVER_DIVERGED;
+                    break;
+                }
+            }
+            else
+                dampedNewtonDirection(problem, &work);
+        }
+
+        double slope = dot(work.grad, work.dir, size);
+        double step  = 1.;
+        double new_value = 0.;
+        size_t backtracks = 0;
+
+        while (true){
+            for (size_t row = 0; row < size; row++)
+                work.x_new[row] = work.x[row] + step * work.dir[row];
+
+            new_value = evalValue(problem, &work, work.x_new, work.grad_new);
+
+            /* pure Newton takes full step, others need sufficient decrease (Armijo condition) */
+            if (params->method == SOLVER_NEWTON || new_value <= value + ARMIJO_SLOPE * step * slope)
+                break;
+
+            if (++backtracks == MAX_BACKTRACKS)
+                break;
+
+            step /= 2;
+        }
+
+        if (backtracks == MAX_BACKTRACKS){
+            result.status = SOLVER_STALLED;
+            break;
+        }
+
+        double step_norm = step * maxAbs(work.dir, size);
+        double x_norm = maxAbs(work.x, size);
+
+        if (params->method == SOLVER_BFGS)
+            updateInverseHessian(&work, size);
+
+        double * temp = work.x;
+        work.x = work.x_new;
+        work.x_new = temp;
+
+        temp = work.grad;
+        work.grad = work.grad_new;
+        work.grad_new = temp;
+
+        value = new_value;
+
+        if (step_norm <= params->tolerance * (1. + x_norm)){
+            result.status = isfinite(value) ? SOLVER_CONVERGED : SOLVER_DIVERGED;
+            result.iters++;
+            break;
+        }
+    }
+
+    result.value = value;
+
+    for (size_t row = 0; row < size; row++)
+        point[problem->active[row]] = work.x[row];
+
+    problem->results[task_index] = result;
+
+    workspaceDtor(&work);
+}
+
+static void failTasks(solver_result_t * results, size_t points_num)
+{
+    for (size_t task_index = 0; task_index < points_num; task_index++)
+        results[task_index] = {SOLVER_NO_DERIVATIVE, NAN, 0};
+}
+
+static void runTasks(problem_t * problem, size_t points_num, pool_task_t task, thread_pool_t * pool)
+{
+    if (pool == NULL){
+        for (size_t task_index = 0; task_index < points_num; task_index++)
+            task(problem, task_index, 0);
+    }
+    else
+        threadPoolFor(pool, points_num, task, problem);
+}
+
+void solverFindRoots(diff_t * diff, node_t * expr_node, unsigned int var_index, double * points, size_t points_num,
+                     const solver_params_t * params, solver_result_t * results, thread_pool_t * pool)
+{
+    assert(diff);
+    assert(expr_node);
+    assert(points);
+    assert(params);
+    assert(results);
+    assert(var_index < diff->var_num);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_SOLVER);
+
+    bool * active = (bool *)calloc(diff->var_num + 1, sizeof(bool));
+    active[var_index] = true;
+
+    problem_t problem = {};
+    if (!problemCtor(&problem, diff, expr_node, active, false)){
+        failTasks(results, points_num);
+
+        free(active);
+        statsPhaseEnd(timer);
+
+        return;
+    }
+
+    double * base_values = (double *)calloc(diff->var_num + 1, sizeof(double));
+    if (diff->var_num > 0)
+        memcpy(base_values, diff->var_values, diff->var_num * sizeof(double));
+
+    problem.params      = params;
+    problem.points      = points;
+    problem.results     = results;
+    problem.base_values = base_values;
+
+    runTasks(&problem, points_num, runRoot, pool);
+
+    free(base_values);
+    free(active);
+    problemDtor(&problem);
+
+    statsPhaseEnd(timer);
+}
+
+void solverMinimize(diff_t * diff, node_t * expr_node, double * points, size_t points_num,
+                    const solver_params_t * params, solver_result_t * results, thread_pool_t * pool)
+{
+    assert(diff);
+    assert(expr_node);
+    assert(points);
+    assert(params);
+    assert(results);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_SOLVER);
+
+    /* expression does not depend on other variables, they stay as they are */
+    bool * active = (bool *)calloc(diff->var_num + 1, sizeof(bool));
+    collectVars(expr_node, active);
+
+    problem_t problem = {};
+    if (!problemCtor(&problem, diff, expr_node, active, params->method != SOLVER_BFGS)){
+        failTasks(results, points_num);
+
+        free(active);
+        statsPhaseEnd(timer);
+
+        return;
+    }
+
+    problem.params       = params;
+    problem.points       = points;
+    problem.point_stride = diff->var_num;
+    problem.results      = results;
+
+    runTasks(&problem, points_num, runMinimize, pool);
+
+    free(active);
+    problemDtor(&problem);
+
+    statsPhaseEnd(timer);
+}
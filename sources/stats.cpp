@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+diff_stats_t * active_stats = NULL;
+
+/// depth of nested calls of every phase in this thread
+static thread_local unsigned int phase_depth[PHASES_NUM] = {};
+
+static const char * const counter_names[STAT_COUNTERS_NUM] = {
+    "nodes_allocated",
+    "nodes_freed",
+    "tree_copy_nodes",
+    "simplify_passes",
+    "fold_constants",
+    "mul_one",
+    "mul_zero",
+    "add_zero",
+    "div_one",
+    "sub_zero",
+    "sub_self",
+    "pow_one",
+    "pow_zero",
+    "pow_base",
+    "memo_hits",
+    "cse_hits",
+    "evaluations"
+};
+
+static const char * const phase_names[PHASES_NUM] = {
+    "parse",
+    "derivative",
+    "simplify",
+    "codegen",
+    "sampling",
+    "solver",
+    "tex"
+};
+
+static uint64_t nowNs();
+
+static uint64_t nowNs()
+{
+    struct timespec time = {};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+void statsEnable(diff_stats_t * stats)
+{
+    assert(stats);
+
+    __atomic_store_n(&active_stats, stats, __ATOMIC_RELEASE);
+}
+
+void statsDisable()
+{
+    __atomic_store_n(&active_stats, (diff_stats_t *)NULL, __ATOMIC_RELEASE);
+}
+
+void statsReset(diff_stats_t * stats)
+{
+    assert(stats);
+
+    memset(stats, 0, sizeof(*stats));
+}
+
+void statsNodesChanged(diff_stats_t * stats, int64_t allocated, int64_t freed)
+{
+    assert(stats);
+
+    if (allocated > 0)
+        __atomic_fetch_add(&stats->counters[STAT_NODES_ALLOCATED], (uint64_t)allocated, __ATOMIC_RELAXED);
+
+    if (freed > 0)
+        __atomic_fetch_add(&stats->counters[STAT_NODES_FREED], (uint64_t)freed, __ATOMIC_RELAXED);
+
+    int64_t live = __atomic_add_fetch(&stats->nodes_live, allocated - freed, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&stats->nodes_peak, __ATOMIC_RELAXED);
+
+    while (live > peak && !__atomic_compare_exchange_n(&stats->nodes_peak, &peak, live, true,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+stats_timer_t statsTimerStart(diff_stats_t * stats, stats_phase_t phase)
+{
+    assert(stats);
+
+    stats_timer_t timer = {};
+
+    timer.stats = stats;
+    timer.phase = phase;
+
+    /* recursive and nested calls are included in the outer one */
+    timer.nested = (phase_depth[phase]++ > 0);
+
+    if (!timer.nested)
+        timer.start_ns = nowNs();
+
+    return timer;
+}
+
+void statsTimerStop(stats_timer_t timer)
+{
+    assert(timer.stats);
+
+    phase_depth[timer.phase]--;
+
+    if (timer.nested)
+        return;
+
+    __atomic_fetch_add(&timer.stats->phase_calls[timer.phase], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&timer.stats->phase_ns   [timer.phase], nowNs() - timer.start_ns, __ATOMIC_RELAXED);
+}
+
+void statsDumpJSON(const diff_stats_t * stats, FILE * file)
+{
+    assert(stats);
+    assert(file);
+
+    fprintf(file, "{\n");
+    fprintf(file, "    \"enabled\": %s,\n", (active_stats == stats) ? "true" : "false");
+
+    fprintf(file, "    \"counters\": {\n");
+    for (size_t counter = 0; counter < STAT_COUNTERS_NUM; counter++)
+        fprintf(file, "        \"%s\": %lu,\n", counter_names[counter], (unsigned long)stats->counters[counter]);
+
+    fprintf(file, "        \"nodes_live\": %ld,\n", (long)stats->nodes_live);
+    fprintf(file, "        \"nodes_peak\": %ld\n",  (long)stats->nodes_peak);
+    fprintf(file, "    },\n");
+
+    fprintf(file, "    \"phases\": {\n");
+    for (size_t phase = 0; phase < PHASES_NUM; phase++){
+        fprintf(file, "        \"%s\": {\"calls\": %lu, \"seconds\": %.9f}%s\n", phase_names[phase],
+                      (unsigned long)stats->phase_calls[phase], (double)stats->phase_ns[phase] * 1e-9,
+                      (phase + 1 < PHASES_NUM) ? "," : "");
+    }
+    fprintf(file, "    }\n");
+
+    fprintf(file, "}\n");
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "sym_table.h"
+
+/// slots compared at once
+static const size_t GROUP_SIZE = 16;
+
+static const int8_t CTRL_EMPTY = INT8_MIN;
+
+static const size_t MIN_CAPACITY = GROUP_SIZE;
+
+static uint64_t nameHash(const char * name, size_t len);
+
+static uint32_t groupMatch(const int8_t * group, int8_t ctrl);
+
+static const char * slotName(const sym_slot_t * slot);
+
+static void setCtrl(sym_table_t * table, size_t slot_index, int8_t ctrl);
+
+static size_t findSlot(const sym_table_t * table, const char * name, size_t len, uint64_t hash, bool * found);
+
+static void symRehash(sym_table_t * table, size_t new_capacity);
+
+sym_table_t symTableCtor(size_t capacity)
+{
+    sym_table_t table = {};
+
+    table.capacity = MIN_CAPACITY;
+
+    /* load factor is not more than 7/8 */
+    while (table.capacity * 7 < capacity * 8)
+        table.capacity *= 2;
+
+    table.ctrl  = (int8_t *)malloc(table.capacity + GROUP_SIZE);
+    table.slots = (sym_slot_t *)calloc(table.capacity, sizeof(sym_slot_t));
+
+    memset(table.ctrl, CTRL_EMPTY, table.capacity + GROUP_SIZE);
+
+    return table;
+}
+
+void symTableDtor(sym_table_t * table)
+{
+    assert(table);
+
+    for (size_t slot_index = 0; slot_index < table->capacity; slot_index++){
+        sym_slot_t * slot = table->slots + slot_index;
+
+        if (table->ctrl[slot_index] != CTRL_EMPTY && slot->len >= SYM_INLINE_LEN)
+            free(slot->name.long_name);
+    }
+
+    free(table->ctrl);
+    free(table->slots);
+
+    table->ctrl     = NULL;
+    table->slots    = NULL;
+    table->capacity = 0;
+    table->size     = 0;
+}
+
+static uint64_t nameHash(const char * name, size_t len)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (size_t index = 0; index < len; index++)
+        hash = (hash ^ (uint8_t)name[index]) * 0x100000001B3ull;
+
+    return hash ^ (hash >> 32);
+}
+
+/// bit i is set if control byte i of the group is equal to ctrl
+static uint32_t groupMatch(const int8_t * group, int8_t ctrl)
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+#else
+    uint32_t mask = 0;
+
+    for (size_t index = 0; index < GROUP_SIZE; index++)
+        if (group[index] == ctrl)
+            mask |= 1u << index;
+
+    return mask;
+#endif
+}
+
+static const char * slotName(const sym_slot_t * slot)
+{
+    return (slot->len < SYM_INLINE_LEN) ? slot->name.inline_name : slot->name.long_name;
+}
+
+static void setCtrl(sym_table_t * table, size_t slot_index, int8_t ctrl)
+{
+    table->ctrl[slot_index] = ctrl;
+
+    if (slot_index < GROUP_SIZE)
+        table->ctrl[table->capacity + slot_index] = ctrl;
+}
+
+/// index of slot with the name if found, else index of the empty slot for it
+static size_t findSlot(const sym_table_t * table, const char * name, size_t len, uint64_t hash, bool * found)
+{
+    size_t mask = table->capacity - 1;
+    int8_t h2 = (int8_t)(hash & 0x7F);
+
+    size_t pos = (hash >> 7) & mask;
+
+    /* table always has empty slots, so the loop ends */
+    while (true){
+        const int8_t * group = table->ctrl + pos;
+
+        uint32_t matches = groupMatch(group, h2);
+
+        while (matches != 0){
+            size_t slot_index = (pos + (size_t)__builtin_ctz(matches)) & mask;
+            const sym_slot_t * slot = table->slots + slot_index;
+
+            if (slot->len == len && memcmp(slotName(slot), name, len) == 0){
+                *found = true;
+                return slot_index;
+            }
+
+            matches &= matches - 1;
+        }
+
+        uint32_t empties = groupMatch(group, CTRL_EMPTY);
+
+        if (empties != 0){
+            *found = false;
+            return (pos + (size_t)__builtin_ctz(empties)) & mask;
+        }
+
+        pos = (pos + GROUP_SIZE) & mask;
+    }
+}
+
+size_t symLookup(const sym_table_t * table, const char * name)
+{
+    assert(table);
+    assert(name);
+
+    size_t len = strlen(name);
+    bool found = false;
+
+    size_t slot_index = findSlot(table, name, len, nameHash(name, len), &found);
+
+    return found ? table->slots[slot_index].value : SYM_NONE;
+}
+
+static void symRehash(sym_table_t * table, size_t new_capacity)
+{
+    sym_table_t new_table = {};
+
+    new_table.capacity = new_capacity;
+    new_table.size     = table->size;
+
+    new_table.ctrl  = (int8_t *)malloc(new_capacity + GROUP_SIZE);
+    new_table.slots = (sym_slot_t *)calloc(new_capacity, sizeof(sym_slot_t));
+
+    memset(new_table.ctrl, CTRL_EMPTY, new_capacity + GROUP_SIZE);
+
+    /* slots are moved with their names, long names keep their memory */
+    for (size_t slot_index = 0; slot_index < table->capacity; slot_index++){
+        if (table->ctrl[slot_index] == CTRL_EMPTY)
+            continue;
+
+        sym_slot_t * slot = table->slots + slot_index;
+
+        uint64_t hash = nameHash(slotName(slot), slot->len);
+        bool found = false;
+
+        size_t new_index = findSlot(&new_table, slotName(slot), slot->len, hash, &found);
+
+        new_table.slots[new_index] = *slot;
+        setCtrl(&new_table, new_index, table->ctrl[slot_index]);
+    }
+
+    free(table->ctrl);
+    free(table->slots);
+
+    *table = new_table;
+}
+
+size_t symInsert(sym_table_t * table, const char * name, size_t value)
+{
+    assert(table);
+    assert(name);
+
+    size_t len = strlen(name);
+    uint64_t hash = nameHash(name, len);
+    bool found = false;
+
+    size_t slot_index = findSlot(table, name, len, hash, &found);
+
+    if (found)
+        return table->slots[slot_index].value;
+
+    if ((table->size + 1) * 8 > table->capacity * 7){
+        symRehash(table, table->capacity * 2);
+        slot_index = findSlot(table, name, len, hash, &found);
+    }
+
+    sym_slot_t * slot = table->slots + slot_index;
+
+    slot->len   = len;
+    slot->value = value;
+
+    if (len < SYM_INLINE_LEN)
+        memcpy(slot->name.inline_name, name, len + 1);
+    else
+        slot->name.long_name = strdup(name);
+
+    setCtrl(table, slot_index, (int8_t)(hash & 0x7F));
+    table->size++;
+
+    return value;
+}
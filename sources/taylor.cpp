@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "taylor.h"
+#include "differ.h"
+#include "codegen.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+/// centers evaluated by one task of taylorTable()
+static const size_t CENTERS_PER_TASK = 64;
+
+/// shared state of taylorTable() tasks
+typedef struct {
+    taylor_table_t * table;
+
+    expr_code_t code;               ///< all derivatives, their common subexpressions are computed once
+    const double * inv_factorials;
+
+    double * scratch;               ///< registers, values of variables and outputs of every thread
+    size_t scratch_size;
+    size_t values_num;
+} table_ctx_t;
+
+static node_t * newShiftNode(unsigned int var_index, double center);
+
+static void tableTask(void * context, size_t task_index, size_t thread_index);
+
+taylor_poly_t taylorPolynomial(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point, size_t last_member_index)
+{
+    assert(diff);
+    assert(expr_node);
+
+    trace_span_t span = traceBeginNum("taylorPolynomial", "members", (long)last_member_index);
+
+    taylor_poly_t poly = {};
+
+    poly.center    = diff_point;
+    poly.var_index = var_index;
+    poly.coeffs    = (double *)calloc(last_member_index + 1, sizeof(double));
+
+    poly.coeffs_num = taylorDerivatives(diff, expr_node, var_index, diff_point, last_member_index, poly.coeffs);
+
+    /* 1/k! is made step by step, so it goes to zero instead of dividing by infinite factorial */
+    double inv_factorial = 1.;
+
+    for (size_t order = 0; order < poly.coeffs_num; order++){
+        if (order > 1)
+            inv_factorial /= (double)order;
+
+        poly.coeffs[order] *= inv_factorial;
+    }
+
+    traceEnd(&span);
+
+    return poly;
+}
+
+void taylorPolyDtor(taylor_poly_t * poly)
+{
+    assert(poly);
+
+    free(poly->coeffs);
+
+    poly->coeffs     = NULL;
+    poly->coeffs_num = 0;
+}
+
+double polyEvaluate(const taylor_poly_t * poly, double x)
+{
+    assert(poly);
+
+    if (poly->coeffs_num == 0)
+        return 0.;
+
+    double shift  = x - poly->center;
+    double result = poly->coeffs[poly->coeffs_num - 1];
+
+    for (size_t order = poly->coeffs_num - 1; order > 0; order--)
+        result = result * shift + poly->coeffs[order - 1];
+
+    return result;
+}
+
+void polyEvaluateBatch(const taylor_poly_t * poly, const double * xs, double * ys, size_t points_num)
+{
+    assert(poly);
+    assert(xs || points_num == 0);
+    assert(ys || points_num == 0);
+
+    size_t point_index = 0;
+
+#ifdef __SSE2__
+    if (poly->coeffs_num > 0){
+        const double * coeffs = poly->coeffs;
+        size_t last = poly->coeffs_num - 1;
+
+        __m128d center = _mm_set1_pd(poly->center);
+
+        /* two independent chains of 2 points hide latency of multiply-add */
+        for (; point_index + 4 <= points_num; point_index += 4){
+            __m128d shift_lo = _mm_sub_pd(_mm_loadu_pd(xs + point_index),     center);
+            __m128d shift_hi = _mm_sub_pd(_mm_loadu_pd(xs + point_index + 2), center);
+
+            __m128d result_lo = _mm_set1_pd(coeffs[last]);
+            __m128d result_hi = result_lo;
+
+            for (size_t order = last; order > 0; order--){
+                __m128d coeff = _mm_set1_pd(coeffs[order - 1]);
+
+                result_lo = _mm_add_pd(_mm_mul_pd(result_lo, shift_lo), coeff);
+                result_hi = _mm_add_pd(_mm_mul_pd(result_hi, shift_hi), coeff);
+            }
+
+            _mm_storeu_pd(ys + point_index,     result_lo);
+            _mm_storeu_pd(ys + point_index + 2, result_hi);
+        }
+    }
+#endif
+
+    for (; point_index < points_num; point_index++)
+        ys[point_index] = polyEvaluate(poly, xs[point_index]);
+}
+
+/// x - a or just x if a is zero
+static node_t * newShiftNode(unsigned int var_index, double center)
+{
+    if (center == 0.)
+        return newVarNode(var_index);
+
+    return newOprNode(SUB, newVarNode(var_index), newNumNode(center));
+}
+
+node_t * polyToTree(const taylor_poly_t * poly)
+{
+    assert(poly);
+
+    if (poly->coeffs_num == 0)
+        return newNumNode(0.);
+
+    node_t * horner = newNumNode(poly->coeffs[poly->coeffs_num - 1]);
+
+    for (size_t order = poly->coeffs_num - 1; order > 0; order--){
+        horner = newOprNode(ADD,
+                    newNumNode(poly->coeffs[order - 1]),
+                    newOprNode(MUL,
+                        newShiftNode(poly->var_index, poly->center),
+                        horner
+                    )
+                );
+    }
+
+    return horner;
+}
+
+node_t * taylorSeriesHorner(diff_t * diff, node_t * expr_node, unsigned int var_index, double diff_point, size_t last_member_index)
+{
+    assert(diff);
+    assert(expr_node);
+
+    taylor_poly_t poly = taylorPolynomial(diff, expr_node, var_index, diff_point, last_member_index);
+
+    node_t * horner = polyToTree(&poly);
+
+    taylorPolyDtor(&poly);
+
+    return horner;
+}
+
+static void tableTask(void * context, size_t task_index, size_t thread_index)
+{
+    table_ctx_t * ctx = (table_ctx_t *)context;
+    taylor_table_t * table = ctx->table;
+
+    double * regs       = ctx->scratch + thread_index * ctx->scratch_size;
+    double * var_values = regs + ctx->code.size;
+    double * outputs    = var_values + ctx->values_num;
+
+    size_t first = task_index * CENTERS_PER_TASK;
+    size_t last  = first + CENTERS_PER_TASK;
+
+    if (last > table->centers_num)
+        last = table->centers_num;
+
+    for (size_t center_index = first; center_index < last; center_index++){
+        var_values[table->var_index] = table->centers[center_index];
+
+        codeEvaluate(&ctx->code, var_values, regs, outputs);
+
+        double * row = table->coeffs + center_index * table->coeffs_num;
+
+        for (size_t order = 0; order < table->coeffs_num; order++)
+            row[order] = outputs[order] * ctx->inv_factorials[order];
+    }
+}
+
+taylor_table_t taylorTable(diff_t * diff, node_t * expr_node, unsigned int var_index, const double * centers, size_t centers_num,
+                           size_t last_member_index, thread_pool_t * pool)
+{
+    assert(diff);
+    assert(expr_node);
+    assert(centers || centers_num == 0);
+
+    trace_span_t span = traceBeginNum("taylorTable", "centers", (long)centers_num);
+
+    taylor_table_t table = {};
+
+    table.var_index   = var_index;
+    table.centers_num = centers_num;
+    table.centers     = (double *)calloc(centers_num + 1, sizeof(double));
+
+    if (centers_num > 0)
+        memcpy(table.centers, centers, centers_num * sizeof(double));
+
+    if (last_member_index == 0){
+        table.coeffs = (double *)calloc(1, sizeof(double));
+        traceEnd(&span);
+
+        return table;
+    }
+
+    /* derivatives do not depend on the center, so they are made only once */
+    nth_derivative_t nth = makeNthDerivative(diff, expr_node, var_index, last_member_index - 1, NULL);
+
+    table_ctx_t ctx = {};
+
+    ctx.table = &table;
+    ctx.code  = codeCtor();
+
+    for (size_t order = 0; order < nth.orders_num; order++)
+        codeAddTree(&ctx.code, nth.derivatives[order]);
+
+    codeStrengthReduce(&ctx.code);
+
+    table.coeffs_num = nth.orders_num;
+    table.coeffs     = (double *)calloc(centers_num * table.coeffs_num + 1, sizeof(double));
+
+    nthDerivativeDtor(&nth);
+
+    double * inv_factorials = (double *)calloc(table.coeffs_num, sizeof(double));
+    inv_factorials[0] = 1.;
+
+    for (size_t order = 1; order < table.coeffs_num; order++)
+        inv_factorials[order] = inv_factorials[order - 1] / (double)order;
+
+    ctx.inv_factorials = inv_factorials;
+
+    /* other variables keep values from diff in copies of every thread */
+    size_t threads_num = (pool != NULL) ? threadPoolSize(pool) : 1;
+
+    ctx.values_num   = (var_index < diff->var_num) ? diff->var_num : var_index + 1;
+    ctx.scratch_size = ctx.code.size + ctx.values_num + table.coeffs_num;
+    ctx.scratch      = (double *)calloc(threads_num * ctx.scratch_size, sizeof(double));
+
+    for (size_t thread_index = 0; thread_index < threads_num; thread_index++){
+        double * var_values = ctx.scratch + thread_index * ctx.scratch_size + ctx.code.size;
+
+        if (diff->var_num > 0)
+            memcpy(var_values, diff->var_values, diff->var_num * sizeof(double));
+    }
+
+    size_t tasks_num = (centers_num + CENTERS_PER_TASK - 1) / CENTERS_PER_TASK;
+
+    if (pool == NULL){
+        for (size_t task_index = 0; task_index < tasks_num; task_index++)
+            tableTask(&ctx, task_index, 0);
+    }
+    else
+        threadPoolFor(pool, tasks_num, tableTask, &ctx);
+
+    free(ctx.scratch);
+    free(inv_factorials);
+    codeDtor(&ctx.code);
+
+    traceEnd(&span);
+
+    return table;
+}
+
+void taylorTableDtor(taylor_table_t * table)
+{
+    assert(table);
+
+    free(table->coeffs);
+    free(table->centers);
+
+    *table = {};
+}
+
+taylor_poly_t taylorTableRow(const taylor_table_t * table, size_t center_index)
+{
+    assert(table);
+    assert(center_index < table->centers_num);
+
+    taylor_poly_t poly = {};
+
+    poly.coeffs     = table->coeffs + center_index * table->coeffs_num;
+    poly.coeffs_num = table->coeffs_num;
+    poly.center     = table->centers[center_index];
+    poly.var_index  = table->var_index;
+
+    return poly;
+}
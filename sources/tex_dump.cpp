@@ -1,15 +1,134 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <stdint.h>
 #include <math.h>
 
 #include "tex_dump.h"
 #include "differ.h"
 #include "bintree.h"
+#include "sampling.h"
+#include "trace.h"
+#include "trav_stack.h"
 
-static void dumpToTEXrecursive(tex_dump_t * tex, diff_t * diff, node_t * node, node_t * parent);
+const size_t TEX_COMMAND_LEN = 512;
 
-static void operatorDump(tex_dump_t * tex, diff_t * diff, node_t * node, node_t * parent);
+/// written part of the document, owned by the writer thread after pushing
+typedef struct {
+    FILE * out;
+    char * text;
+    size_t size;
+} section_job_t;
+
+/// end of the document: the writer thread closes the file and queues pdflatex
+typedef struct {
+    FILE * out;
+    char * file_name;
+    job_queue_t * latex;
+} close_job_t;
+
+static void writePreamble(FILE * file);
+
+static void pushSection(tex_dump_t * tex);
+
+static void writeSection(void * arg);
+
+static void closeDocument(void * arg);
+
+static void runLatex(void * arg);
+
+static bool needBrackets(enum oper op_num, bool has_parent, enum oper parent_op);
+
+static void numberDump(tex_dump_t * tex, double number);
+
+static void operatorPrefix(tex_dump_t * tex, enum oper op_num, bool need_brackets);
+
+static void operatorInfix(tex_dump_t * tex, enum oper op_num);
+
+static void operatorSuffix(tex_dump_t * tex, enum oper op_num, bool need_brackets);
+
+/// set of subterms compared by structure, every term has index
+typedef struct {
+    node_t ** slots;
+    size_t * indices;
+    size_t capacity;
+    size_t size;
+} term_set_t;
+
+/// subterms named T_1, T_2, ... by TexSimplifySteps(), they are copies owned by the table
+typedef struct {
+    node_t ** terms;
+    size_t terms_num;
+    size_t capacity;
+
+    term_set_t set;
+} tex_names_t;
+
+/// state of one formula: subterms are replaced by names, formula is elided when budget is over
+typedef struct {
+    tex_names_t * names;
+    const term_set_t * unchanged;   ///< big subterms of the previous step, NULL - new names are not made
+    const node_t * defined;         ///< term whose definition is dumped, it is not replaced by its own name
+    size_t budget;
+} render_ctx_t;
+
+/// state of TexSimplifySteps()
+typedef struct {
+    const tex_steps_t * limits;
+
+    tex_names_t names;
+    node_t * shown;                 ///< copy of the last rendered tree
+    size_t rendered;
+    size_t skipped;
+} steps_state_t;
+
+const size_t TEX_NO_TERM = SIZE_MAX;
+
+const size_t TEX_TITLE_LEN = 128;
+
+static void termSetDtor(term_set_t * set);
+
+static void termSetInsert(term_set_t * set, node_t * node, size_t index);
+
+static size_t termSetFind(const term_set_t * set, const node_t * node);
+
+static void collectTerms(term_set_t * set, node_t * root, size_t min_size);
+
+static size_t addName(tex_names_t * names, node_t * node);
+
+static void namesDtor(tex_names_t * names);
+
+static bool dumpReplacement(tex_dump_t * tex, render_ctx_t * ctx, node_t * node);
+
+static void dumpStep(tex_dump_t * tex, diff_t * diff, node_t * node, steps_state_t * state, const term_set_t * unchanged);
+
+static void showStep(tex_dump_t * tex, diff_t * diff, node_t * node, steps_state_t * state, const char * title, bool force);
+
+static void dumpTree(tex_dump_t * tex, diff_t * diff, node_t * root, render_ctx_t * ctx);
+
+static void flatDumpTree(tex_dump_t * tex, diff_t * diff, const flat_expr_t * flat);
+
+tex_pipeline_t texPipelineCtor(size_t latex_num, size_t max_pending)
+{
+    tex_pipeline_t pipeline = {};
+
+    pipeline.writer = jobQueueCtor(1, max_pending);
+    pipeline.latex  = jobQueueCtor(latex_num, max_pending);
+
+    return pipeline;
+}
+
+void texPipelineDtor(tex_pipeline_t * pipeline)
+{
+    assert(pipeline);
+
+    /* writer queues pdflatex runs, so it is stopped first */
+    jobQueueDtor(pipeline->writer);
+    jobQueueDtor(pipeline->latex);
+
+    *pipeline = {};
+}
 
 tex_dump_t startTexDump(const char * file_name)
 {
@@ -20,7 +139,31 @@ tex_dump_t startTexDump(const char * file_name)
     tex.file_name = file_name;
     tex.file = fopen(file_name, "w");
 
-    fprintf(tex.file,
+    writePreamble(tex.file);
+
+    return tex;
+}
+
+tex_dump_t startTexDumpAsync(const char * file_name, tex_pipeline_t * pipeline)
+{
+    assert(file_name);
+    assert(pipeline);
+
+    tex_dump_t tex = {};
+
+    tex.file_name = file_name;
+    tex.pipeline  = pipeline;
+    tex.out       = fopen(file_name, "w");
+    tex.file      = open_memstream(&tex.section, &tex.section_size);
+
+    writePreamble(tex.file);
+
+    return tex;
+}
+
+static void writePreamble(FILE * file)
+{
+    fprintf(file,
         "\\documentclass{article}\n"
         "\\usepackage[utf8]{inputenc}\n"
         "\\usepackage[T2A]{fontenc}\n"
@@ -38,8 +181,85 @@ tex_dump_t startTexDump(const char * file_name)
         "\\date{}\n"
         "\\begin{document}\n"
         "\t\\maketitle\n");
+}
 
-    return tex;
+/// closes buffer of the current section and queues it to the writer thread
+static void pushSection(tex_dump_t * tex)
+{
+    fclose(tex->file);
+
+    section_job_t * job = (section_job_t *)calloc(1, sizeof(section_job_t));
+
+    job->out  = tex->out;
+    job->text = tex->section;
+    job->size = tex->section_size;
+
+    jobQueuePush(tex->pipeline->writer, writeSection, job);
+
+    tex->file         = NULL;
+    tex->section      = NULL;
+    tex->section_size = 0;
+}
+
+void texEndSection(tex_dump_t * tex)
+{
+    assert(tex);
+
+    if (tex->pipeline == NULL)
+        return;
+
+    pushSection(tex);
+
+    tex->file = open_memstream(&tex->section, &tex->section_size);
+}
+
+static void writeSection(void * arg)
+{
+    section_job_t * job = (section_job_t *)arg;
+
+    trace_span_t span = traceBeginNum("writeSection", "bytes", (long)job->size);
+
+    fwrite(job->text, 1, job->size, job->out);
+
+    traceEnd(&span);
+
+    free(job->text);
+    free(job);
+}
+
+static void closeDocument(void * arg)
+{
+    close_job_t * job = (close_job_t *)arg;
+
+    fclose(job->out);
+
+    /* pdflatex gets the file only after all its sections are written */
+    jobQueuePush(job->latex, runLatex, job->file_name);
+
+    free(job);
+}
+
+static void runLatex(void * arg)
+{
+    char * file_name = (char *)arg;
+
+    /* file name is freed before the trace is written, so the span has no arguments */
+    stats_timer_t timer = statsPhaseBegin(PHASE_TEX);
+    trace_span_t span = traceBegin("pdflatex");
+
+    char system_str[TEX_COMMAND_LEN] = "";
+
+    /* nobody answers pdflatex questions in background, batch mode also keeps the terminal quiet
+       without redirection to a platform specific null device */
+    snprintf(system_str, TEX_COMMAND_LEN, "pdflatex -interaction=batchmode %s", file_name);
+
+    if (system(system_str) != 0)
+        fprintf(stderr, "pdflatex failed on %s\n", file_name);
+
+    traceEnd(&span);
+    statsPhaseEnd(timer);
+
+    free(file_name);
 }
 
 void endTexDump(tex_dump_t * tex)
@@ -47,6 +267,23 @@ void endTexDump(tex_dump_t * tex)
     assert(tex);
 
     fprintf(tex->file, "\\end{document}\n");
+
+    if (tex->pipeline != NULL){
+        pushSection(tex);
+
+        close_job_t * job = (close_job_t *)calloc(1, sizeof(close_job_t));
+
+        job->out       = tex->out;
+        job->file_name = strdup(tex->file_name);
+        job->latex     = tex->pipeline->latex;
+
+        jobQueuePush(tex->pipeline->writer, closeDocument, job);
+
+        tex->out = NULL;
+
+        return;
+    }
+
     fclose(tex->file);
 
     const size_t BUFFER_LEN = 128;
@@ -56,7 +293,14 @@ void endTexDump(tex_dump_t * tex)
     sprintf(system_str, "pdflatex %s", tex->file_name);
 
     printf("%s\n", system_str);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_TEX);
+    trace_span_t span = traceBegin("pdflatex");
+
     system(system_str);
+
+    traceEnd(&span);
+    statsPhaseEnd(timer);
 }
 
 void dumpToTEX(tex_dump_t * tex, diff_t * diff, node_t * node)
@@ -65,107 +309,257 @@ void dumpToTEX(tex_dump_t * tex, diff_t * diff, node_t * node)
     assert(diff);
     assert(node);
 
+    stats_timer_t timer = statsPhaseBegin(PHASE_TEX);
+    trace_span_t span = traceBegin("dumpToTEX");
+
     fprintf(tex->file, "$ ");
 
-    dumpToTEXrecursive(tex, diff, node, NULL);
+    dumpTree(tex, diff, node, NULL);
+
+    traceEnd(&span);
+    statsPhaseEnd(timer);
 
     fprintf(tex->file, " $\n\n");
     fprintf(tex->file, "\\vspace{3mm}\n");
 }
 
-static void dumpToTEXrecursive(tex_dump_t * tex, diff_t * diff, node_t * node, node_t * parent)
+static bool needBrackets(enum oper op_num, bool has_parent, enum oper parent_op)
 {
-    assert(tex);
-    assert(diff);
-    assert(node);
+    return has_parent && !opers[op_num].binary && opers[parent_op].priority > opers[op_num].priority;
+}
 
-    if (type_(node) == NUM){
-        if (val_(node).number < 0)
-            fprintf(tex->file, "(%lg)", val_(node).number);
-        else
-            fprintf(tex->file, "%lg", val_(node).number);
+static void numberDump(tex_dump_t * tex, double number)
+{
+    if (number < 0)
+        fprintf(tex->file, "(%lg)", number);
+    else
+        fprintf(tex->file, "%lg", number);
+}
+
+/// part of operation before the left operand
+static void operatorPrefix(tex_dump_t * tex, enum oper op_num, bool need_brackets)
+{
+    if (need_brackets)
+        fprintf(tex->file, "(");
+
+    if (opers[op_num].binary){
+        if (op_num == DIV)
+            fprintf(tex->file, "\\frac{");
 
         return;
     }
 
-    if (type_(node) == VAR){
-        fprintf(tex->file, "%s", diff->vars[val_(node).op].name);
-        return;
+    switch(op_num) {
+        case COS: case SIN: case TAN: case LN:
+            fprintf(tex->file, "\\%s(", opers[op_num].name);
+            break;
+
+        case FAC:
+            break;
+
+        default:
+            fprintf(tex->file, "%s", opers[op_num].name);
+            break;
     }
+}
+
+/// part of binary operation between operands
+static void operatorInfix(tex_dump_t * tex, enum oper op_num)
+{
+    switch(op_num){
+        case DIV:
+            fprintf(tex->file, "}{");
+            break;
+
+        case POW:
+            fprintf(tex->file, "^{");
+            break;
+
+        case MUL:
+            fprintf(tex->file, " \\cdot ");
+            break;
 
-    operatorDump(tex, diff, node, parent);
+        default:
+            fprintf(tex->file, " %s ", opers[op_num].name);
+            break;
+    }
 }
 
-static void operatorDump(tex_dump_t * tex, diff_t * diff, node_t * node, node_t * parent)
+/// part of operation after the last operand
+static void operatorSuffix(tex_dump_t * tex, enum oper op_num, bool need_brackets)
 {
-    enum oper op_num = val_(node).op;
+    switch(op_num) {
+        case DIV: case POW:
+            fprintf(tex->file, "}");
+            break;
 
-    bool need_brackets = false;
+        case COS: case SIN: case TAN: case LN:
+            fprintf(tex->file, ")");
+            break;
 
-    if (parent != NULL){
-        enum oper parent_op = val_(parent).op;
+        case FAC:
+            fprintf(tex->file, "!");
+            break;
 
-        if (! opers[op_num].binary && opers[parent_op].priority > opers[op_num].priority)
-            need_brackets = true;
+        default:
+            break;
     }
 
     if (need_brackets)
-        fprintf(tex->file, "(");
+        fprintf(tex->file, ")");
+}
 
-    if (opers[op_num].binary){
-        switch(op_num){
-            case DIV:
-                fprintf(tex->file, "\\frac{");
+/// stage of operation: 0 - before left operand, 1 - before right operand, 2 - after operands
+typedef struct {
+    node_t * node;
+    node_t * parent;
+    int stage;
+} dump_frame_t;
+
+typedef struct {
+    uint32_t index;
+    uint32_t parent;
+    int stage;
+} flat_dump_frame_t;
+
+/// ctx is NULL if the whole tree is dumped
+static void dumpTree(tex_dump_t * tex, diff_t * diff, node_t * root, render_ctx_t * ctx)
+{
+    trav_stack_t<dump_frame_t> frames;
+    stackInit(&frames);
 
-                dumpToTEXrecursive(tex, diff, node->left, node);
-                fprintf(tex->file, "}{");
-                dumpToTEXrecursive(tex, diff, node->right, node);
+    stackPush(&frames, {root, NULL, 0});
 
-                fprintf(tex->file, "}");
-                break;
+    while (frames.size > 0){
+        dump_frame_t * frame = stackTop(&frames);
+        node_t * node = frame->node;
+
+        if (type_(node) == DRV)
+            expandDeferred(node);
+
+        if (ctx != NULL && frame->stage == 0 && dumpReplacement(tex, ctx, node)){
+            stackPop(&frames);
+            continue;
+        }
 
-            case POW:
-                dumpToTEXrecursive(tex, diff, node->left, node);
-                fprintf(tex->file, "^{");
-                dumpToTEXrecursive(tex, diff, node->right, node);
-                fprintf(tex->file, "}");
+        if (type_(node) == NUM){
+            numberDump(tex, val_(node).number);
+            stackPop(&frames);
+            continue;
+        }
+
+        if (type_(node) == VAR){
+            fprintf(tex->file, "%s", diff->var_names[val_(node).var]);
+            stackPop(&frames);
+            continue;
+        }
+
+        enum oper op_num = val_(node).op;
+        bool need_brackets = needBrackets(op_num, frame->parent != NULL,
+                                          (frame->parent != NULL) ? val_(frame->parent).op : ADD);
+
+        /* frame is changed before push, push can move the stack */
+        switch (frame->stage){
+            case 0:
+                operatorPrefix(tex, op_num, need_brackets);
+
+                frame->stage = 1;
+                stackPush(&frames, {node->left, node, 0});
                 break;
 
-            case MUL:
-                dumpToTEXrecursive(tex, diff, node->left, node);
-                fprintf(tex->file, " \\cdot ");
-                dumpToTEXrecursive(tex, diff, node->right, node);
+            case 1:
+                frame->stage = 2;
+
+                if (opers[op_num].binary){
+                    operatorInfix(tex, op_num);
+                    stackPush(&frames, {node->right, node, 0});
+                }
                 break;
 
             default:
-                dumpToTEXrecursive(tex, diff, node->left, node);
-                fprintf(tex->file, " %s ", opers[op_num].name);
-                dumpToTEXrecursive(tex, diff, node->right, node);
+                operatorSuffix(tex, op_num, need_brackets);
+                stackPop(&frames);
                 break;
         }
     }
-    else {
-        switch(op_num) {
-            case COS: case SIN: case TAN: case LN:
-                fprintf(tex->file, "\\%s(", opers[op_num].name);
-                dumpToTEXrecursive(tex, diff, node->left, node);
-                fprintf(tex->file, ")");
+
+    stackDtor(&frames);
+}
+
+
+void flatDumpToTEX(tex_dump_t * tex, diff_t * diff, const flat_expr_t * flat)
+{
+    assert(tex);
+    assert(diff);
+    assert(flat);
+    assert(flat->size > 0);
+
+    stats_timer_t timer = statsPhaseBegin(PHASE_TEX);
+    trace_span_t span = traceBegin("flatDumpToTEX");
+
+    fprintf(tex->file, "$ ");
+
+    flatDumpTree(tex, diff, flat);
+
+    traceEnd(&span);
+    statsPhaseEnd(timer);
+
+    fprintf(tex->file, " $\n\n");
+    fprintf(tex->file, "\\vspace{3mm}\n");
+}
+
+static void flatDumpTree(tex_dump_t * tex, diff_t * diff, const flat_expr_t * flat)
+{
+    trav_stack_t<flat_dump_frame_t> frames;
+    stackInit(&frames);
+
+    stackPush(&frames, {flatRoot(flat), FLAT_NONE, 0});
+
+    while (frames.size > 0){
+        flat_dump_frame_t * frame = stackTop(&frames);
+        uint32_t index = frame->index;
+
+        if (flat->types[index] == NUM){
+            numberDump(tex, flat->values[index].number);
+            stackPop(&frames);
+            continue;
+        }
+
+        if (flat->types[index] == VAR){
+            fprintf(tex->file, "%s", diff->var_names[flat->values[index].var]);
+            stackPop(&frames);
+            continue;
+        }
+
+        enum oper op_num = (enum oper)flat->ops[index];
+        bool need_brackets = needBrackets(op_num, frame->parent != FLAT_NONE,
+                                          (frame->parent != FLAT_NONE) ? (enum oper)flat->ops[frame->parent] : ADD);
+
+        switch (frame->stage){
+            case 0:
+                operatorPrefix(tex, op_num, need_brackets);
+
+                frame->stage = 1;
+                stackPush(&frames, {flat->left[index], index, 0});
                 break;
 
-            case FAC:
-                dumpToTEXrecursive(tex, diff, node->left, node);
-                fprintf(tex->file, "!");
+            case 1:
+                frame->stage = 2;
+
+                if (opers[op_num].binary){
+                    operatorInfix(tex, op_num);
+                    stackPush(&frames, {flat->right[index], index, 0});
+                }
                 break;
 
             default:
-                fprintf(tex->file, "%s", opers[op_num].name);
-                dumpToTEXrecursive(tex, diff, node->left, node);
+                operatorSuffix(tex, op_num, need_brackets);
+                stackPop(&frames);
                 break;
         }
     }
 
-    if (need_brackets)
-        fprintf(tex->file, ")");
+    stackDtor(&frames);
 }
 
 node_t * TexSimplifyExpression(tex_dump_t * tex, diff_t * diff, node_t * node)
@@ -173,6 +567,8 @@ node_t * TexSimplifyExpression(tex_dump_t * tex, diff_t * diff, node_t * node)
     assert(tex);
     assert(node);
 
+    trace_span_t span = traceBegin("TexSimplifyExpression");
+
     bool changing = true;
     while (changing){
         changing = false;
@@ -183,6 +579,8 @@ node_t * TexSimplifyExpression(tex_dump_t * tex, diff_t * diff, node_t * node)
             fprintf(tex->file, "Упрощаем константы...\n\n");
             dumpToTEX(tex, diff, node);
             fprintf(tex->file, "\n\n");
+
+            texEndSection(tex);
         }
 
         changing = false;
@@ -193,11 +591,273 @@ node_t * TexSimplifyExpression(tex_dump_t * tex, diff_t * diff, node_t * node)
             fprintf(tex->file, "Удаляем лишнее...\n\n");
             dumpToTEX(tex, diff, node);
             fprintf(tex->file, "\n\n");
+
+            texEndSection(tex);
         }
         else
             break;
     }
 
+    traceEnd(&span);
+
+    return node;
+}
+
+static void termSetDtor(term_set_t * set)
+{
+    free(set->slots);
+    free(set->indices);
+
+    *set = {};
+}
+
+static void termSetInsert(term_set_t * set, node_t * node, size_t index)
+{
+    /* load factor is not more than 1/2 */
+    if (2 * (set->size + 1) > set->capacity){
+        term_set_t old_set = *set;
+
+        set->capacity = (old_set.capacity == 0) ? 64 : old_set.capacity * 2;
+        set->slots    = (node_t **)calloc(set->capacity, sizeof(node_t *));
+        set->indices  = (size_t   *)calloc(set->capacity, sizeof(size_t));
+        set->size     = 0;
+
+        for (size_t slot = 0; slot < old_set.capacity; slot++)
+            if (old_set.slots[slot] != NULL)
+                termSetInsert(set, old_set.slots[slot], old_set.indices[slot]);
+
+        termSetDtor(&old_set);
+    }
+
+    size_t slot = exprHash(node) & (set->capacity - 1);
+    while (set->slots[slot] != NULL)
+        slot = (slot + 1) & (set->capacity - 1);
+
+    set->slots  [slot] = node;
+    set->indices[slot] = index;
+    set->size++;
+}
+
+/// index of the term equal to node, TEX_NO_TERM if there is no such term
+static size_t termSetFind(const term_set_t * set, const node_t * node)
+{
+    if (set->size == 0)
+        return TEX_NO_TERM;
+
+    size_t slot = exprHash(node) & (set->capacity - 1);
+
+    /* most of different terms are rejected by their hashes */
+    for (; set->slots[slot] != NULL; slot = (slot + 1) & (set->capacity - 1))
+        if (exprEqual(set->slots[slot], node))
+            return set->indices[slot];
+
+    return TEX_NO_TERM;
+}
+
+/// adds operations whose subtrees have at least min_size nodes, equal subtrees are added once
+static void collectTerms(term_set_t * set, node_t * root, size_t min_size)
+{
+    trav_stack_t<trav_frame_t> frames;
+    stackInit(&frames);
+
+    trav_stack_t<size_t> sizes;
+    stackInit(&sizes);
+
+    stackPush(&frames, {root, false});
+
+    while (frames.size > 0){
+        trav_frame_t frame = stackPop(&frames);
+        node_t * node = frame.node;
+
+        if (!frame.expanded){
+            stackPush(&frames, {node, true});
+
+            if (node->right != NULL)
+                stackPush(&frames, {node->right, false});
+
+            if (node->left != NULL)
+                stackPush(&frames, {node->left, false});
+
+            continue;
+        }
+
+        /* sizes of operands are on top of the stack */
+        size_t size = 1;
+
+        if (node->right != NULL)
+            size += stackPop(&sizes);
+
+        if (node->left != NULL)
+            size += stackPop(&sizes);
+
+        stackPush(&sizes, size);
+
+        if (size >= min_size && type_(node) == OPR && termSetFind(set, node) == TEX_NO_TERM)
+            termSetInsert(set, node, 0);
+    }
+
+    stackDtor(&sizes);
+    stackDtor(&frames);
+}
+
+/// copies the term and gives it the next name
+static size_t addName(tex_names_t * names, node_t * node)
+{
+    if (names->terms_num == names->capacity){
+        names->capacity = (names->capacity == 0) ? 16 : names->capacity * 2;
+        names->terms = (node_t **)realloc(names->terms, names->capacity * sizeof(node_t *));
+    }
+
+    size_t index = names->terms_num++;
+
+    names->terms[index] = exprCopy(node);
+    termSetInsert(&names->set, names->terms[index], index);
+
+    return index;
+}
+
+static void namesDtor(tex_names_t * names)
+{
+    for (size_t index = 0; index < names->terms_num; index++)
+        exprDestroy(names->terms[index]);
+
+    free(names->terms);
+    termSetDtor(&names->set);
+
+    *names = {};
+}
+
+/// dumps name of the subterm or elision instead of the subtree, returns false if the subtree must be dumped
+static bool dumpReplacement(tex_dump_t * tex, render_ctx_t * ctx, node_t * node)
+{
+    if (ctx->budget == 0){
+        fprintf(tex->file, "\\ldots");
+        return true;
+    }
+
+    ctx->budget--;
+
+    if (type_(node) != OPR || node == ctx->defined)
+        return false;
+
+    size_t name = termSetFind(&ctx->names->set, node);
+
+    if (name == TEX_NO_TERM && ctx->unchanged != NULL && termSetFind(ctx->unchanged, node) != TEX_NO_TERM)
+        name = addName(ctx->names, node);
+
+    if (name == TEX_NO_TERM)
+        return false;
+
+    fprintf(tex->file, "T_{%zu}", name + 1);
+
+    return true;
+}
+
+/// dumps formula of the step and definitions of names made for it
+static void dumpStep(tex_dump_t * tex, diff_t * diff, node_t * node, steps_state_t * state, const term_set_t * unchanged)
+{
+    stats_timer_t timer = statsPhaseBegin(PHASE_TEX);
+
+    size_t budget    = (state->limits->node_budget == 0) ? SIZE_MAX : state->limits->node_budget;
+    size_t first_new = state->names.terms_num;
+
+    render_ctx_t ctx = {&state->names, unchanged, NULL, budget};
+
+    fprintf(tex->file, "$ ");
+    dumpTree(tex, diff, node, &ctx);
+    fprintf(tex->file, " $\n\n");
+
+    /* definitions use only older names, so they do not make new ones */
+    for (size_t index = first_new; index < state->names.terms_num; index++){
+        ctx = {&state->names, NULL, state->names.terms[index], budget};
+
+        fprintf(tex->file, "$ T_{%zu} = ", index + 1);
+        dumpTree(tex, diff, state->names.terms[index], &ctx);
+        fprintf(tex->file, " $\n\n");
+    }
+
+    fprintf(tex->file, "\\vspace{3mm}\n");
+
+    statsPhaseEnd(timer);
+}
+
+/// renders step if limit of steps is not reached (or force is set), otherwise only counts it
+static void showStep(tex_dump_t * tex, diff_t * diff, node_t * node, steps_state_t * state, const char * title, bool force)
+{
+    if (!force && state->limits->max_steps != 0 && state->rendered >= state->limits->max_steps){
+        state->skipped++;
+        return;
+    }
+
+    /* rules can change operands of kept nodes, so hashes are refreshed before comparison */
+    exprRehashTree(node);
+
+    term_set_t unchanged = {};
+
+    if (state->limits->min_named_size != 0)
+        collectTerms(&unchanged, state->shown, state->limits->min_named_size);
+
+    fprintf(tex->file, "%s\n\n", title);
+    dumpStep(tex, diff, node, state, &unchanged);
+    fprintf(tex->file, "\n\n");
+
+    termSetDtor(&unchanged);
+
+    exprDestroy(state->shown);
+    state->shown = exprCopy(node);
+    state->rendered++;
+
+    texEndSection(tex);
+}
+
+node_t * TexSimplifySteps(tex_dump_t * tex, diff_t * diff, node_t * node, const tex_steps_t * steps)
+{
+    assert(tex);
+    assert(diff);
+    assert(node);
+    assert(steps);
+
+    trace_span_t span = traceBegin("TexSimplifySteps");
+
+    steps_state_t state = {};
+
+    state.limits = steps;
+
+    /* the input is already shown by the caller */
+    exprRehashTree(node);
+    state.shown = exprCopy(node);
+
+    bool changing = true;
+    while (changing){
+        changing = false;
+
+        node = foldConstants(node, NULL, &changing);
+
+        if (changing)
+            showStep(tex, diff, node, &state, "Упрощаем константы...", false);
+
+        changing = false;
+
+        node = deleteNeutral(node, NULL, &changing);
+
+        if (changing)
+            showStep(tex, diff, node, &state, "Удаляем лишнее...", false);
+        else
+            break;
+    }
+
+    if (state.skipped > 0){
+        char title[TEX_TITLE_LEN] = "";
+        snprintf(title, TEX_TITLE_LEN, "Пропущено шагов: %zu. Результат:", state.skipped);
+
+        showStep(tex, diff, node, &state, title, true);
+    }
+
+    exprDestroy(state.shown);
+    namesDtor(&state.names);
+
+    traceEnd(&span);
+
     return node;
 }
 
@@ -208,6 +868,11 @@ void TexMakePlot(tex_dump_t * tex, diff_t * diff, node_t * tree,
     assert(diff);
     assert(tree);
 
+    trace_span_t span = traceBegin("TexMakePlot");
+
+    plot_t plot = sampleAdaptive(diff, tree, var_index, left_border, right_border, &DEFAULT_SAMPLING);
+    downsamplePlot(&plot, num_of_pts);
+
     fprintf(tex->file,
         "\\begin{center}\n"
         "\\begin{tikzpicture}\n"
@@ -216,18 +881,18 @@ void TexMakePlot(tex_dump_t * tex, diff_t * diff, node_t * tree,
         "ylabel={$f(x)$},\n"
         "grid=both,\n"
         "title={График $f(x)$},\n"
+        "unbounded coords=jump,\n"
+        "restrict y to domain*=%lf:%lf,\n"
         "]\n"
-        "\\addplot[mark=none, color=blue] table {\n");
-
-    double step = (right_border - left_border) / num_of_pts;
-
-    for (double cur_x = left_border; cur_x < right_border; cur_x += step){
-        diff->vars[var_index].value = cur_x;
+        "\\addplot[mark=none, color=blue] table {\n", -max_y, max_y);
 
-        double cur_y = evaluate(diff, tree);
+    for (size_t point_index = 0; point_index < plot.size; point_index++){
+        plot_point_t point = plot.points[point_index];
 
-        if (fabs(cur_y) < max_y)
-            fprintf(tex->file, "%lf %lf\n", cur_x, cur_y);
+        if (isnan(point.y))
+            fprintf(tex->file, "%lf nan\n", point.x);
+        else
+            fprintf(tex->file, "%lf %lf\n", point.x, point.y);
     }
 
     fprintf(tex->file,
@@ -235,4 +900,10 @@ void TexMakePlot(tex_dump_t * tex, diff_t * diff, node_t * tree,
         "\\end{axis}\n"
         "\\end{tikzpicture}\n"
         "\\end{center}");
+
+    plotDtor(&plot);
+
+    texEndSection(tex);
+
+    traceEnd(&span);
 }
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "thread_pool.h"
+
+struct thread_pool {
+    std::thread * workers = NULL;
+    size_t workers_num = 0;
+
+    std::mutex for_mutex = {};
+
+    std::mutex mutex = {};
+    std::condition_variable start_cond = {};
+    std::condition_variable  done_cond = {};
+
+    size_t generation = 0;
+    bool stopping = false;
+
+    pool_task_t task = NULL;
+    void * context = NULL;
+    size_t tasks_num = 0;
+
+    std::atomic<size_t> next_task = {0};
+    size_t active_workers = 0;
+};
+
+/// loop whose tasks the thread runs now, loops of different pools can be nested in one thread
+typedef struct task_frame {
+    thread_pool_t * pool;
+    size_t thread_index;
+
+    struct task_frame * outer;
+} task_frame_t;
+
+/// innermost loop of the current thread, NULL outside of tasks
+static thread_local task_frame_t * task_frame = NULL;
+
+static const task_frame_t * findTaskFrame(const thread_pool_t * pool);
+
+static void runTasks(thread_pool_t * pool, size_t thread_index);
+
+static void workerLoop(thread_pool_t * pool, size_t thread_index);
+
+thread_pool_t * threadPoolCtor(size_t threads_num)
+{
+    if (threads_num == 0)
+        threads_num = std::thread::hardware_concurrency();
+
+    if (threads_num == 0)
+        threads_num = 1;
+
+    thread_pool_t * pool = new thread_pool_t();
+
+    pool->workers_num = threads_num - 1;
+    pool->workers = new std::thread[pool->workers_num];
+
+    /* thread 0 is the caller of threadPoolFor */
+    for (size_t worker_index = 0; worker_index < pool->workers_num; worker_index++)
+        pool->workers[worker_index] = std::thread(workerLoop, pool, worker_index + 1);
+
+    return pool;
+}
+
+void threadPoolDtor(thread_pool_t * pool)
+{
+    assert(pool);
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stopping = true;
+    }
+    pool->start_cond.notify_all();
+
+    for (size_t worker_index = 0; worker_index < pool->workers_num; worker_index++)
+        pool->workers[worker_index].join();
+
+    delete [] pool->workers;
+    delete pool;
+}
+
+size_t threadPoolSize(thread_pool_t * pool)
+{
+    assert(pool);
+
+    return pool->workers_num + 1;
+}
+
+static void runTasks(thread_pool_t * pool, size_t thread_index)
+{
+    size_t task_index = 0;
+
+    task_frame_t frame = {pool, thread_index, task_frame};
+    task_frame = &frame;
+
+    while ((task_index = pool->next_task.fetch_add(1, std::memory_order_relaxed)) < pool->tasks_num)
+        pool->task(pool->context, task_index, thread_index);
+
+    task_frame = frame.outer;
+}
+
+/// frame of the loop of this pool that the current thread runs, NULL if there is no such one
+static const task_frame_t * findTaskFrame(const thread_pool_t * pool)
+{
+    for (const task_frame_t * frame = task_frame; frame != NULL; frame = frame->outer)
+        if (frame->pool == pool)
+            return frame;
+
+    return NULL;
+}
+
+static void workerLoop(thread_pool_t * pool, size_t thread_index)
+{
+    size_t seen_generation = 0;
+
+    while (true){
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->start_cond.wait(lock, [&]{ return pool->stopping || pool->generation != seen_generation; });
+
+            if (pool->stopping)
+                return;
+
+            seen_generation = pool->generation;
+        }
+
+        runTasks(pool, thread_index);
+
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+
+            if (--(pool->active_workers) == 0)
+                pool->done_cond.notify_all();
+        }
+    }
+}
+
+void threadPoolFor(thread_pool_t * pool, size_t tasks_num, pool_task_t task, void * context)
+{
+    assert(pool);
+    assert(task);
+
+    if (tasks_num == 0)
+        return;
+
+    /* nested loop of the same pool runs in the calling thread, other threads are busy with the outer loop
+       and waiting for them would deadlock; thread index is kept, so per-thread state is not shared.
+       Loop of other pool runs as usual, its thread indices are its own */
+    const task_frame_t * outer_frame = findTaskFrame(pool);
+
+    if (outer_frame != NULL){
+        for (size_t task_index = 0; task_index < tasks_num; task_index++)
+            task(context, task_index, outer_frame->thread_index);
+
+        return;
+    }
+
+    /* not worth waking workers */
+    if (pool->workers_num == 0 || tasks_num == 1){
+        for (size_t task_index = 0; task_index < tasks_num; task_index++)
+            task(context, task_index, 0);
+
+        return;
+    }
+
+    std::lock_guard<std::mutex> for_lock(pool->for_mutex);
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+
+        pool->task      = task;
+        pool->context   = context;
+        pool->tasks_num = tasks_num;
+        pool->next_task.store(0, std::memory_order_relaxed);
+
+        pool->active_workers = pool->workers_num;
+        pool->generation++;
+    }
+    pool->start_cond.notify_all();
+
+    runTasks(pool, 0);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done_cond.wait(lock, [&]{ return pool->active_workers == 0; });
+}
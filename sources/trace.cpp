@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include <mutex>
+#include <atomic>
+
+#include "trace.h"
+#include "logger.h"
+
+const size_t TRACE_FILE_NAME_LEN = 256;
+
+/// finished spans of one thread
+typedef struct {
+    trace_span_t * spans;
+    uint64_t * end_ns;
+    size_t size;
+    size_t capacity;
+
+    size_t thread_id;
+} trace_buffer_t;
+
+bool tracing_enabled = false;
+
+static struct {
+    std::mutex mutex;
+
+    trace_buffer_t ** buffers;
+    size_t buffers_num;
+    size_t buffers_capacity;
+
+    uint64_t start_ns;
+    std::atomic<unsigned int> generation;   ///< increased on every start so threads drop buffers of previous traces,
+                                            ///< read without the lock by recording threads
+
+    char file_name[TRACE_FILE_NAME_LEN];
+} trace = {};
+
+static thread_local trace_buffer_t * thread_buffer = NULL;
+static thread_local unsigned int thread_generation = 0;
+
+static uint64_t nowNs();
+
+static trace_buffer_t * getThreadBuffer();
+
+static void writeEscaped(FILE * file, const char * str);
+
+static void writeSpan(FILE * file, const trace_span_t * span, uint64_t end_ns, size_t thread_id, bool first);
+
+static uint64_t nowNs()
+{
+    struct timespec time = {};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+/// buffer of the current thread, registers new one on the first span of the thread in this trace
+static trace_buffer_t * getThreadBuffer()
+{
+    std::lock_guard<std::mutex> lock(trace.mutex);
+
+    if (thread_buffer != NULL && thread_generation == trace.generation.load(std::memory_order_relaxed))
+        return thread_buffer;
+
+    trace_buffer_t * buffer = (trace_buffer_t *)calloc(1, sizeof(trace_buffer_t));
+
+    if (trace.buffers_num == trace.buffers_capacity){
+        trace.buffers_capacity = (trace.buffers_capacity == 0) ? 8 : trace.buffers_capacity * 2;
+        trace.buffers = (trace_buffer_t **)realloc(trace.buffers, trace.buffers_capacity * sizeof(trace_buffer_t *));
+    }
+
+    buffer->thread_id = trace.buffers_num + 1;
+    trace.buffers[trace.buffers_num++] = buffer;
+
+    thread_buffer     = buffer;
+    thread_generation = trace.generation.load(std::memory_order_relaxed);
+
+    return buffer;
+}
+
+void traceStart(const char * file_name)
+{
+    assert(file_name);
+
+    std::lock_guard<std::mutex> lock(trace.mutex);
+
+    if (tracing_enabled)
+        return;
+
+    strncpy(trace.file_name, file_name, TRACE_FILE_NAME_LEN - 1);
+
+    trace.generation.fetch_add(1, std::memory_order_relaxed);
+    trace.start_ns = nowNs();
+
+    __atomic_store_n(&tracing_enabled, true, __ATOMIC_RELEASE);
+}
+
+trace_span_t traceSpanStart(const char * name, const char * arg_name, const char * arg_str, long arg_num)
+{
+    assert(name);
+
+    trace_span_t span = {};
+
+    span.active   = true;
+    span.name     = name;
+    span.arg_name = arg_name;
+    span.arg_str  = arg_str;
+    span.arg_num  = arg_num;
+    span.start_ns = nowNs();
+
+    return span;
+}
+
+void traceSpanStop(trace_span_t * span)
+{
+    assert(span);
+
+    uint64_t end_ns = nowNs();
+
+    span->active = false;
+
+    /* tracing was stopped inside the span */
+    if (!__atomic_load_n(&tracing_enabled, __ATOMIC_ACQUIRE))
+        return;
+
+    bool same_trace = thread_buffer != NULL && thread_generation == trace.generation.load(std::memory_order_relaxed);
+    trace_buffer_t * buffer = same_trace ? thread_buffer : getThreadBuffer();
+
+    if (buffer->size == buffer->capacity){
+        buffer->capacity = (buffer->capacity == 0) ? 1024 : buffer->capacity * 2;
+
+        buffer->spans  = (trace_span_t *)realloc(buffer->spans,  buffer->capacity * sizeof(trace_span_t));
+        buffer->end_ns = (uint64_t     *)realloc(buffer->end_ns, buffer->capacity * sizeof(uint64_t));
+    }
+
+    buffer->spans [buffer->size] = *span;
+    buffer->end_ns[buffer->size] = end_ns;
+    buffer->size++;
+}
+
+static void writeEscaped(FILE * file, const char * str)
+{
+    fputc('"', file);
+
+    for (; *str != '\0'; str++){
+        if (*str == '"' || *str == '\\')
+            fputc('\\', file);
+
+        fputc(*str, file);
+    }
+
+    fputc('"', file);
+}
+
+static void writeSpan(FILE * file, const trace_span_t * span, uint64_t end_ns, size_t thread_id, bool first)
+{
+    /* timestamps are in microseconds from the start of the trace */
+    uint64_t start_ns = (span->start_ns > trace.start_ns) ? span->start_ns - trace.start_ns : 0;
+
+    fprintf(file, "%s\n{\"name\": ", first ? "" : ",");
+    writeEscaped(file, span->name);
+
+    fprintf(file, ", \"cat\": \"differ\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f",
+                  thread_id, (double)start_ns / 1000., (double)(end_ns - span->start_ns) / 1000.);
+
+    if (span->arg_name != NULL){
+        fprintf(file, ", \"args\": {");
+        writeEscaped(file, span->arg_name);
+        fprintf(file, ": ");
+
+        if (span->arg_str != NULL)
+            writeEscaped(file, span->arg_str);
+        else
+            fprintf(file, "%ld", span->arg_num);
+
+        fprintf(file, "}");
+    }
+
+    fprintf(file, "}");
+}
+
+void traceStop()
+{
+    std::lock_guard<std::mutex> lock(trace.mutex);
+
+    if (!tracing_enabled)
+        return;
+
+    __atomic_store_n(&tracing_enabled, false, __ATOMIC_RELEASE);
+
+    FILE * file = fopen(trace.file_name, "w");
+
+    if (file == NULL)
+        logPrint(LOG_RELEASE, "cannot open trace file '%s'\n", trace.file_name);
+
+    size_t spans_num = 0;
+
+    if (file != NULL)
+        fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+
+    for (size_t buffer_index = 0; buffer_index < trace.buffers_num; buffer_index++){
+        trace_buffer_t * buffer = trace.buffers[buffer_index];
+
+        if (file != NULL){
+            fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, "
+                          "\"args\": {\"name\": \"thread %zu\"}}", (buffer_index == 0) ? "" : ",",
+                          buffer->thread_id, buffer->thread_id - 1);
+
+            for (size_t span_index = 0; span_index < buffer->size; span_index++)
+                writeSpan(file, buffer->spans + span_index, buffer->end_ns[span_index], buffer->thread_id, false);
+        }
+
+        spans_num += buffer->size;
+
+        free(buffer->spans);
+        free(buffer->end_ns);
+        free(buffer);
+    }
+
+    if (file != NULL){
+        fprintf(file, "\n]}\n");
+        fclose(file);
+    }
+
+    logPrint(LOG_DEBUG, "trace of %zu spans in %zu threads written to '%s'\n", spans_num, trace.buffers_num, trace.file_name);
+
+    free(trace.buffers);
+
+    trace.buffers = NULL;
+    trace.buffers_num = 0;
+    trace.buffers_capacity = 0;
+}
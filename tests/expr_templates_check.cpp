@@ -0,0 +1,50 @@
+/// standalone check of expr_templates.h: it includes nothing else from the project and is linked alone
+
+#include <stdio.h>
+#include <math.h>
+#include <type_traits>
+
+#include "expr_templates.h"
+
+using namespace et;
+
+static int failed = 0;
+
+static void checkValue(const char * name, double value, double expected)
+{
+    if (fabs(value - expected) > 1e-12 * (1. + fabs(expected))){
+        printf("%s: %.17g, expected %.17g\n", name, value, expected);
+        failed++;
+    }
+}
+
+int main()
+{
+    Var<0> x;
+    Var<1> y;
+
+    /* builders fold constants and delete neutral elements while types are made */
+    static_assert(std::is_same<decltype(derivative<0>(x * x)), Opr<ADD, Var<0>, Var<0>>>::value, "x*x' is x + x");
+    static_assert(std::is_same<decltype(derivative<1>(x * x)), Int<0>>::value, "x*x does not depend on y");
+    static_assert(std::is_same<decltype(2_c + 3_c), Int<5>>::value, "integers are folded");
+    static_assert(depends_on_v<1, decltype(sin(x * y))>, "sin(x*y) depends on y");
+
+    double vars[] = {0.7, 1.3};
+    double xv = vars[0], yv = vars[1];
+
+    auto f = x * sin(y) + pow(ln(x), 2_c);
+
+    checkValue("f",     f(vars), xv * ::sin(yv) + ::log(xv) * ::log(xv));
+    checkValue("df/dx", derivative<0>(f)(vars), ::sin(yv) + 2. * ::log(xv) / xv);
+    checkValue("df/dy", derivative<1>(f)(vars), xv * ::cos(yv));
+
+    auto g = tan(x) / (y + 1.) - cos(x * y);
+
+    checkValue("dg/dx", derivative<0>(g)(vars), 1. / (::cos(xv) * ::cos(xv)) / (yv + 1.) + yv * ::sin(xv * yv));
+    checkValue("d2(x^3)", nthDerivative<0, 2>(pow(x, 3_c))(vars), 6. * xv);
+
+    if (failed == 0)
+        printf("expr_templates: ok\n");
+
+    return failed;
+}
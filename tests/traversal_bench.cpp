@@ -0,0 +1,271 @@
+/// benchmark of the iterative tree walks against recursive reference versions of the same walks
+/// on shallow (balanced) and deep (chain) trees of the same size, prints time per node
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bintree.h"
+#include "differ.h"
+
+const size_t SMALL_TREE_TERMS = 100;
+const size_t LARGE_TREE_TERMS = 5000;     ///< deep chain is still safe for the recursive versions with 8 MB stack
+
+const size_t NODES_PER_MEASURE = 5000000;
+
+/// one walk over the tree, returns something depending on the result so it is not optimized out
+typedef double (*walk_func_t)(node_t * tree);
+
+typedef struct {
+    const char * name;
+    walk_func_t recursive;
+    walk_func_t iterative;
+} walk_t;
+
+static double nowSec();
+
+static node_t * makeTerm(size_t index);
+
+static node_t * makeBalanced(size_t first, size_t terms_num);
+
+static node_t * makeChain(size_t terms_num);
+
+static node_t * copyRecursive(node_t * node);
+
+static void destroyRecursive(node_t * node);
+
+static double evaluateRecursive(node_t * node, const double * var_values);
+
+static node_t * derivativeRecursive(node_t * node, unsigned int var_index);
+
+static double copyDestroyRec (node_t * tree);
+static double copyDestroyIter(node_t * tree);
+static double evaluateRec    (node_t * tree);
+static double evaluateIter   (node_t * tree);
+static double derivativeRec  (node_t * tree);
+static double derivativeIter (node_t * tree);
+
+static double measure(walk_func_t walk, node_t * tree, size_t tree_size);
+
+static const double VAR_VALUES[] = {0.7};
+
+static diff_t bench_diff = {};
+
+static double nowSec()
+{
+    struct timespec time = {};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+/// small term without multiplication of large operands, so derivatives stay linear in size
+static node_t * makeTerm(size_t index)
+{
+    switch (index % 4){
+        case 0:
+            return newOprNode(MUL, newNumNode((double)(index % 7 + 1)), newVarNode(0));
+
+        case 1:
+            return newOprNode(SIN, newVarNode(0), NULL);
+
+        case 2:
+            return newOprNode(POW, newVarNode(0), newNumNode(2.));
+
+        default:
+            return newOprNode(DIV, newVarNode(0), newNumNode((double)(index % 5 + 2)));
+    }
+}
+
+/// sum of terms with depth log2(terms_num)
+static node_t * makeBalanced(size_t first, size_t terms_num)
+{
+    if (terms_num == 1)
+        return makeTerm(first);
+
+    size_t half = terms_num / 2;
+
+    return newOprNode((first % 2 == 0) ? ADD : SUB, makeBalanced(first, half), makeBalanced(first + half, terms_num - half));
+}
+
+/// the same sum with depth terms_num
+static node_t * makeChain(size_t terms_num)
+{
+    node_t * tree = makeTerm(0);
+
+    for (size_t index = 1; index < terms_num; index++)
+        tree = newOprNode((index % 2 == 0) ? ADD : SUB, tree, makeTerm(index));
+
+    return tree;
+}
+
+static node_t * copyRecursive(node_t * node)
+{
+    if (node == NULL)
+        return NULL;
+
+    return newNode(node->data, node->elem_size, copyRecursive(node->left), copyRecursive(node->right), node->color_for_dump);
+}
+
+static void destroyRecursive(node_t * node)
+{
+    if (node == NULL)
+        return;
+
+    destroyRecursive(node->left);
+    destroyRecursive(node->right);
+
+    exprDelNode(node);
+}
+
+static double evaluateRecursive(node_t * node, const double * var_values)
+{
+    switch (type_(node)){
+        case NUM:
+            return val_(node).number;
+
+        case VAR:
+            return var_values[val_(node).var];
+
+        default: {
+            enum oper op_num = val_(node).op;
+
+            double left_val  = evaluateRecursive(node->left, var_values);
+            double right_val = opers[op_num].binary ? evaluateRecursive(node->right, var_values) : 0.;
+
+            return calcOper(op_num, left_val, right_val);
+        }
+    }
+}
+
+/// the same rules as makeDerivative, operands are differentiated by recursive calls
+static node_t * derivativeRecursive(node_t * node, unsigned int var_index)
+{
+    switch (type_(node)){
+        case NUM:
+            return newNumNode(0.);
+
+        case VAR:
+            return newNumNode((val_(node).var == var_index) ? 1. : 0.);
+
+        default: {
+            enum oper op_num = val_(node).op;
+
+            node_t * d_left  = derivativeRecursive(node->left, var_index);
+            node_t * d_right = opers[op_num].binary ? derivativeRecursive(node->right, var_index) : NULL;
+
+            return opers[op_num].diffFunc(node, var_index, d_left, d_right, false);
+        }
+    }
+}
+
+static double copyDestroyRec(node_t * tree)
+{
+    node_t * copy = copyRecursive(tree);
+    double result = (double)(size_t)copy->elem_size;
+
+    destroyRecursive(copy);
+
+    return result;
+}
+
+static double copyDestroyIter(node_t * tree)
+{
+    node_t * copy = exprCopy(tree);
+    double result = (double)(size_t)copy->elem_size;
+
+    exprDestroy(copy);
+
+    return result;
+}
+
+static double evaluateRec(node_t * tree)
+{
+    return evaluateRecursive(tree, VAR_VALUES);
+}
+
+static double evaluateIter(node_t * tree)
+{
+    return evaluateWithValues(tree, VAR_VALUES);
+}
+
+static double derivativeRec(node_t * tree)
+{
+    node_t * derivative = derivativeRecursive(tree, 0);
+    double result = (double)type_(derivative);
+
+    destroyRecursive(derivative);
+
+    return result;
+}
+
+static double derivativeIter(node_t * tree)
+{
+    node_t * derivative = makeDerivative(&bench_diff, tree, 0);
+    double result = (double)type_(derivative);
+
+    exprDestroy(derivative);
+
+    return result;
+}
+
+/// nanoseconds per node of the tree, repeats the walk so every measure touches about the same number of nodes
+static double measure(walk_func_t walk, node_t * tree, size_t tree_size)
+{
+    size_t repeats = NODES_PER_MEASURE / tree_size + 1;
+    double checksum = 0.;
+
+    /* warm up allocator and caches */
+    checksum += walk(tree);
+
+    double start = nowSec();
+
+    for (size_t repeat = 0; repeat < repeats; repeat++)
+        checksum += walk(tree);
+
+    double time = nowSec() - start;
+
+    if (checksum == -1.)
+        printf("checksum %g\n", checksum);
+
+    return time * 1e9 / (double)(repeats * tree_size);
+}
+
+int main()
+{
+    diffInit(&bench_diff);
+
+    const walk_t walks[] = {
+        {"copy+destroy", copyDestroyRec, copyDestroyIter},
+        {"evaluate",     evaluateRec,    evaluateIter   },
+        {"derivative",   derivativeRec,  derivativeIter }
+    };
+
+    const size_t sizes[] = {SMALL_TREE_TERMS, LARGE_TREE_TERMS};
+
+    printf("%-14s %-8s %8s %14s %14s %8s\n", "walk", "shape", "nodes", "recursive ns", "iterative ns", "ratio");
+
+    for (size_t size_index = 0; size_index < sizeof(sizes) / sizeof(sizes[0]); size_index++){
+        node_t * shapes[] = {makeBalanced(0, sizes[size_index]), makeChain(sizes[size_index])};
+        const char * shape_names[] = {"shallow", "deep"};
+
+        for (size_t shape = 0; shape < 2; shape++){
+            size_t tree_size = treeSize(shapes[shape]);
+
+            for (size_t walk = 0; walk < sizeof(walks) / sizeof(walks[0]); walk++){
+                double recursive = measure(walks[walk].recursive, shapes[shape], tree_size);
+                double iterative = measure(walks[walk].iterative, shapes[shape], tree_size);
+
+                printf("%-14s %-8s %8zu %14.2f %14.2f %8.2f\n", walks[walk].name, shape_names[shape], tree_size,
+                                                                 recursive, iterative, iterative / recursive);
+            }
+        }
+
+        exprDestroy(shapes[0]);
+        exprDestroy(shapes[1]);
+    }
+
+    diffDtor(&bench_diff);
+
+    return 0;
+}